@@ -0,0 +1,51 @@
+TEMPLATE = app
+TARGET = Benchmark
+DESTDIR = ./
+QT += core gui xml opengl
+CONFIG += release console
+DEFINES += QT_LARGEFILE_SUPPORT QT_XML_LIB QT_OPENGL_LIB qh_QHpointer QT_DLL
+
+INCLUDEPATH += ./GeneratedFiles \
+    ./GeneratedFiles/Release \
+    . \
+    ./GraphicsLibrary/Mesh/SurfaceMesh \
+    ./Utility \
+    ./Stacker \
+    ./GraphicsLibrary/Skeleton \
+    ./GraphicsLibrary/Skeleton/Solver/UmfPack_include/UMFPACK \
+    ./GraphicsLibrary/Skeleton/Solver/UmfPack_include/AMD \
+    ./GraphicsLibrary/Skeleton/Solver/UmfPack_include/UFconfig \
+
+win32{
+    LIBS += -L"./GUI/Viewer/libQGLViewer/QGLViewer/lib" \
+        -L"./GraphicsLibrary/Skeleton/Solver/lib" \
+        -lopengl32 \
+        -lglu32 \
+        -lQGLViewer2 \
+        -lpsapi \
+        -llibamd \
+        -llibumfpack
+}
+
+unix {
+    LIBS += -L$$PWD/GraphicsLibrary/Skeleton/Solver/lib/ -lumfpack
+    LIBS += -L$$PWD/GraphicsLibrary/Skeleton/Solver/lib/ -lamd
+
+    LIBS += -lGLEW -lGLU -lGL -lQGLViewer
+}
+
+DEPENDPATH += .
+MOC_DIR += ./GeneratedFiles/release
+OBJECTS_DIR += release
+UI_DIR += ./GeneratedFiles
+RCC_DIR += ./GeneratedFiles
+include(Workspace.pri)
+
+# The benchmark replaces the GUI entry point
+SOURCES -= ./GUI/main.cpp
+SOURCES += ./Benchmark/main.cpp
+win32:QMAKE_CXXFLAGS += /openmp
+unix {
+    QMAKE_CXXFLAGS += -fopenmp
+    LIBS += -fopenmp
+}
@@ -0,0 +1,261 @@
+// Stackability benchmark
+// Times every stage of the envelope pipeline over a folder of shapes, at several
+// envelope resolutions and cone sizes, and writes the results as CSV and JSON.
+//
+// Usage: Benchmark [folder = data] [output = benchmark] [--recursive] [--convert] [--load]
+//
+// With --convert, every OBJ/OFF/STL shape of the folder (with its .seg, .ctrl and .grp)
+// is written next to it as a binary .sgm file, then the program exits.
+// With --load, only the loading of the shapes is timed, in MB/s, to output_load.csv.
+
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "GraphicsLibrary/Mesh/QSegMesh.h"
+#include "GraphicsLibrary/Mesh/MeshReader.h"
+#include "Stacker/Controller.h"
+#include "Stacker/Offset.h"
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// High-water mark of the resident memory of the process, in MB
+double peakMemory()
+{
+#ifdef Q_OS_WIN
+	PROCESS_MEMORY_COUNTERS pmc;
+	GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+	return pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef Q_OS_MAC
+	return usage.ru_maxrss / (1024.0 * 1024.0);	// bytes
+#else
+	return usage.ru_maxrss / 1024.0;				// kilobytes
+#endif
+#endif
+}
+
+// Same as QMeshDoc::importObject(), without the document
+QSegMesh * loadShape( QString fileName )
+{
+	QSegMesh * mesh = new QSegMesh();
+	mesh->read(fileName);
+	mesh->setObjectName(QFileInfo(fileName).completeBaseName());
+
+	QString ctrlFile = fileName;
+	ctrlFile.chop(3); ctrlFile += "ctrl";
+
+	if(mesh->attachments.contains("ctrl"))
+	{
+		std::istringstream ctrlStream(mesh->attachments["ctrl"].constData());
+		Controller * ctrl = new Controller(mesh, ctrlStream);
+		mesh->ptr["controller"] = ctrl;
+
+		if(mesh->attachments.contains("grp"))
+		{
+			std::istringstream grpStream(mesh->attachments["grp"].constData());
+			ctrl->loadGroups(grpStream);
+		}
+	}
+	else if(QFileInfo(ctrlFile).exists())
+	{
+		Controller * ctrl = new Controller(mesh, true, ctrlFile);
+		mesh->ptr["controller"] = ctrl;
+
+		QString grpFile = ctrlFile;
+		grpFile.chop(4); grpFile += "grp";
+
+		if(QFileInfo(grpFile).exists())
+		{
+			std::ifstream inF(qPrintable(grpFile), std::ios::in);
+			ctrl->loadGroups(inF);
+			inF.close();
+		}
+	}
+	else
+	{
+		mesh->ptr["controller"] = new Controller(mesh);
+	}
+
+	return mesh;
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	// Arguments
+	QStringList args = app.arguments();
+	bool isRecursive = args.removeAll("--recursive") > 0;
+	bool isConvert = args.removeAll("--convert") > 0;
+	bool isLoad = args.removeAll("--load") > 0;
+	QString folder = (args.size() > 1) ? args[1] : "data";
+	QString outputName = (args.size() > 2) ? args[2] : "benchmark";
+
+	// Settings
+	QList<int> resolutions; resolutions << 100 << 200 << 400;
+	QList<double> cones; cones << 0.05 << 0.2 << 0.5;
+	QStringList stages; stages << "render" << "readback" << "offset" << "search" << "regions" << "hotspot";
+
+	// Shapes
+	QStringList shapes;
+	QStringList filters; filters << "*.obj" << "*.off";
+	if(isConvert) filters << "*.stl"; else filters << "*.sgm";
+
+	QDirIterator it(folder, filters, QDir::Files,
+		isRecursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags);
+	while(it.hasNext()) shapes << it.next();
+	shapes.sort();
+
+	if(isConvert)
+	{
+		foreach(QString fileName, shapes)
+		{
+			QString binaryFileName = fileName.left(fileName.lastIndexOf('.')) + ".sgm";
+
+			CreateTimer(timer);
+			bool isConverted = QSegMesh::convertToBinary(fileName, binaryFileName);
+			std::cout << qPrintable(QFileInfo(fileName).fileName()) << (isConverted ? " converted in " : " failed after ")
+				<< timer.elapsed() << " ms" << std::endl;
+		}
+
+		return 0;
+	}
+
+	if(shapes.isEmpty())
+	{
+		std::cout << "No shapes found in " << qPrintable(folder) << std::endl;
+		return 1;
+	}
+
+	if(isLoad)
+	{
+		QFile loadFile(outputName + "_load.csv");
+		if(!loadFile.open(QIODevice::WriteOnly | QIODevice::Text))
+		{
+			std::cout << "Can't write " << qPrintable(outputName) << "_load.csv" << std::endl;
+			return 1;
+		}
+		QTextStream load(&loadFile);
+		load << "shape,mb,parse_ms,parse_mb_s,load_ms,load_mb_s\n";
+
+		foreach(QString fileName, shapes)
+		{
+			double mb = QFileInfo(fileName).size() / (1024.0 * 1024.0);
+
+			// Parsing alone, binary files have none
+			double parseTime = 0;
+			if(QFileInfo(fileName).suffix().toLower() != "sgm")
+			{
+				CreateTimer(parseTimer);
+				MeshData data;
+				MeshReader::read(fileName, data);
+				parseTime = parseTimer.nsecsElapsed() * 1e-6;
+			}
+
+			// Segmented mesh ready to use
+			CreateTimer(loadTimer);
+			QSegMesh mesh;
+			mesh.read(fileName);
+			double loadTime = loadTimer.nsecsElapsed() * 1e-6;
+
+			double parseRate = parseTime > 0 ? mb / (parseTime * 1e-3) : 0;
+			double loadRate = loadTime > 0 ? mb / (loadTime * 1e-3) : 0;
+
+			load << "\"" << QFileInfo(fileName).fileName() << "\"," << mb << "," << parseTime << "," << parseRate << "," << loadTime << "," << loadRate << "\n";
+			std::cout << qPrintable(QFileInfo(fileName).fileName()) << " (" << mb << " MB) parsed at " << parseRate
+				<< " MB/s, loaded at " << loadRate << " MB/s" << std::endl;
+		}
+
+		std::cout << "Results saved to " << qPrintable(outputName) << "_load.csv" << std::endl;
+		return 0;
+	}
+
+	// Output
+	QFile csvFile(outputName + ".csv"), jsonFile(outputName + ".json");
+	if(!csvFile.open(QIODevice::WriteOnly | QIODevice::Text) || !jsonFile.open(QIODevice::WriteOnly | QIODevice::Text))
+	{
+		std::cout << "Can't write " << qPrintable(outputName) << ".csv/json" << std::endl;
+		return 1;
+	}
+	QTextStream csv(&csvFile), json(&jsonFile);
+
+	csv << "shape,faces,resolution,cone,directions,stackability";
+	foreach(QString stage, stages) csv << "," << stage << "_ms";
+	csv << ",total_ms,peak_mb\n";
+
+	json << "{\n  \"baseline_peak_mb\": " << peakMemory() << ",\n  \"runs\": [";
+	bool isFirstRun = true;
+
+	foreach(QString fileName, shapes)
+	{
+		CreateTimer(loadTimer);
+		QSegMesh * mesh = loadShape(fileName);
+		double loadTime = loadTimer.nsecsElapsed() * 1e-6;
+		std::cout << qPrintable(QFileInfo(fileName).fileName()) << " (" << mesh->nbFaces() << " faces) loaded in "
+			<< loadTime << " ms, " << QFileInfo(fileName).size() / (1024.0 * 1024.0) / (loadTime * 1e-3) << " MB/s" << std::endl;
+
+		// No viewer, the envelopes are rasterized in software
+		Offset offset(NULL);
+		offset.setActiveObject(mesh);
+		offset.setSearchType(ROT_AROUND_X_AND_Y);
+
+		foreach(int resolution, resolutions)
+		{
+			foreach(double cone, cones)
+			{
+				offset.setEnvelopeResolution(resolution);
+				offset.setConeSize(cone);
+				offset.resetStageTimes();
+
+				CreateTimer(timer);
+				double stackability = offset.computeStackability();
+				offset.detectHotspots();
+				double total = timer.nsecsElapsed() * 1e-6;
+				double peak = peakMemory();
+
+				// CSV row
+				csv << "\"" << mesh->objectName() << "\"," << mesh->nbFaces() << "," << resolution << "," << cone << ","
+					<< offset.searchEvaluations << "," << stackability;
+				foreach(QString stage, stages) csv << "," << offset.stageTimes.value(stage, 0);
+				csv << "," << total << "," << peak << "\n";
+
+				// JSON object
+				json << (isFirstRun ? "\n" : ",\n");
+				json << "    {\"shape\": \"" << mesh->objectName() << "\", \"faces\": " << mesh->nbFaces()
+					<< ", \"resolution\": " << resolution << ", \"cone\": " << cone
+					<< ", \"directions\": " << offset.searchEvaluations << ", \"stackability\": " << stackability
+					<< ", \"stages_ms\": {";
+				for(int i = 0; i < stages.size(); i++)
+					json << (i ? ", " : "") << "\"" << stages[i] << "\": " << offset.stageTimes.value(stages[i], 0);
+				json << "}, \"total_ms\": " << total << ", \"peak_mb\": " << peak << "}";
+				isFirstRun = false;
+
+				std::cout << "  " << resolution << " px, cone " << cone << " : " << total << " ms, peak " << peak << " MB, "
+					<< offset.searchEvaluations << " directions (" << offset.searchSavedEvaluations << " saved)" << std::endl;
+			}
+		}
+
+		delete (Controller *) mesh->ptr["controller"];
+		delete mesh;
+	}
+
+	json << "\n  ]\n}\n";
+
+	std::cout << "Results saved to " << qPrintable(outputName) << ".csv/json" << std::endl;
+
+	return 0;
+}
@@ -4,6 +4,7 @@
 #include "Workspace.h"
 #include "MeshBrowser/MeshBrowserWidget.h"
 #include "Stacker/Controller.h"
+#include <sstream>
 
 QMeshDoc::QMeshDoc( QObject * parent ) : QObject(parent)
 {
@@ -22,7 +23,7 @@ void QMeshDoc::importObject()
 	if(workspace->activeScene == NULL) return;
 
 	// The dialog
-	QString fileName = QFileDialog::getOpenFileName(0, "Import Mesh", DEFAULT_FILE_PATH, "Mesh Files (*.obj *.off *.stl)"); 
+	QString fileName = QFileDialog::getOpenFileName(0, "Import Mesh", DEFAULT_FILE_PATH, "Mesh Files (*.obj *.off *.stl *.sgm)"); 
 	
 	// Read the file
 	QSegMesh * newMesh = importObject(fileName);
@@ -68,7 +69,20 @@ QSegMesh * QMeshDoc::importObject(QString fileName)
 	// Setup controller file name
 	fileName.chop(3);fileName += "ctrl";
 
-	if(QFileInfo(fileName).exists())
+	if(newMesh->attachments.contains("ctrl"))
+	{
+		// Stored in the binary file
+		std::istringstream ctrlStream(newMesh->attachments["ctrl"].constData());
+		Controller * ctrl = new Controller(newMesh, ctrlStream);
+		newMesh->ptr["controller"] = ctrl;
+
+		if(newMesh->attachments.contains("grp"))
+		{
+			std::istringstream grpStream(newMesh->attachments["grp"].constData());
+			ctrl->loadGroups(grpStream);
+		}
+	}
+	else if(QFileInfo(fileName).exists())
 	{
 		// Load controller
 		newMesh->ptr["controller"] = new Controller(newMesh, true, fileName);
@@ -114,7 +128,7 @@ void QMeshDoc::exportObject(QSegMesh * mesh)
 		return;
 	}
 
-	QString fileName = QFileDialog::getSaveFileName(0, "Export Mesh", DEFAULT_FILE_PATH, "Mesh Files (*.obj *.off *.stl)"); 
+	QString fileName = QFileDialog::getSaveFileName(0, "Export Mesh", DEFAULT_FILE_PATH, "Mesh Files (*.obj *.off *.stl *.sgm)"); 
 
 	// Based on file extension
 	QString ext = fileName.right(3).toLower();
@@ -124,6 +138,23 @@ void QMeshDoc::exportObject(QSegMesh * mesh)
 		mesh->saveObj(fileName);
 	}
 
+	if(ext == "sgm")
+	{
+		// Controller and groups go in the same file
+		Controller * ctrl = (Controller *) mesh->ptr["controller"];
+		if(ctrl)
+		{
+			std::ostringstream ctrlStream, grpStream;
+			ctrl->save(ctrlStream);
+			ctrl->saveGroups(grpStream);
+
+			mesh->attachments["ctrl"] = QByteArray(ctrlStream.str().c_str());
+			mesh->attachments["grp"] = QByteArray(grpStream.str().c_str());
+		}
+
+		mesh->saveBinary(fileName);
+	}
+
 	emit(printMessage(mesh->objectName() + " has been exported."));
 
 	DEFAULT_FILE_PATH = QFileInfo(fileName).absolutePath();
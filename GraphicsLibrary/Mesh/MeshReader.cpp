@@ -0,0 +1,499 @@
+#include "MeshReader.h"
+#include "GraphicsLibrary/Mesh/SurfaceMesh/Surface_mesh.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QByteArray>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#define MESH_READER_CHUNK_SIZE (1 << 20)	// Bytes of the file parsed by one thread
+#define MESH_READER_MAX_DIGITS 19			// Longer mantissas are converted by strtod
+#define MESH_READER_MAX_EXACT 22			// Powers of ten exactly represented by a double
+
+static const double powersOfTen[MESH_READER_MAX_EXACT + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+static inline bool isBlank( char c ) { return c == ' ' || c == '\t' || c == '\r'; }
+static inline bool isDigit( char c ) { return c >= '0' && c <= '9'; }
+
+static inline const char * skipBlanks( const char * p, const char * end )
+{
+	while(p < end && isBlank(*p)) p++;
+	return p;
+}
+
+static inline const char * nextLine( const char * p, const char * end )
+{
+	const char * eol = (const char *) memchr(p, '\n', end - p);
+	return eol ? eol + 1 : end;
+}
+
+bool MeshData::hasGroups() const
+{
+	if(groupNames.empty()) return false;
+
+	for(int i = 0; i < (int)faceGroup.size(); i++)
+		if(faceGroup[i] < 0) return false;
+
+	return true;
+}
+
+bool MeshReader::parseDouble( const char *& p, const char * end, double & value )
+{
+	const char * start = p = skipBlanks(p, end);
+
+	bool isNegative = false;
+	if(p < end && (*p == '-' || *p == '+')) isNegative = (*p++ == '-');
+
+	// Decimal mantissa and exponent
+	unsigned long long mantissa = 0;
+	int numDigits = 0, exponent = 0;
+	bool hasDigits = false, isTruncated = false;
+
+	for(; p < end && isDigit(*p); p++)
+	{
+		hasDigits = true;
+		if(numDigits < MESH_READER_MAX_DIGITS){ mantissa = mantissa * 10 + (*p - '0'); if(mantissa) numDigits++; }
+		else isTruncated = true;
+	}
+
+	if(p < end && *p == '.')
+	{
+		for(p++; p < end && isDigit(*p); p++)
+		{
+			hasDigits = true;
+			if(numDigits < MESH_READER_MAX_DIGITS){ mantissa = mantissa * 10 + (*p - '0'); if(mantissa) numDigits++; exponent--; }
+			else isTruncated = true;
+		}
+	}
+
+	if(!hasDigits)
+	{
+		p = start;
+		return false;
+	}
+
+	if(p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char * e = p + 1;
+		bool isNegativeExponent = false;
+		if(e < end && (*e == '-' || *e == '+')) isNegativeExponent = (*e++ == '-');
+
+		if(e < end && isDigit(*e))
+		{
+			int n = 0;
+			for(; e < end && isDigit(*e); e++)
+				if(n < 100000) n = n * 10 + (*e - '0');
+
+			exponent += isNegativeExponent ? -n : n;
+			p = e;
+		}
+	}
+
+	// Both factors are exact, so is the rounding of their product
+	if(!isTruncated && mantissa <= (1ULL << 53) && exponent >= -MESH_READER_MAX_EXACT && exponent <= MESH_READER_MAX_EXACT)
+	{
+		value = (exponent < 0) ? mantissa / powersOfTen[-exponent] : mantissa * powersOfTen[exponent];
+		if(isNegative) value = -value;
+		return true;
+	}
+
+	// The file is not null terminated, the number is copied
+	char buffer[64];
+	int length = std::min(int(p - start), 63);
+	memcpy(buffer, start, length);
+	buffer[length] = '\0';
+	value = strtod(buffer, NULL);
+
+	return true;
+}
+
+bool MeshReader::parseInt( const char *& p, const char * end, int & value )
+{
+	const char * start = p = skipBlanks(p, end);
+
+	bool isNegative = false;
+	if(p < end && (*p == '-' || *p == '+')) isNegative = (*p++ == '-');
+
+	if(p >= end || !isDigit(*p))
+	{
+		p = start;
+		return false;
+	}
+
+	long long n = 0;
+	for(; p < end && isDigit(*p); p++)
+		if(n < INT_MAX) n = n * 10 + (*p - '0');
+
+	n = std::min(n, (long long)INT_MAX);
+	value = int(isNegative ? -n : n);
+
+	return true;
+}
+
+// Lines of the file parsed by one thread
+struct MeshChunk
+{
+	MeshChunk() : begin(NULL), end(NULL), isValid(true) {}
+
+	const char * begin, * end;
+	bool isValid;
+
+	// OBJ
+	std::vector<double> points;
+	std::vector<int> faceSize;
+	std::vector<int> faceVertices;		// Relative ones count from the first vertex of the chunk
+	std::vector<int> relative;			// Positions of the relative indices in \faceVertices
+	std::vector<int> faceGroup;			// Local to the chunk
+	std::vector<QString> groupNames;
+
+	// OFF, the numbers of each line
+	std::vector<int> lineSize;
+	std::vector<double> values;
+};
+
+// Chunks of about the same size, ending at line boundaries
+static std::vector<MeshChunk> splitChunks( const char * data, size_t size )
+{
+	int numChunks = std::max(1, int(size / MESH_READER_CHUNK_SIZE));
+	std::vector<MeshChunk> chunks(numChunks);
+
+	const char * p = data, * end = data + size;
+
+	for(int i = 0; i < numChunks; i++)
+	{
+		chunks[i].begin = p;
+		p = (i + 1 == numChunks) ? end : nextLine(std::max(p, data + size * (i + 1) / numChunks), end);
+		chunks[i].end = p;
+	}
+
+	return chunks;
+}
+
+static void parseObjChunk( MeshChunk & c )
+{
+	const char * p = c.begin;
+
+	while(p < c.end)
+	{
+		const char * line = skipBlanks(p, c.end);
+		const char * end = nextLine(line, c.end);
+		p = end;
+
+		if(end - line < 2 || (line[1] != ' ' && line[1] != '\t')) continue;
+
+		// Vertex
+		if(line[0] == 'v')
+		{
+			const char * q = line + 1;
+			double x, y, z;
+
+			if(!MeshReader::parseDouble(q, end, x) || !MeshReader::parseDouble(q, end, y) || !MeshReader::parseDouble(q, end, z))
+			{
+				c.isValid = false;
+				return;
+			}
+
+			c.points.push_back(x);
+			c.points.push_back(y);
+			c.points.push_back(z);
+		}
+
+		// Face, the texture and normal indices are skipped
+		else if(line[0] == 'f')
+		{
+			const char * q = line + 1;
+			int index, size = 0, numLocal = c.points.size() / 3;
+
+			while(MeshReader::parseInt(q, end, index))
+			{
+				if(index < 0) c.relative.push_back(c.faceVertices.size());
+				c.faceVertices.push_back((index < 0) ? numLocal + index : index - 1);
+				size++;
+
+				while(q < end && !isBlank(*q) && *q != '\n') q++;
+			}
+
+			c.faceSize.push_back(size);
+			c.faceGroup.push_back(c.groupNames.size() - 1);
+		}
+
+		// Group
+		else if(line[0] == 'g')
+		{
+			c.groupNames.push_back(QString::fromUtf8(line + 2, end - line - 2).trimmed());
+		}
+	}
+}
+
+// Indices from zero over the whole file, faces with a vertex out of range are dropped
+static void resolveObjChunk( MeshChunk & c, int pointOffset, int groupOffset, int numPoints )
+{
+	for(int i = 0; i < (int)c.relative.size(); i++)
+		c.faceVertices[c.relative[i]] += pointOffset;
+
+	int numFaces = 0, numCorners = 0, corner = 0;
+
+	for(int f = 0; f < (int)c.faceSize.size(); f++)
+	{
+		int size = c.faceSize[f];
+		bool isValid = size > 2;
+
+		for(int k = 0; k < size; k++)
+		{
+			int v = c.faceVertices[corner + k];
+			isValid = isValid && v >= 0 && v < numPoints;
+		}
+
+		if(isValid)
+		{
+			for(int k = 0; k < size; k++)
+				c.faceVertices[numCorners + k] = c.faceVertices[corner + k];
+
+			c.faceSize[numFaces] = size;
+			c.faceGroup[numFaces] = groupOffset + c.faceGroup[f];
+			numFaces++;
+			numCorners += size;
+		}
+
+		corner += size;
+	}
+
+	c.faceSize.resize(numFaces);
+	c.faceGroup.resize(numFaces);
+	c.faceVertices.resize(numCorners);
+}
+
+static void appendFaces( MeshData & mesh, const std::vector<int> & faceSize, const std::vector<int> & faceVertices )
+{
+	for(int f = 0; f < (int)faceSize.size(); f++)
+		mesh.faceStart.push_back(mesh.faceStart.back() + faceSize[f]);
+
+	mesh.faceVertices.insert(mesh.faceVertices.end(), faceVertices.begin(), faceVertices.end());
+}
+
+bool MeshReader::readObj( const char * data, size_t size, MeshData & mesh )
+{
+	std::vector<MeshChunk> chunks = splitChunks(data, size);
+	int numChunks = chunks.size();
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int i = 0; i < numChunks; i++)
+		parseObjChunk(chunks[i]);
+
+	// Vertices and groups before each chunk
+	std::vector<int> pointOffset(numChunks), groupOffset(numChunks);
+	int numPoints = 0, numGroups = 0, numFaces = 0;
+
+	for(int i = 0; i < numChunks; i++)
+	{
+		if(!chunks[i].isValid) return false;
+
+		pointOffset[i] = numPoints;
+		groupOffset[i] = numGroups;
+		numPoints += chunks[i].points.size() / 3;
+		numGroups += chunks[i].groupNames.size();
+	}
+
+	#pragma omp parallel for
+	for(int i = 0; i < numChunks; i++)
+		resolveObjChunk(chunks[i], pointOffset[i], groupOffset[i], numPoints);
+
+	// Join in file order
+	for(int i = 0; i < numChunks; i++) numFaces += chunks[i].faceSize.size();
+
+	mesh.points.reserve(3 * numPoints);
+	mesh.faceStart.reserve(numFaces + 1);
+	mesh.faceGroup.reserve(numFaces);
+
+	for(int i = 0; i < numChunks; i++)
+	{
+		MeshChunk & c = chunks[i];
+
+		mesh.points.insert(mesh.points.end(), c.points.begin(), c.points.end());
+		appendFaces(mesh, c.faceSize, c.faceVertices);
+		mesh.faceGroup.insert(mesh.faceGroup.end(), c.faceGroup.begin(), c.faceGroup.end());
+		mesh.groupNames.insert(mesh.groupNames.end(), c.groupNames.begin(), c.groupNames.end());
+	}
+
+	return true;
+}
+
+static void parseOffChunk( MeshChunk & c )
+{
+	const char * p = c.begin;
+
+	while(p < c.end)
+	{
+		const char * line = skipBlanks(p, c.end);
+		const char * end = nextLine(line, c.end);
+		p = end;
+
+		int size = 0;
+		double value;
+
+		while(MeshReader::parseDouble(line, end, value))
+		{
+			c.values.push_back(value);
+			size++;
+		}
+
+		// Empty and comment lines
+		if(size) c.lineSize.push_back(size);
+	}
+}
+
+bool MeshReader::readOff( const char * data, size_t size, MeshData & mesh )
+{
+	const char * p = data, * end = data + size;
+
+	// Header, [ST][N]OFF then the counts on the same or on a following line
+	const char * line = skipBlanks(p, end);
+	const char * lineEnd = nextLine(line, end);
+
+	while(line < end && (*line == '#' || *line == '\n'))
+	{
+		line = skipBlanks(lineEnd, end);
+		lineEnd = nextLine(line, end);
+	}
+
+	if(lineEnd - line > 1 && line[0] == 'S' && line[1] == 'T') line += 2;
+	if(line < lineEnd && line[0] == 'N') line++;
+	if(lineEnd - line < 3 || strncmp(line, "OFF", 3) != 0) return false;
+	line += 3;
+
+	// Binary and the other variants are left to the Surface_mesh reader
+	if(line < lineEnd && !isBlank(*line) && *line != '\n') return false;
+
+	int numVertices = 0, numFaces = 0;
+	while(!parseInt(line, lineEnd, numVertices))
+	{
+		if(line < lineEnd && *line != '#' && *line != '\n') return false;
+
+		line = skipBlanks(lineEnd, end);
+		lineEnd = nextLine(line, end);
+		if(line >= end) return false;
+	}
+	if(!parseInt(line, lineEnd, numFaces) || numVertices < 0 || numFaces < 0) return false;
+
+	// Vertex and face lines
+	std::vector<MeshChunk> chunks = splitChunks(lineEnd, end - lineEnd);
+	int numChunks = chunks.size();
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int i = 0; i < numChunks; i++)
+		parseOffChunk(chunks[i]);
+
+	// Join in file order
+	mesh.points.reserve(3 * numVertices);
+	mesh.faceStart.reserve(numFaces + 1);
+
+	int numLines = 0;
+
+	for(int i = 0; i < numChunks; i++)
+	{
+		const MeshChunk & c = chunks[i];
+		const double * values = c.values.empty() ? NULL : &c.values[0];
+
+		for(int l = 0; l < (int)c.lineSize.size() && numLines < numVertices + numFaces; l++, numLines++)
+		{
+			int lineSize = c.lineSize[l];
+
+			if(numLines < numVertices)
+			{
+				// Normals and texture coordinates follow the position
+				if(lineSize < 3) return false;
+				mesh.points.insert(mesh.points.end(), values, values + 3);
+			}
+			else
+			{
+				int n = int(values[0]);
+				if(n < 3 || n + 1 > lineSize) return false;
+
+				bool isValid = true;
+				for(int k = 1; k <= n; k++)
+					isValid = isValid && values[k] >= 0 && values[k] < numVertices;
+
+				// Faces with a vertex out of range are dropped
+				if(isValid)
+				{
+					for(int k = 1; k <= n; k++)
+						mesh.faceVertices.push_back(int(values[k]));
+					mesh.faceStart.push_back(mesh.faceVertices.size());
+				}
+			}
+
+			values += lineSize;
+		}
+	}
+
+	if(numLines < numVertices + numFaces) return false;
+
+	mesh.faceGroup.assign(mesh.numFaces(), -1);
+
+	return true;
+}
+
+void MeshReader::fromSurfaceMesh( Surface_mesh & from, MeshData & mesh )
+{
+	Surface_mesh::Vertex_property<Point> points = from.vertex_property<Point>("v:point");
+	Surface_mesh::Vertex_iterator vit, vend = from.vertices_end();
+	Surface_mesh::Face_iterator fit, fend = from.faces_end();
+	Surface_mesh::Vertex_around_face_circulator fvit, fvend;
+
+	mesh = MeshData();
+	mesh.points.reserve(3 * from.n_vertices());
+
+	for(vit = from.vertices_begin(); vit != vend; ++vit)
+		for(int i = 0; i < 3; i++)
+			mesh.points.push_back(points[vit][i]);
+
+	for(fit = from.faces_begin(); fit != fend; ++fit)
+	{
+		fvit = fvend = from.vertices(fit);
+		do{ Surface_mesh::Vertex v = fvit; mesh.faceVertices.push_back(v.idx()); } while(++fvit != fvend);
+
+		mesh.faceStart.push_back(mesh.faceVertices.size());
+	}
+
+	mesh.faceGroup.assign(mesh.numFaces(), -1);
+}
+
+bool MeshReader::read( QString fileName, MeshData & mesh )
+{
+	mesh = MeshData();
+
+	QString ext = QFileInfo(fileName).suffix().toLower();
+
+	if(ext == "obj" || ext == "off")
+	{
+		QFile file(fileName);
+		if(!file.open(QIODevice::ReadOnly)) return false;
+
+		// Mapped when possible, else read at once
+		qint64 size = file.size();
+		uchar * mapped = size ? file.map(0, size) : NULL;
+		QByteArray buffer;
+		if(!mapped){ buffer = file.readAll(); size = buffer.size(); }
+
+		const char * data = mapped ? (const char *) mapped : buffer.constData();
+		bool isRead = (ext == "obj") ? readObj(data, size, mesh) : readOff(data, size, mesh);
+
+		if(mapped) file.unmap(mapped);
+		if(isRead) return true;
+
+		mesh = MeshData();
+	}
+
+	// STL, binary OFF and the other variants
+	Surface_mesh from;
+	if(!from.read(qPrintable(fileName))) return false;
+
+	fromSurfaceMesh(from, mesh);
+
+	return true;
+}
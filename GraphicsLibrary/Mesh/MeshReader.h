@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <QString>
+
+class Surface_mesh;
+
+// Geometry, faces and OBJ groups of a mesh file, as collected in one pass
+struct MeshData
+{
+	MeshData() : faceStart(1, 0) {}
+
+	int numVertices() const { return points.size() / 3; }
+	int numFaces() const { return faceStart.size() - 1; }
+
+	// Are all faces in a group, as segmented OBJs are
+	bool hasGroups() const;
+
+	std::vector<double> points;			// x y z of each vertex
+	std::vector<int> faceStart;			// Vertices of face i are [faceStart[i], faceStart[i+1]) in \faceVertices
+	std::vector<int> faceVertices;		// Zero based
+	std::vector<int> faceGroup;			// OBJ group of each face, -1 before the first group
+	std::vector<QString> groupNames;
+};
+
+// Reader of ASCII OBJ and OFF files. The file is split in chunks at line boundaries that
+// are parsed in parallel, then the chunks are joined in file order.
+class MeshReader
+{
+public:
+	// False when the file can't be read, or is not plain ASCII OBJ/OFF
+	static bool read( QString fileName, MeshData & mesh );
+
+	static bool readObj( const char * data, size_t size, MeshData & mesh );
+	static bool readOff( const char * data, size_t size, MeshData & mesh );
+
+	// Faces and vertices of a mesh read by the Surface_mesh readers
+	static void fromSurfaceMesh( Surface_mesh & from, MeshData & mesh );
+
+	// Number at \p, which is moved past it. False when there is none.
+	static bool parseDouble( const char *& p, const char * end, double & value );
+	static bool parseInt( const char *& p, const char * end, int & value );
+};
@@ -1,10 +1,11 @@
 ﻿#include "GUI/global.h"
 #include "GraphicsLibrary/Mesh/QSegMesh.h"
+#include "GraphicsLibrary/Mesh/MeshReader.h"
 #include <fstream>
-#include <set>
-#include <map>
+#include <algorithm>
 #include <QFile>
-#include <QTextStream>
+#include <QFileInfo>
+#include <QStringList>
 #include <QVector>
 #include "Utility/SimpleDraw.h"
 
@@ -34,6 +35,15 @@ QSegMesh::QSegMesh( const QSegMesh& from )
 	}
 
 	this->upVec = from.upVec;
+
+	this->scaleFactor = from.scaleFactor;
+	this->translation = from.translation;
+	this->val = from.val;
+	this->vec = from.vec;
+
+	// Segment names are the primitive ids
+	this->segmentName = from.segmentName;
+	this->setObjectName(from.objectName());
 }
 
 QSegMesh& QSegMesh::operator=( const QSegMesh& rhs )
@@ -56,101 +66,39 @@ QSegMesh& QSegMesh::operator=( const QSegMesh& rhs )
 	return *this;
 }
 
-void QSegMesh::checkObjSegmentation ( QString fileName, QString segFilename)
+void QSegMesh::read( QString fileName )
 {
-	// Check if there is .seg file already
-	std::fstream inF(qPrintable(segFilename), std::ios::in);
-	if (inF) return;
-
-
-	QFile file(fileName);
-	file.open(QIODevice::ReadOnly | QIODevice::Text);
-	QTextStream in(&file);
-
-	QVector<int> faceGroups;
-	bool collectingFaces = false;
-
-	while (!in.atEnd()){
-		QString line = in.readLine();
-
-		// Possible face group is coming
-		if(line.startsWith("g ")){
-			collectingFaces = true;
-			faceGroups.push_back(0);
-
-			// Get name for this segment
-			segmentName.push_back(line.replace("g ", "").trimmed());
-
-			// If no name on file, give it one
-			if(segmentName.back() == "")
-				segmentName.back() = QString("Segment %1").arg(segmentName.size());
-		}
-		
-		// Count faces
-		if(line.startsWith("f ")){
-			if(collectingFaces)
-				faceGroups.back() += 1;
-			else
-				return;
-		}
-	}
-
-	// Write segmentation file
-	QFile segFile(segFilename);
-	segFile.open(QIODevice::WriteOnly | QIODevice::Text);
-	QTextStream out(&segFile);
-
-	out << (int)faceGroups.size() << "\n";
-	out << "labels ";
-	for (int i=0;i<segmentName.size(); i++)
+	// Binary file, no parsing
+	if(QFileInfo(fileName).suffix().toLower() == "sgm")
 	{
-		out<<segmentName[i]<<" ";
-	}
-	out << "\n";
-
-
-	int offset = 0;
-
-	for(int i = 0; i < (int)faceGroups.size(); i++){
-		int fCount = faceGroups[i];
-		if(i > 0) offset += faceGroups[i-1];
-
-		for(int j = 0; j < fCount; j++)
-			out << j + offset << " " << i << "\n";
+		if(!readBinary(fileName))
+			printf("Invalid segmented mesh file: %s \n", qPrintable(fileName));
+		return;
 	}
-}
 
-void QSegMesh::read( QString fileName )
-{
-	// Load entire mesh geometry
-	QSurfaceMesh mesh;
-	mesh.read(qPrintable(fileName));
+	// Geometry, faces and OBJ groups in a single pass
+	MeshData mesh;
+	MeshReader::read(fileName, mesh);
 
 	QString file_name = fileName;
 	QString segFilename = file_name.replace(file_name.lastIndexOf('.') + 1, 3, "seg");
 
-	// Check if file include segments "g Object"
-	checkObjSegmentation(fileName, segFilename);
+	// Segment of each face, from the segmentation file or else from the OBJ groups
+	std::vector<int> faceSeg;
+	int nbSeg = 0;
 
-	// Load segmentation file
 	std::ifstream inF(qPrintable(segFilename), std::ios::in);
 
-	if (turnOffSegments || mesh.n_faces() < 1 || !inF)
+	if (turnOffSegments || mesh.numFaces() < 1)
 	{
-		// Unsegmented mesh
-		segment.push_back(new QSurfaceMesh(mesh));
+		// Unsegmented mesh / point cloud
 	}
-	else
+	else if (inF)
 	{
-		int nbSeg;
 		inF >> nbSeg;
 
-		if(nbSeg == 0)
-			segment.push_back(new QSurfaceMesh(mesh)); // non-segmented / point cloud?
-		else
+		if (nbSeg > 0)
 		{
-			nbSeg = Max(1, nbSeg);
-
 			segmentName.clear();
 			std::string str;
 			inF >> str;
@@ -168,82 +116,124 @@ void QSegMesh::read( QString fileName )
 			}
 
 			// Assign face segments
-			std::vector<int> faceSeg(mesh.n_faces());
+			faceSeg.resize(mesh.numFaces(), 0);
 			int fid, sid;
-			for (int i=0;i<(int)mesh.n_faces()&&inF;i++)
+			for (int i=0;i<mesh.numFaces()&&inF;i++)
 			{
-				inF >> fid >> sid;	
-				faceSeg[fid] = sid;
+				inF >> fid >> sid;
+				if (fid >= 0 && fid < mesh.numFaces() && sid >= 0 && sid < nbSeg)
+					faceSeg[fid] = sid;
 			}
-			inF.close();
+		}
 
-			// Create segments
-			for (int i=0;i<nbSeg;i++)
-			{
-				segment.push_back(new QSurfaceMesh());
-			}
+		inF.close();
+	}
+	else if (mesh.hasGroups())
+	{
+		// Segmented OBJ, one segment per "g" group
+		nbSeg = mesh.groupNames.size();
+		faceSeg = mesh.faceGroup;
 
-			// Create unique vertex set for each segment
-			std::vector< std::set <Surface_mesh::Vertex> > segVertices(nbSeg);
-			Surface_mesh::Face_iterator fit, fend = mesh.faces_end();
-			Surface_mesh::Vertex_around_face_circulator fvit;	
+		segmentName.clear();
+		for (int i=0;i<nbSeg;i++)
+		{
+			// If no name on file, give it one
+			if (mesh.groupNames[i].isEmpty())
+				segmentName.push_back(QString("Segment %1").arg(i + 1));
+			else
+				segmentName.push_back(mesh.groupNames[i]);
+		}
+	}
 
-			for (fit = mesh.faces_begin(); fit!=fend; ++fit)
-			{
-				Surface_mesh::Face f = fit;
-				int sid = faceSeg[f.idx()];
+	if (nbSeg < 1) faceSeg.clear();
 
-				fvit = mesh.vertices(fit);	
-				segVertices[sid].insert(fvit);
-				segVertices[sid].insert(++fvit);
-				segVertices[sid].insert(++fvit);
-			}
+	createSegments(mesh, faceSeg, Max(1, nbSeg));
+
+	// Clear any empty segments
+	for (std::vector<QSurfaceMesh*>::iterator itr=segment.begin(); itr!=segment.end(); )
+	{
+		if (!(*itr)->n_vertices())
+			itr = segment.erase(itr);
+		else
+			itr++;
+	}
+
+	// Build up
+	build_up();
+}
 
-			// Add Vertices to each segment	
-			std::vector< std::map <Surface_mesh::Vertex, Surface_mesh::Vertex> > segVerMap(nbSeg);
-			Surface_mesh::Vertex_property<Point>  points   = mesh.vertex_property<Point>("v:point");
+// Segments built straight from the file data, the vertices of the file are mapped to
+// each segment through a table. With no \faceSeg, one segment has the whole mesh.
+void QSegMesh::createSegments( const MeshData & mesh, const std::vector<int> & faceSeg, int nbSeg )
+{
+	bool isWhole = faceSeg.empty();
+	int nbFaces = mesh.numFaces(), nbVertices = mesh.numVertices();
+
+	// Faces of each segment, in file order
+	std::vector<int> segStart(nbSeg + 1, 0), segFaces(nbFaces);
+	for (int f = 0; f < nbFaces; f++)
+		segStart[(isWhole ? 0 : faceSeg[f]) + 1]++;
+	for (int i = 0; i < nbSeg; i++)
+		segStart[i + 1] += segStart[i];
+
+	std::vector<int> next(segStart.begin(), segStart.end() - 1);
+	for (int f = 0; f < nbFaces; f++)
+		segFaces[next[isWhole ? 0 : faceSeg[f]]++] = f;
+
+	// Created here, filled in parallel
+	std::vector<QSurfaceMesh*> newSegments(nbSeg);
+	for (int i = 0; i < nbSeg; i++)
+		newSegments[i] = new QSurfaceMesh();
+
+	#pragma omp parallel
+	{
+		std::vector<int> remap(nbVertices), used;
+		std::vector<Surface_mesh::Vertex> vertices;
 
-			for (int i=0;i<nbSeg;i++)
+		#pragma omp for schedule(dynamic)
+		for (int i = 0; i < nbSeg; i++)
+		{
+			// Vertices of the segment, in file order
+			used.clear();
+
+			if (isWhole)
+			{
+				for (int v = 0; v < nbVertices; v++) used.push_back(v);
+			}
+			else
 			{
-				int j = 0;
+				for (int j = segStart[i]; j < segStart[i + 1]; j++)
+					used.insert(used.end(), mesh.faceVertices.begin() + mesh.faceStart[segFaces[j]], mesh.faceVertices.begin() + mesh.faceStart[segFaces[j] + 1]);
 
-				std::set<Surface_mesh::Vertex>::iterator vit, vend = segVertices[i].end();
-				for (vit=segVertices[i].begin(); vit!=vend; vit++, j++)
-				{
-					segment[i]->add_vertex(mesh.getVertexPos(*vit));
+				std::sort(used.begin(), used.end());
+				used.erase(std::unique(used.begin(), used.end()), used.end());
+			}
 
-					segVerMap[i].insert(std::make_pair(*vit, mesh.getVertex(j)));  // Create a new index for each vertex
-				}
+			QSurfaceMesh * seg = newSegments[i];
+			int segFaceCount = segStart[i + 1] - segStart[i];
+			seg->reserve(used.size(), used.size() + segFaceCount, segFaceCount);
+
+			for (int k = 0; k < (int)used.size(); k++)
+			{
+				const double * p = &mesh.points[3 * used[k]];
+				seg->add_vertex(Point(p[0], p[1], p[2]));
+				remap[used[k]] = k;
 			}
 
-			// Add Faces to each segment
-			std::vector<Surface_mesh::Vertex>  vertices(3);
-			for (fit = mesh.faces_begin(); fit!=fend; ++fit)
+			for (int j = segStart[i]; j < segStart[i + 1]; j++)
 			{
-				Surface_mesh::Face f = fit;
-				int sid = faceSeg[f.idx()];
+				int f = segFaces[j];
 
-				fvit = mesh.vertices(fit);
-				vertices[0] = segVerMap[sid][fvit];
-				vertices[1] = segVerMap[sid][++fvit];
-				vertices[2] = segVerMap[sid][++fvit];
+				vertices.clear();
+				for (int c = mesh.faceStart[f]; c < mesh.faceStart[f + 1]; c++)
+					vertices.push_back(Surface_mesh::Vertex(remap[mesh.faceVertices[c]]));
 
-				segment[sid]->add_face(vertices);
+				seg->add_face(vertices);
 			}
 		}
 	}
 
-	// Clear any empty segments
-	for (std::vector<QSurfaceMesh*>::iterator itr=segment.begin(); itr!=segment.end(); )
-	{
-		if (!(*itr)->n_vertices())
-			itr = segment.erase(itr);
-		else
-			itr++;
-	}
-
-	// Build up
-	build_up();
+	segment.insert(segment.end(), newSegments.begin(), newSegments.end());
 }
 
 void QSegMesh::saveObj( QString fileName )
@@ -277,6 +267,253 @@ void QSegMesh::saveObj( QString fileName )
 	fclose(outF);
 }
 
+// Binary segmented mesh, 8 byte aligned so it is used straight from a memory map
+// [header][segments][attachments][vertices (double x3)][faces (uint x3, per segment)][names]
+#define SEGMESH_MAGIC "STKSGMSH"
+#define SEGMESH_VERSION 1
+
+struct SegMeshHeader
+{
+	char magic[8];
+	quint32 version;
+	quint32 numSegments;
+	quint32 numAttachments;
+	quint32 reserved;
+	quint64 numVertices, numFaces;
+	double translation[3];
+	double scaleFactor;
+};
+
+struct SegMeshSegment
+{
+	quint64 vertexOffset, numVertices;	// Offsets in bytes from the start of the file
+	quint64 faceOffset, numFaces;		// Vertex indices are local to the segment
+	quint64 nameOffset, nameSize;
+};
+
+struct SegMeshAttachment
+{
+	quint64 keyOffset, keySize;
+	quint64 dataOffset, dataSize;
+};
+
+static inline quint64 alignedSize( quint64 size )
+{
+	return (size + 7) & ~quint64(7);
+}
+
+bool QSegMesh::readBinary( QString fileName )
+{
+	QFile file(fileName);
+	if(!file.open(QIODevice::ReadOnly)) return false;
+
+	quint64 fileSize = file.size();
+	if(fileSize < sizeof(SegMeshHeader)) return false;
+
+	const uchar * data = file.map(0, fileSize);
+	if(!data) return false;
+
+	SegMeshHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	quint64 tablesSize = header.numSegments * sizeof(SegMeshSegment) + header.numAttachments * sizeof(SegMeshAttachment);
+	bool isValid = memcmp(header.magic, SEGMESH_MAGIC, 8) == 0 && header.version == SEGMESH_VERSION 
+		&& sizeof(header) + tablesSize <= fileSize;
+
+	const SegMeshSegment * segments = (const SegMeshSegment *)(data + sizeof(header));
+	const SegMeshAttachment * extras = (const SegMeshAttachment *)(segments + (isValid ? header.numSegments : 0));
+
+	// Every section has to be inside the file
+	#define SEGMESH_INSIDE(offset, size) ((offset) <= fileSize && (size) <= fileSize - (offset))
+
+	for(uint i = 0; isValid && i < header.numSegments; i++)
+	{
+		const SegMeshSegment & s = segments[i];
+		isValid = s.numVertices < fileSize && s.numFaces < fileSize
+			&& SEGMESH_INSIDE(s.vertexOffset, s.numVertices * 3 * sizeof(double))
+			&& SEGMESH_INSIDE(s.faceOffset, s.numFaces * 3 * sizeof(quint32))
+			&& SEGMESH_INSIDE(s.nameOffset, s.nameSize);
+	}
+
+	for(uint i = 0; isValid && i < header.numAttachments; i++)
+	{
+		const SegMeshAttachment & a = extras[i];
+		isValid = SEGMESH_INSIDE(a.keyOffset, a.keySize) && SEGMESH_INSIDE(a.dataOffset, a.dataSize);
+	}
+
+	#undef SEGMESH_INSIDE
+
+	std::vector<QSurfaceMesh*> newSegments;
+	QVector<QString> newNames;
+
+	for(uint i = 0; isValid && i < header.numSegments; i++)
+	{
+		const SegMeshSegment & s = segments[i];
+		const double * v = (const double *)(data + s.vertexOffset);
+		const quint32 * f = (const quint32 *)(data + s.faceOffset);
+
+		QSurfaceMesh * seg = new QSurfaceMesh();
+		newSegments.push_back(seg);
+		seg->reserve(s.numVertices, 3 * s.numFaces / 2, s.numFaces);
+
+		for(quint64 vi = 0; vi < s.numVertices; vi++)
+			seg->add_vertex(Point(v[3*vi], v[3*vi+1], v[3*vi+2]));
+
+		for(quint64 fi = 0; isValid && fi < s.numFaces; fi++)
+		{
+			const quint32 * t = f + 3 * fi;
+			isValid = t[0] < s.numVertices && t[1] < s.numVertices && t[2] < s.numVertices;
+
+			if(isValid) seg->add_triangle(Surface_mesh::Vertex(t[0]), Surface_mesh::Vertex(t[1]), Surface_mesh::Vertex(t[2]));
+		}
+
+		newNames.push_back(QString::fromUtf8((const char *)data + s.nameOffset, s.nameSize));
+	}
+
+	QMap<QString, QByteArray> newAttachments;
+	for(uint i = 0; isValid && i < header.numAttachments; i++)
+	{
+		const SegMeshAttachment & a = extras[i];
+		QString key = QString::fromUtf8((const char *)data + a.keyOffset, a.keySize);
+		newAttachments[key] = QByteArray((const char *)data + a.dataOffset, a.dataSize);
+	}
+
+	file.unmap((uchar *)data);
+
+	if(!isValid)
+	{
+		for(int i = 0; i < (int)newSegments.size(); i++) delete newSegments[i];
+		return false;
+	}
+
+	segment = newSegments;
+	segmentName = newNames;
+	attachments = newAttachments;
+
+	// Stored already normalized, keep the record of the original normalization
+	build_up();
+
+	translation = Vec3d(header.translation[0], header.translation[1], header.translation[2]);
+	scaleFactor = header.scaleFactor;
+
+	return true;
+}
+
+bool QSegMesh::saveBinary( QString fileName )
+{
+	SegMeshHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SEGMESH_MAGIC, 8);
+	header.version = SEGMESH_VERSION;
+	header.numSegments = nbSegments();
+	header.numAttachments = attachments.size();
+	header.numVertices = nbVertices();
+	header.numFaces = nbFaces();
+	for(int i = 0; i < 3; i++) header.translation[i] = translation[i];
+	header.scaleFactor = scaleFactor;
+
+	// Layout of the sections
+	std::vector<SegMeshSegment> segments(nbSegments());
+	std::vector<SegMeshAttachment> extras;
+	QByteArray strings;
+
+	quint64 offset = sizeof(header) + segments.size() * sizeof(SegMeshSegment) + attachments.size() * sizeof(SegMeshAttachment);
+
+	for(uint i = 0; i < nbSegments(); i++)
+	{
+		segments[i].vertexOffset = offset;
+		segments[i].numVertices = segment[i]->n_vertices();
+		offset += segments[i].numVertices * 3 * sizeof(double);
+	}
+
+	for(uint i = 0; i < nbSegments(); i++)
+	{
+		segments[i].faceOffset = offset;
+		segments[i].numFaces = segment[i]->n_faces();
+		offset += alignedSize(segments[i].numFaces * 3 * sizeof(quint32));
+	}
+
+	for(uint i = 0; i < nbSegments(); i++)
+	{
+		QString name = (i < (uint)segmentName.size()) ? segmentName[i] : segment[i]->objectName();
+		QByteArray bytes = name.toUtf8();
+
+		segments[i].nameOffset = offset + strings.size();
+		segments[i].nameSize = bytes.size();
+		strings += bytes;
+	}
+
+	QMapIterator<QString, QByteArray> it(attachments);
+	while(it.hasNext())
+	{
+		it.next();
+		QByteArray key = it.key().toUtf8();
+
+		SegMeshAttachment a;
+		a.keyOffset = offset + strings.size();
+		a.keySize = key.size();
+		strings += key;
+
+		a.dataOffset = offset + strings.size();
+		a.dataSize = it.value().size();
+		strings += it.value();
+
+		extras.push_back(a);
+	}
+
+	// Write
+	QFile file(fileName);
+	if(!file.open(QIODevice::WriteOnly)) return false;
+
+	file.write((const char *)&header, sizeof(header));
+	if(segments.size()) file.write((const char *)&segments[0], segments.size() * sizeof(SegMeshSegment));
+	if(extras.size()) file.write((const char *)&extras[0], extras.size() * sizeof(SegMeshAttachment));
+
+	for(uint i = 0; i < nbSegments(); i++)
+	{
+		std::vector<Point> points = segment[i]->clonePoints();
+		if(points.size()) file.write((const char *)&points[0][0], points.size() * 3 * sizeof(double));
+	}
+
+	for(uint i = 0; i < nbSegments(); i++)
+	{
+		std::vector<uint> faces = segment[i]->cloneTriangleIndices();
+		std::vector<quint32> indices(faces.begin(), faces.end());
+		indices.resize(alignedSize(indices.size() * sizeof(quint32)) / sizeof(quint32), 0);
+
+		if(indices.size()) file.write((const char *)&indices[0], indices.size() * sizeof(quint32));
+	}
+
+	file.write(strings);
+
+	bool isWritten = (quint64)file.size() == offset + strings.size();
+	file.close();
+
+	return isWritten;
+}
+
+bool QSegMesh::convertToBinary( QString fileName, QString binaryFileName )
+{
+	QSegMesh mesh;
+	mesh.read(fileName);
+	mesh.setObjectName(QFileInfo(fileName).completeBaseName());
+
+	if(!mesh.nbSegments()) return false;
+
+	// Controller and groups saved next to the mesh
+	QString baseName = fileName.left(fileName.lastIndexOf('.') + 1);
+	QStringList extras; extras << "ctrl" << "grp";
+
+	foreach(QString ext, extras)
+	{
+		QFile file(baseName + ext);
+		if(file.open(QIODevice::ReadOnly))
+			mesh.attachments[ext] = file.readAll();
+	}
+
+	return mesh.saveBinary(binaryFileName);
+}
+
 void QSegMesh::insertCopyMesh(QSurfaceMesh * newSegment)
 {
 	this->segment.push_back(new QSurfaceMesh(*newSegment));
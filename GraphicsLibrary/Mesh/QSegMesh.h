@@ -3,7 +3,9 @@
 #include <QString>
 #include <QVector>
 #include <QMap>
+#include <QByteArray>
 #include "QSurfaceMesh.h"
+#include "MeshReader.h"
 #include <vector>
 
 class QSegMesh : public QObject
@@ -41,9 +43,14 @@ public:
 
 	// Load the mesh from file
 	void read(QString fileName);
+	bool readBinary(QString fileName);
 
 	// Save the mesh
 	void saveObj(QString fileName);
+	bool saveBinary(QString fileName);
+
+	// Mesh file with its .seg, .ctrl and .grp files to a single binary file
+	static bool convertToBinary(QString fileName, QString binaryFileName);
 
 	// Build up the mesh
 	void build_up();
@@ -82,10 +89,13 @@ public:
 	QMap<QString, double> val;
 	QMap<QString, Vec3d> vec;
 
+	// Extra sections of the binary file, "ctrl" and "grp" hold the controller
+	QMap<QString, QByteArray> attachments;
+
 private:
 	std::vector<QSurfaceMesh*> segment;
-	
-	// This is useful for segmented OBJs
-	void checkObjSegmentation ( QString fileName, QString segFilename);
+
+	// Segment \faceSeg[i] gets face i of \mesh
+	void createSegments( const MeshData & mesh, const std::vector<int> & faceSeg, int nbSeg );
 
 };
@@ -0,0 +1,179 @@
+#include "ContractionSolver.h"
+#include <algorithm>
+#include <cassert>
+
+#define CONTRACTION_CG_MAX_ITERATIONS 1000
+#define CONTRACTION_CG_TOLERANCE 1e-10		// Residual relative to the right hand side
+
+ContractionSolver::ContractionSolver()
+{
+	isIterative = false;
+	numIterations = 0;
+	isAnalyzed = false;
+	n = 0;
+}
+
+void ContractionSolver::init( int numVertices, const std::vector<unsigned int> & triangles )
+{
+	n = numVertices;
+
+	// Each vertex and its neighbors, both ways
+	std::vector< std::vector<int> > columns(n);
+	for(int i = 0; i < n; i++) columns[i].push_back(i);
+
+	for(int f = 0; f + 2 < (int)triangles.size(); f += 3)
+		for(int a = 0; a < 3; a++)
+			for(int b = 0; b < 3; b++)
+				if(a != b) columns[triangles[f + b]].push_back(triangles[f + a]);
+
+	lapStart.assign(1, 0);
+	lapRows.clear();
+
+	for(int j = 0; j < n; j++)
+	{
+		std::sort(columns[j].begin(), columns[j].end());
+		columns[j].erase(std::unique(columns[j].begin(), columns[j].end()), columns[j].end());
+
+		lapRows.insert(lapRows.end(), columns[j].begin(), columns[j].end());
+		lapStart.push_back(lapRows.size());
+	}
+
+	lapValues.assign(lapRows.size(), 0);
+
+	// Entry (i, j) of L^T L when columns i and j share a row. The pattern is symmetric
+	// so the rows of column r are also the columns of row r.
+	Eigen::DynamicSparseMatrix<double> pattern(n, n);
+	std::vector<int> mark(n, -1);
+
+	for(int j = 0; j < n; j++)
+	{
+		for(int k = lapStart[j]; k < lapStart[j + 1]; k++)
+		{
+			int r = lapRows[k];
+
+			for(int l = lapStart[r]; l < lapStart[r + 1]; l++)
+			{
+				int i = lapRows[l];
+				if(mark[i] == j) continue;
+
+				mark[i] = j;
+				pattern.coeffRef(i, j) = 1;
+			}
+		}
+	}
+
+	normal = Eigen::SparseMatrix<double>(pattern);
+	isAnalyzed = false;
+}
+
+int ContractionSolver::slot( int row, int col ) const
+{
+	int result = std::lower_bound(lapRows.begin() + lapStart[col], lapRows.begin() + lapStart[col + 1], row) - lapRows.begin();
+	assert(result < lapStart[col + 1] && lapRows[result] == row);
+	return result;
+}
+
+void ContractionSolver::fillNormal( const std::vector<double> & diagonal )
+{
+	#pragma omp parallel for
+	for(int j = 0; j < n; j++)
+	{
+		for(Eigen::SparseMatrix<double>::InnerIterator it(normal, j); it; ++it)
+		{
+			int i = it.index();
+
+			// Dot product of columns i and j, rows are sorted
+			double sum = 0;
+			int a = lapStart[i], b = lapStart[j];
+
+			while(a < lapStart[i + 1] && b < lapStart[j + 1])
+			{
+				if(lapRows[a] < lapRows[b]) a++;
+				else if(lapRows[b] < lapRows[a]) b++;
+				else sum += lapValues[a++] * lapValues[b++];
+			}
+
+			if(i == j) sum += diagonal[i];
+
+			it.valueRef() = sum;
+		}
+	}
+}
+
+void ContractionSolver::solve( const std::vector<double> & diagonal, const Eigen::MatrixXd & B, Eigen::MatrixXd & X )
+{
+	fillNormal(diagonal);
+	numIterations = 0;
+
+	if(!isIterative)
+	{
+		// Ordering and symbolic factorization only depend on the pattern
+		if(!isAnalyzed)
+		{
+			cholesky.analyzePattern(normal);
+			isAnalyzed = true;
+		}
+
+		cholesky.factorize(normal);
+
+		if(cholesky.info() == Eigen::Success)
+		{
+			X = cholesky.solve(B);
+			return;
+		}
+	}
+
+	numIterations = conjugateGradient(B, X);
+}
+
+// Jacobi preconditioned conjugate gradients on each column of X
+int ContractionSolver::conjugateGradient( const Eigen::MatrixXd & B, Eigen::MatrixXd & X ) const
+{
+	int numCols = B.cols();
+
+	Eigen::VectorXd invDiagonal = Eigen::VectorXd::Ones(n);
+	for(int j = 0; j < n; j++)
+		for(Eigen::SparseMatrix<double>::InnerIterator it(normal, j); it; ++it)
+			if(it.index() == j && it.value() != 0) invDiagonal[j] = 1.0 / it.value();
+
+	Eigen::MatrixXd R = normal * X;
+	R = B - R;
+	Eigen::MatrixXd Z = invDiagonal.asDiagonal() * R;
+	Eigen::MatrixXd P = Z, AP(n, numCols);
+
+	std::vector<double> rz(numCols), threshold(numCols);
+	for(int c = 0; c < numCols; c++)
+	{
+		rz[c] = R.col(c).dot(Z.col(c));
+		threshold[c] = CONTRACTION_CG_TOLERANCE * B.col(c).norm();
+	}
+
+	int iteration = 0;
+
+	for(; iteration < CONTRACTION_CG_MAX_ITERATIONS; iteration++)
+	{
+		bool isConverged = true;
+		for(int c = 0; c < numCols; c++)
+			if(R.col(c).norm() > threshold[c]) isConverged = false;
+		if(isConverged) break;
+
+		AP = normal * P;
+
+		for(int c = 0; c < numCols; c++)
+		{
+			double pAp = P.col(c).dot(AP.col(c));
+			if(R.col(c).norm() <= threshold[c] || pAp <= 0) continue;
+
+			double alpha = rz[c] / pAp;
+			X.col(c) += alpha * P.col(c);
+			R.col(c) -= alpha * AP.col(c);
+			Z.col(c) = invDiagonal.cwiseProduct(R.col(c));
+
+			double rzNext = R.col(c).dot(Z.col(c));
+			P.col(c) = Z.col(c) + (rzNext / rz[c]) * P.col(c);
+			rz[c] = rzNext;
+		}
+	}
+
+	return iteration;
+}
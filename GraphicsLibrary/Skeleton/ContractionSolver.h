@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+// Eigen is used for sparse matrix (and solving)
+#define EIGEN_YES_I_KNOW_SPARSE_MODULE_IS_NOT_STABLE_YET
+#include <Eigen/Sparse>
+#include <Eigen/SparseExtra>
+
+// Least squares of the contraction step, [W_L L; W_H] x = [0; W_H p], solved through the
+// normal equations (L^T L + W_H^2) X = W_H^2 P with x, y and z as the columns of X.
+// The weighted Laplacian keeps the pattern of the mesh edges, only its values change, so
+// the pattern of the normal equations, its ordering and its symbolic factorization are
+// kept across iterations and only the numeric factorization is done again.
+// Conjugate gradients started from the current positions are used when the factorization
+// fails, or always with \isIterative.
+class ContractionSolver
+{
+public:
+	ContractionSolver();
+
+	// Pattern of the Laplacian of a triangle mesh, \triangles has three vertices per face
+	void init( int numVertices, const std::vector<unsigned int> & triangles );
+
+	// Index in \lapValues of entry (row, col), which is in the pattern
+	int slot( int row, int col ) const;
+
+	// Weighted Laplacian in compressed columns, the values are filled by the caller
+	std::vector<int> lapStart, lapRows;
+	std::vector<double> lapValues;
+
+	// X = (L^T L + diag(\diagonal))^-1 B, X holds the starting guess of the iterative solver
+	void solve( const std::vector<double> & diagonal, const Eigen::MatrixXd & B, Eigen::MatrixXd & X );
+
+	bool isIterative;
+	int numIterations;		// Of the last solve, 0 when it was factored
+
+private:
+	int n;
+	Eigen::SparseMatrix<double> normal;		// L^T L plus the diagonal, full pattern
+	Eigen::SimplicialCholesky< Eigen::SparseMatrix<double> > cholesky;
+	bool isAnalyzed;
+
+	void fillNormal( const std::vector<double> & diagonal );
+	int conjugateGradient( const Eigen::MatrixXd & B, Eigen::MatrixXd & X ) const;
+};
@@ -94,12 +94,15 @@ void SkeletonExtract::GeometryCollapse(int maxIter)
 
 	int iteration = 0;
 
+	// The pattern of the contraction matrix is the same at every iteration
+	mesh.fillTrianglesList();
+	solver.init(n, mesh.triangles);
+
 	do{
 		QElapsedTimer timer; timer.start();
 
 		// Build contraction matrix
-		A = BuildMatrixA();
-		ATA = A.transpose() * A;
+		BuildMatrixA();
 
 		// Apply smooth operation
 		ImplicitSmooth();
@@ -124,12 +127,14 @@ void SkeletonExtract::GeometryCollapse(int maxIter)
 	this->collapsedVertexPos = mesh.clonePoints();
 }
 
-Eigen::SparseMatrix<double> SkeletonExtract::BuildMatrixA()
+void SkeletonExtract::BuildMatrixA()
 {
 	Surface_mesh::Vertex_property< std::set<uint> > adjVF = mesh.vertex_property< std::set<uint> >("v:adjVF");
 
-	// Use dynamic sparse matrix only when filling
-	Eigen::DynamicSparseMatrix<double> matA(3 * n, n);
+	// Laplacian part, the positional weights are only on the diagonal of the normal equations
+	const std::vector<int> & colStart = solver.lapStart;
+	std::vector<double> & matA = solver.lapValues;
+	std::fill(matA.begin(), matA.end(), 0.0);
 
 	std::vector<double> areaRatio (fn);
 	std::vector<double> collapsed (n);
@@ -165,12 +170,12 @@ Eigen::SparseMatrix<double> SkeletonExtract::BuildMatrixA()
 			cot1 = cot2 = cot3 = 0;
 
 		// Assign to sparse matrix
-		matA.coeffRef(c2, c2) += -cot1; matA.coeffRef(c2, c3) += cot1;
-		matA.coeffRef(c3, c3) += -cot1; matA.coeffRef(c3, c2) += cot1;
-		matA.coeffRef(c3, c3) += -cot2; matA.coeffRef(c3, c1) += cot2;
-		matA.coeffRef(c1, c1) += -cot2; matA.coeffRef(c1, c3) += cot2;
-		matA.coeffRef(c1, c1) += -cot3; matA.coeffRef(c1, c2) += cot3;
-		matA.coeffRef(c2, c2) += -cot3; matA.coeffRef(c2, c1) += cot3;
+		matA[solver.slot(c2, c2)] += -cot1; matA[solver.slot(c2, c3)] += cot1;
+		matA[solver.slot(c3, c3)] += -cot1; matA[solver.slot(c3, c2)] += cot1;
+		matA[solver.slot(c3, c3)] += -cot2; matA[solver.slot(c3, c1)] += cot2;
+		matA[solver.slot(c1, c1)] += -cot2; matA[solver.slot(c1, c3)] += cot2;
+		matA[solver.slot(c1, c1)] += -cot3; matA[solver.slot(c1, c2)] += cot3;
+		matA[solver.slot(c2, c2)] += -cot3; matA[solver.slot(c2, c1)] += cot3;
 	}
 
 	// For each vertex
@@ -183,18 +188,22 @@ Eigen::SparseMatrix<double> SkeletonExtract::BuildMatrixA()
 		foreach(uint fi, adjF) totalRatio += areaRatio[fi];
 		totalRatio /= adjF.size();
 
-		double totalPosWeight = matA.col(i).sum();
+		double totalPosWeight = 0;
+		for (int k = colStart[i]; k < colStart[i + 1]; k++)
+			totalPosWeight += matA[k];
 
 		if (totalPosWeight > MAX_POS_WEIGHT)
 		{
 			collapsed[i] = true;
 			vertexFlag[i] = 1;
 
-			matA.col(i) /= MAX_POS_WEIGHT;
+			for (int k = colStart[i]; k < colStart[i + 1]; k++)
+				matA[k] /= MAX_POS_WEIGHT;
 		}
 
 		// normalized by row sum
-		matA.col(i) *= lapWeight[i];
+		for (int k = colStart[i]; k < colStart[i + 1]; k++)
+			matA[k] *= lapWeight[i];
 
 		// Then assign new weights
 		lapWeight[i] *= LaplacianConstraintScale;
@@ -203,45 +212,34 @@ Eigen::SparseMatrix<double> SkeletonExtract::BuildMatrixA()
 		lapWeight[i] = Min(MAX_LAP_WEIGHT, lapWeight[i]);
 		posWeight[i] = Min(MAX_POS_WEIGHT, posWeight[i]);
 	}
-
-	// Assign positional weights
-	for (int i = 0; i < n; i++)
-	{
-		matA.coeffRef(i + n, i) = posWeight[i];
-		matA.coeffRef(i + n + n, i) = OriginalPositionalConstraintWeight;
-	}
-
-	// Return as regular SparseMatrix
-	return Eigen::SparseMatrix<double> (matA);
 }
 
 void SkeletonExtract::ImplicitSmooth()
 {
-	Eigen::VectorXd ATb, x(n);
-	Eigen::VectorXd b (n * 3);
-
 	std::vector<Point> newPos = mesh.clonePoints();
-	std::vector<Point> oldPos = newPos;
 
-	Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::UmfPack> lu_of_ATA(ATA);
+	// Positional rows of A, on the diagonal of A^T A and in A^T b
+	std::vector<double> diagonal(n);
+	Eigen::MatrixXd ATb(n, 3), x(n, 3);
 
-	// for each of axis 'x' 'y' 'z'
-	for (uint i = 0; i < 3; i++)
+	for (uint j = 0; j < n; j++)
 	{
-		// Assign values
-		for (uint j = 0; j < n; j++){
-			b(j) = 0;
-			b(j + n) = oldPos[j][i] * posWeight[j];
-			b(j + n + n) = 0;
+		diagonal[j] = posWeight[j] * posWeight[j] + OriginalPositionalConstraintWeight * OriginalPositionalConstraintWeight;
+
+		// for each of axis 'x' 'y' 'z'
+		for (uint i = 0; i < 3; i++)
+		{
+			ATb(j, i) = newPos[j][i] * posWeight[j] * posWeight[j];
+			x(j, i) = newPos[j][i];
 		}
+	}
 
-		// Solve A * x = b
-		ATb = A.transpose() * b;
-		lu_of_ATA.solve(ATb, &x);
+	// Solve A^T A * x = A^T b
+	solver.solve(diagonal, ATb, x);
 
-		for (uint j = 0; j < n; j++)
-			newPos[j][i] = x[j];
-	}
+	for (uint j = 0; j < n; j++)
+		for (uint i = 0; i < 3; i++)
+			newPos[j][i] = x(j, i);
 
 	mesh.setFromPoints(newPos);
 }
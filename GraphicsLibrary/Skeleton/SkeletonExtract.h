@@ -10,10 +10,8 @@
 // Skeleton data structure
 #include "Skeleton.h"
 
-// Eigen is used for sparse matrix (and solving)
-#define EIGEN_YES_I_KNOW_SPARSE_MODULE_IS_NOT_STABLE_YET
-#include <Eigen/Sparse>
-#include <Eigen/UmfPackSupport>
+// Sparse least squares of the contraction
+#include "ContractionSolver.h"
 
 class SkeletonExtract{
 
@@ -73,8 +71,8 @@ private:
 	void EmbeddingImproving();
 
 	// Geometry collapse sub-steps:
-	Eigen::SparseMatrix<double> A, ATA;
-	Eigen::SparseMatrix<double> BuildMatrixA();
+	ContractionSolver solver;
+	void BuildMatrixA();
 	void ImplicitSmooth();
 
 	// Simplification sub-steps:
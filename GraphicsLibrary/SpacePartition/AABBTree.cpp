@@ -0,0 +1,112 @@
+#include "AABBTree.h"
+#include <algorithm>
+
+AABBTree::AABBTree( const std::vector<BoundingBox> & boxes )
+{
+	this->boxes = boxes;
+
+	std::vector<int> ids(boxes.size());
+	for(int i = 0; i < (int)ids.size(); i++) ids[i] = i;
+
+	nodes.reserve(2 * boxes.size());
+	root = build(ids, 0, ids.size());
+}
+
+// Center along one axis, for the partition around the median
+struct CenterOnAxis
+{
+	const std::vector<BoundingBox> * boxes;
+	int axis;
+	bool operator () ( int a, int b ) const { return (*boxes)[a].center[axis] < (*boxes)[b].center[axis]; }
+};
+
+int AABBTree::build( std::vector<int> & ids, int begin, int end )
+{
+	if(begin >= end) return -1;
+
+	Node node;
+	node.item = node.left = node.right = -1;
+
+	int index = nodes.size();
+
+	if(end - begin == 1)
+	{
+		node.box = boxes[ids[begin]];
+		node.item = ids[begin];
+		nodes.push_back(node);
+		return index;
+	}
+
+	Vec3d vmin = boxes[ids[begin]].vmin, vmax = boxes[ids[begin]].vmax;
+	Vec3d cmin = boxes[ids[begin]].center, cmax = cmin;
+
+	for(int i = begin + 1; i < end; i++)
+	{
+		const BoundingBox & b = boxes[ids[i]];
+
+		for(int k = 0; k < 3; k++)
+		{
+			vmin[k] = Min(vmin[k], b.vmin[k]);	vmax[k] = Max(vmax[k], b.vmax[k]);
+			cmin[k] = Min(cmin[k], b.center[k]);	cmax[k] = Max(cmax[k], b.center[k]);
+		}
+	}
+
+	node.box = BoundingBox(vmin, vmax);
+	nodes.push_back(node);
+
+	// Split where the centers are the most spread
+	Vec3d spread = cmax - cmin;
+	CenterOnAxis order; order.boxes = &boxes;
+	order.axis = (spread[0] > spread[1]) ? (spread[0] > spread[2] ? 0 : 2) : (spread[1] > spread[2] ? 1 : 2);
+
+	int median = (begin + end) / 2;
+	std::nth_element(ids.begin() + begin, ids.begin() + median, ids.begin() + end, order);
+
+	int left = build(ids, begin, median);
+	int right = build(ids, median, end);
+
+	nodes[index].left = left;
+	nodes[index].right = right;
+
+	return index;
+}
+
+void AABBTree::search( int node, const BoundingBox & box, std::vector<int> & result ) const
+{
+	if(node < 0) return;
+
+	const Node & n = nodes[node];
+	if(!n.box.intersectsBoundingBox(box)) return;
+
+	if(n.item >= 0)
+	{
+		result.push_back(n.item);
+		return;
+	}
+
+	search(n.left, box, result);
+	search(n.right, box, result);
+}
+
+std::vector<int> AABBTree::overlapping( const BoundingBox & box ) const
+{
+	std::vector<int> result;
+	search(root, box, result);
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+std::vector< std::pair<int,int> > AABBTree::overlappingPairs() const
+{
+	std::vector< std::pair<int,int> > result;
+
+	for(int i = 0; i < (int)boxes.size(); i++)
+	{
+		std::vector<int> others = overlapping(boxes[i]);
+
+		for(int k = 0; k < (int)others.size(); k++)
+			if(others[k] > i) result.push_back(std::make_pair(i, others[k]));
+	}
+
+	return result;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include "MathLibrary/Bounding/BoundingBox.h"
+
+// Bounding volume hierarchy over a fixed list of boxes, split at the median center
+// along the longest axis. Touching boxes count as overlapping.
+class AABBTree
+{
+public:
+	AABBTree( const std::vector<BoundingBox> & boxes );
+
+	// Boxes overlapping \box, in increasing order
+	std::vector<int> overlapping( const BoundingBox & box ) const;
+
+	// All pairs (i, j), i < j, of overlapping boxes, sorted
+	std::vector< std::pair<int,int> > overlappingPairs() const;
+
+private:
+	struct Node
+	{
+		BoundingBox box;
+		int item;				// Leaf box, -1 for inner nodes
+		int left, right;
+	};
+
+	std::vector<BoundingBox> boxes;
+	std::vector<Node> nodes;
+	int root;
+
+	int build( std::vector<int> & ids, int begin, int end );
+	void search( int node, const BoundingBox & box, std::vector<int> & result ) const;
+};
@@ -0,0 +1,96 @@
+#include "VoxelBitset.h"
+#include <climits>
+#include <cassert>
+
+// Index of the lowest set bit of \w, which is not zero
+static inline int lowestBit( quint64 w )
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(w);
+#else
+	// De Bruijn multiplication of the isolated bit
+	static const int table[64] = { 0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+		62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5, 63, 47, 56, 27, 60, 41, 37, 16,
+		54, 35, 52, 21, 44, 32, 23, 11, 46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6 };
+	return table[((w & (~w + 1)) * 0x03f79d71b4cb0a89ULL) >> 58];
+#endif
+}
+
+VoxelBitset::VoxelBitset()
+{
+	originZ = firstWord = numWords = 0;
+}
+
+VoxelBitset::VoxelBitset( const std::vector<Voxel> & voxels, int origin_z )
+{
+	originZ = origin_z;
+	firstWord = numWords = 0;
+
+	if(voxels.empty()) return;
+
+	minVox = Voxel(INT_MAX, INT_MAX, INT_MAX);
+	maxVox = Voxel(INT_MIN, INT_MIN, INT_MIN);
+
+	for(int i = 0; i < (int)voxels.size(); i++)
+	{
+		minVox.toMin(voxels[i]);
+		maxVox.toMax(voxels[i]);
+	}
+
+	assert(minVox.z >= originZ);
+
+	firstWord = (minVox.z - originZ) / 64;
+	numWords = (maxVox.z - originZ) / 64 - firstWord + 1;
+
+	int numRows = (maxVox.x - minVox.x + 1) * sizeY();
+	words.assign(numRows * numWords, 0);
+
+	for(int i = 0; i < (int)voxels.size(); i++)
+	{
+		const Voxel & v = voxels[i];
+		int bit = v.z - originZ;
+
+		size_t w = ((v.x - minVox.x) * sizeY() + v.y - minVox.y) * numWords + (bit / 64 - firstWord);
+		words[w] |= quint64(1) << (bit % 64);
+	}
+}
+
+std::vector<Voxel> VoxelBitset::intersection( const VoxelBitset & other ) const
+{
+	std::vector<Voxel> result;
+
+	if(isEmpty() || other.isEmpty()) return result;
+
+	assert(originZ == other.originZ);
+
+	// Overlap of the bounds
+	Voxel from = minVox, to = maxVox;
+	from.toMax(other.minVox);
+	to.toMin(other.maxVox);
+
+	if(from.x > to.x || from.y > to.y || from.z > to.z) return result;
+
+	int wordFrom = (from.z - originZ) / 64, wordTo = (to.z - originZ) / 64;
+
+	for(int x = from.x; x <= to.x; x++)
+	{
+		for(int y = from.y; y <= to.y; y++)
+		{
+			const quint64 * a = row(x, y);
+			const quint64 * b = other.row(x, y);
+
+			for(int w = wordFrom; w <= wordTo; w++)
+			{
+				quint64 both = a[w - firstWord] & b[w - other.firstWord];
+
+				while(both)
+				{
+					result.push_back(Voxel(x, y, originZ + w * 64 + lowestBit(both)));
+					both &= both - 1;
+				}
+			}
+		}
+	}
+
+	return result;
+}
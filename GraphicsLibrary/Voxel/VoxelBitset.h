@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <QtGlobal>
+#include "Utility/Macros.h"
+#include "GraphicsLibrary/Mesh/SurfaceMesh/Vector.h"
+#include "Voxel.h"
+
+// Occupancy of a voxel set over its bounds, one bit per voxel. Each (x, y) row is packed
+// along z in 64 bit words counted from \originZ, so two sets built with the same origin
+// are intersected one word at a time.
+class VoxelBitset
+{
+public:
+	VoxelBitset();
+	VoxelBitset( const std::vector<Voxel> & voxels, int originZ );
+
+	bool isEmpty() const { return words.empty(); }
+
+	// Voxels in both sets, in x, y then z order
+	std::vector<Voxel> intersection( const VoxelBitset & other ) const;
+
+	Voxel minVox, maxVox;
+
+private:
+	int originZ;
+	int firstWord, numWords;		// Words of each row, from \originZ
+	std::vector<quint64> words;		// Row of (x, y) starts at ((x - minVox.x) * sizeY + y - minVox.y) * numWords
+
+	int sizeY() const { return maxVox.y - minVox.y + 1; }
+	const quint64 * row( int x, int y ) const { return &words[((x - minVox.x) * sizeY() + y - minVox.y) * numWords]; }
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <QtGlobal>
+#include "Voxel.h"
+
+#define VOXEL_SET_MIN_CAPACITY 64			// Power of two
+#define VOXEL_SET_OFFSET (1 << 20)			// Coordinates are in [-OFFSET, OFFSET)
+#define VOXEL_SET_EMPTY (~quint64(0))
+
+// Hash set of voxels with an integer for each, open addressing with linear probing.
+// Coordinates are packed in 21 bits each, so one 64 bit key is compared per probe.
+class VoxelSet
+{
+public:
+	VoxelSet() { clear(); }
+
+	void clear()
+	{
+		keys.assign(VOXEL_SET_MIN_CAPACITY, VOXEL_SET_EMPTY);
+		values.assign(VOXEL_SET_MIN_CAPACITY, 0);
+		count = 0;
+	}
+
+	int size() const { return count; }
+
+	bool has( int x, int y, int z ) const { return slot(key(x, y, z)) >= 0; }
+
+	// Integer given to the voxel, \notFound when it is not in the set
+	int find( int x, int y, int z, int notFound = -1 ) const
+	{
+		int s = slot(key(x, y, z));
+		return (s < 0) ? notFound : values[s];
+	}
+
+	// False when the voxel is in the set already, its integer is kept
+	bool insert( int x, int y, int z, int value )
+	{
+		// Load factor under one half
+		if(2 * (count + 1) > (int)keys.size()) rehash(2 * keys.size());
+
+		quint64 k = key(x, y, z);
+		uint mask = keys.size() - 1;
+
+		for(uint i = hash(k) & mask; ; i = (i + 1) & mask)
+		{
+			if(keys[i] == k) return false;
+
+			if(keys[i] == VOXEL_SET_EMPTY)
+			{
+				keys[i] = k;
+				values[i] = value;
+				count++;
+				return true;
+			}
+		}
+	}
+
+	std::vector<Voxel> getAll() const
+	{
+		std::vector<Voxel> result;
+		result.reserve(count);
+
+		for(int i = 0; i < (int)keys.size(); i++)
+		{
+			if(keys[i] == VOXEL_SET_EMPTY) continue;
+
+			quint64 k = keys[i];
+			result.push_back(Voxel(int((k >> 42) & 0x1FFFFF) - VOXEL_SET_OFFSET,
+				int((k >> 21) & 0x1FFFFF) - VOXEL_SET_OFFSET, int(k & 0x1FFFFF) - VOXEL_SET_OFFSET));
+		}
+
+		return result;
+	}
+
+private:
+	std::vector<quint64> keys;
+	std::vector<int> values;
+	int count;
+
+	static quint64 key( int x, int y, int z )
+	{
+		return (quint64(x + VOXEL_SET_OFFSET) << 42) | (quint64(y + VOXEL_SET_OFFSET) << 21) | quint64(z + VOXEL_SET_OFFSET);
+	}
+
+	// Mixing of the 64 bit finalizer of MurmurHash3
+	static uint hash( quint64 k )
+	{
+		k ^= k >> 33; k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33; k *= 0xc4ceb9fe1a85ec53ULL;
+		k ^= k >> 33;
+		return uint(k);
+	}
+
+	int slot( quint64 k ) const
+	{
+		uint mask = keys.size() - 1;
+
+		for(uint i = hash(k) & mask; ; i = (i + 1) & mask)
+		{
+			if(keys[i] == k) return i;
+			if(keys[i] == VOXEL_SET_EMPTY) return -1;
+		}
+	}
+
+	void rehash( int capacity )
+	{
+		std::vector<quint64> oldKeys(capacity, VOXEL_SET_EMPTY);
+		std::vector<int> oldValues(capacity, 0);
+		oldKeys.swap(keys);
+		oldValues.swap(values);
+
+		uint mask = capacity - 1;
+
+		for(int j = 0; j < (int)oldKeys.size(); j++)
+		{
+			if(oldKeys[j] == VOXEL_SET_EMPTY) continue;
+
+			uint i = hash(oldKeys[j]) & mask;
+			while(keys[i] != VOXEL_SET_EMPTY) i = (i + 1) & mask;
+
+			keys[i] = oldKeys[j];
+			values[i] = oldValues[j];
+		}
+	}
+};
@@ -1,6 +1,57 @@
 #include "Voxeler.h"
 #include "Utility/SimpleDraw.h"
 #include "Utility/Stats.h"
+#include <stack>
+
+#define VOXELER_BLOCK_SIZE 256		// Faces rasterized by one thread at a time
+
+// Separating axis test of a triangle against the voxels of one size. The triangle is
+// projected once on the 13 axes, a voxel then only needs the projection of its center.
+struct TriangleVoxelTest
+{
+	TriangleVoxelTest( const Vec3d & a, const Vec3d & b, const Vec3d & c, double voxel_size )
+	{
+		voxelSize = voxel_size;
+		double h = voxel_size * 0.5;
+
+		Vec3d v[3] = { a, b, c };
+		Vec3d e[3] = { b - a, c - b, a - c };
+		Vec3d unit[3] = { Vec3d(1,0,0), Vec3d(0,1,0), Vec3d(0,0,1) };
+
+		// Box faces, triangle normal, then the edges crossed with the box axes
+		int n = 0;
+		for(int i = 0; i < 3; i++) axis[n++] = unit[i];
+		axis[n++] = cross(e[0], e[1]);
+		for(int i = 0; i < 3; i++)
+			for(int j = 0; j < 3; j++)
+				axis[n++] = cross(e[i], unit[j]);
+
+		for(int i = 0; i < 13; i++)
+		{
+			double p0 = dot(axis[i], v[0]), p1 = dot(axis[i], v[1]), p2 = dot(axis[i], v[2]);
+			minP[i] = Min(p0, Min(p1, p2));
+			maxP[i] = Max(p0, Max(p1, p2));
+			radius[i] = h * (fabs(axis[i][0]) + fabs(axis[i][1]) + fabs(axis[i][2]));
+		}
+	}
+
+	bool intersects( const Voxel & v ) const
+	{
+		Vec3d center(v.x * voxelSize, v.y * voxelSize, v.z * voxelSize);
+
+		for(int i = 0; i < 13; i++)
+		{
+			double c = dot(axis[i], center);
+			if(minP[i] - c > radius[i] || maxP[i] - c < -radius[i]) return false;
+		}
+
+		return true;
+	}
+
+	double voxelSize;
+	Vec3d axis[13];
+	double minP[13], maxP[13], radius[13];
+};
 
 Voxeler::Voxeler( QSurfaceMesh * src_mesh, double voxel_size, bool verbose /*= false*/ )
 {
@@ -15,26 +66,39 @@ Voxeler::Voxeler( QSurfaceMesh * src_mesh, double voxel_size, bool verbose /*= f
 	if(isVerbose) printf("Computing voxels..");
 
 	mesh->assignFaceArray();
+	int numFaces = mesh->face_array.size();
 
-	// For each face in mesh
-	foreach(Surface_mesh::Face f, mesh->face_array)
+	// Faces are rasterized in parallel by blocks, the voxels of each block are kept in
+	// the order of its faces so the result is the same as one face after the other
+	int numBlocks = (numFaces + VOXELER_BLOCK_SIZE - 1) / VOXELER_BLOCK_SIZE;
+	std::vector< std::vector<Voxel> > blockVoxels(numBlocks);
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int b = 0; b < numBlocks; b++)
 	{
-		FaceBounds fb = findFaceBounds( f );
+		int end = Min(numFaces, (b + 1) * VOXELER_BLOCK_SIZE);
 
-		for(int x = fb.minX; x <= fb.maxX; x++)
+		for(int i = b * VOXELER_BLOCK_SIZE; i < end; i++)
 		{
-			for(int y = fb.minY; y <= fb.maxY; y++)
-			{
-				for(int z = fb.minZ; z <= fb.maxZ; z++)
-				{
-					Voxel v(x,y,z);
-
-					if(isVoxelIntersects(v, f) && !kd.has(x,y,z)){
-						kd.insert3(v.x, v.y, v.z, voxels.size());
-						voxels.push_back( v );
-					}
-				}
-			}
+			Surface_mesh::Face f = mesh->face_array[i];
+			std::vector<Vec3d> f_vec = mesh->facePoints(f);
+			TriangleVoxelTest triangle(f_vec[0], f_vec[1], f_vec[2], voxelSize);
+			FaceBounds fb = findFaceBounds( f );
+
+			for(int x = fb.minX; x <= fb.maxX; x++)
+				for(int y = fb.minY; y <= fb.maxY; y++)
+					for(int z = fb.minZ; z <= fb.maxZ; z++)
+						if(triangle.intersects(Voxel(x,y,z)))
+							blockVoxels[b].push_back(Voxel(x,y,z));
+		}
+	}
+
+	for(int b = 0; b < numBlocks; b++)
+	{
+		foreach(Voxel v, blockVoxels[b])
+		{
+			if(voxelSet.insert(v.x, v.y, v.z, voxels.size()))
+				voxels.push_back( v );
 		}
 	}
 	
@@ -109,15 +173,9 @@ FaceBounds Voxeler::findFaceBounds( QSurfaceMesh::Face f )
 
 bool Voxeler::isVoxelIntersects( const Voxel& v, QSurfaceMesh::Face f )
 {
-	Vec3d center = Vec3d(v.x * voxelSize, v.y * voxelSize, v.z * voxelSize);
-
-	double s = voxelSize * 0.5;
-
-	BoundingBox b(center, s,s,s);
-
 	std::vector<Vec3d> f_vec =  mesh->facePoints(f);
 
-	return b.containsTriangle(f_vec[0], f_vec[1], f_vec[2]);
+	return TriangleVoxelTest(f_vec[0], f_vec[1], f_vec[2], voxelSize).intersects(v);
 }
 
 void Voxeler::draw()
@@ -140,16 +198,8 @@ void Voxeler::draw()
 
 	// DEBUG == DELETE ME:
 
-	std::vector<Voxel> temp1, temp2;// = fillOther();
-
-	std::vector<double*> insideVoxels = innerVoxels.getAll();
-	std::vector<double*> outsideVoxels = outerVoxels.getAll();
-
-	foreach(double * pos, insideVoxels)
-		temp1.push_back(Voxel(pos[0], pos[1], pos[2]));
-
-	foreach(double * pos, outsideVoxels)
-		temp2.push_back(Voxel(pos[0], pos[1], pos[2]));
+	std::vector<Voxel> temp1 = innerVoxels.getAll();
+	std::vector<Voxel> temp2 = outerVoxels.getAll();
 
 	for(int i = 0; i < (int) temp1.size(); i++){
 		Vec3d c = temp1[i];
@@ -283,67 +333,102 @@ void Voxeler::drawVoxels( const std::vector< Voxel > & voxels, double voxel_size
 	glEnable(GL_LIGHTING);
 }
 
-std::vector<Voxel> Voxeler::fillOther()
+Voxel Voxeler::gridSize()
 {
-	std::vector<Voxel> filled;
+	return Voxel(maxVox.x - minVox.x + 3, maxVox.y - minVox.y + 3, maxVox.z - minVox.z + 3);
+}
 
-	for(int x = minVox.x - 1; x <= maxVox.x + 1; x++){
-		for(int y = minVox.y - 1; y <= maxVox.y + 1; y++){
-			for(int z = minVox.z - 1; z <= maxVox.z + 1; z++){
-				if(!kd.has(x,y,z))
-					filled.push_back(Voxel(x,y,z));
-			}
-		}
-	}
+Voxel Voxeler::gridVoxel( int index )
+{
+	Voxel size = gridSize();
 
-	return filled;
+	return Voxel(minVox.x - 1 + index / (size.y * size.z), minVox.y - 1 + (index / size.z) % size.y, minVox.z - 1 + index % size.z);
 }
 
-void Voxeler::fillInsideOut(KDTree & inside, KDTree & outside)
+std::vector<char> Voxeler::labelGrid( bool isFloodOutside )
 {
-	printf("Computing inside, outside..");
+	Voxel size = gridSize();
+	int strideX = size.y * size.z, strideY = size.z;
 
-	fillOuter(outside);
+	std::vector<char> labels(size.x * strideX, EMPTY_VOXEL);
 
-	// Compute inner as complement of outside
-	for(int x = minVox.x - 1; x <= maxVox.x + 1; x++){
-		for(int y = minVox.y - 1; y <= maxVox.y + 1; y++){
-			for(int z = minVox.z - 1; z <= maxVox.z + 1; z++){
-				if(!kd.has(x,y,z) && !outside.has(x,y,z)){
-					inside.insert3(x,y,z,1);
-				}
-			}
+	foreach(Voxel v, voxels)
+		labels[(v.x - minVox.x + 1) * strideX + (v.y - minVox.y + 1) * strideY + (v.z - minVox.z + 1)] = SURFACE_VOXEL;
+
+	if(!isFloodOutside) return labels;
+
+	// Flood from the corner by runs along z, a run is filled at once and only its
+	// first voxel and the runs of its neighbors are put on the stack
+	std::stack<int> stack;
+	stack.push(labels.size() - 1);
+
+	while(!stack.empty())
+	{
+		int start = stack.top();
+		stack.pop();
+
+		if(labels[start] != EMPTY_VOXEL) continue;
+
+		// Extent of the run
+		int z = start % size.z, first = start, last = start;
+		while(first - start > -z && labels[first - 1] == EMPTY_VOXEL) first--;
+		while(last - start < size.z - 1 - z && labels[last + 1] == EMPTY_VOXEL) last++;
+
+		int x = start / strideX, y = (start / strideY) % size.y;
+
+		for(int i = first; i <= last; i++)
+		{
+			labels[i] = OUTSIDE_VOXEL;
+
+			// Starts of the neighboring runs
+			if(x > 0 && labels[i - strideX] == EMPTY_VOXEL && (i == first || labels[i - strideX - 1] != EMPTY_VOXEL)) stack.push(i - strideX);
+			if(x < size.x - 1 && labels[i + strideX] == EMPTY_VOXEL && (i == first || labels[i + strideX - 1] != EMPTY_VOXEL)) stack.push(i + strideX);
+			if(y > 0 && labels[i - strideY] == EMPTY_VOXEL && (i == first || labels[i - strideY - 1] != EMPTY_VOXEL)) stack.push(i - strideY);
+			if(y < size.y - 1 && labels[i + strideY] == EMPTY_VOXEL && (i == first || labels[i + strideY - 1] != EMPTY_VOXEL)) stack.push(i + strideY);
 		}
 	}
+
+	return labels;
 }
 
-void Voxeler::fillOuter(KDTree & outside)
+std::vector<Voxel> Voxeler::fillOther()
 {
-	std::stack<Voxel> stack;
+	std::vector<Voxel> filled;
+	std::vector<char> labels = labelGrid(false);
 
-	stack.push(maxVox + Voxel(1,1,1));
+	for(int i = 0; i < (int)labels.size(); i++)
+		if(labels[i] != SURFACE_VOXEL)
+			filled.push_back(gridVoxel(i));
 
-	while(!stack.empty())
+	return filled;
+}
+
+void Voxeler::fillInsideOut(VoxelSet & inside, VoxelSet & outside)
+{
+	printf("Computing inside, outside..");
+
+	std::vector<char> labels = labelGrid(true);
+
+	// Inner is the complement of outside
+	for(int i = 0; i < (int)labels.size(); i++)
 	{
-		// Get next square
-		Voxel c = stack.top(); // get current voxel
-		stack.pop();
+		Voxel v = gridVoxel(i);
 
-		// Base case:
-		if( !kd.has(c.x, c.y, c.z) && !outside.has(c.x, c.y, c.z) )
-		{
-			// Otherwise, add it to set of outside voxels
-			outside.insert3(c.x, c.y, c.z, 1);
+		if(labels[i] == OUTSIDE_VOXEL) outside.insert(v.x, v.y, v.z, 1);
+		if(labels[i] == EMPTY_VOXEL) inside.insert(v.x, v.y, v.z, 1);
+	}
+}
 
-			// Visit neighbors
-			if(c.x < maxVox.x + 1) stack.push( c + Voxel( 1, 0, 0) );
-			if(c.y < maxVox.y + 1) stack.push( c + Voxel( 0, 1, 0) );
-			if(c.z < maxVox.z + 1) stack.push( c + Voxel( 0, 0, 1) );
+void Voxeler::fillOuter(VoxelSet & outside)
+{
+	std::vector<char> labels = labelGrid(true);
 
-			if(c.x > minVox.x - 1) stack.push( c + Voxel(-1, 0, 0) );
-			if(c.y > minVox.y - 1) stack.push( c + Voxel( 0,-1, 0) );
-			if(c.z > minVox.z - 1) stack.push( c + Voxel( 0, 0,-1) );
-		}
+	for(int i = 0; i < (int)labels.size(); i++)
+	{
+		if(labels[i] != OUTSIDE_VOXEL) continue;
+
+		Voxel v = gridVoxel(i);
+		outside.insert(v.x, v.y, v.z, 1);
 	}
 }
 
@@ -363,7 +448,7 @@ std::vector<Voxel> Voxeler::Intersects(Voxeler * other)
 	{
 		Voxel v = minVoxeler->voxels[i];
 
-		if(maxVoxeler->kd.has(v.x, v.y, v.z))
+		if(maxVoxeler->voxelSet.has(v.x, v.y, v.z))
 			intersection.push_back(v);
 	}
 
@@ -383,10 +468,10 @@ std::map<int, Voxel> Voxeler::around(Point p)
 			for(int k = -1; k <= 1; k += 1){
 				Voxel v(x + i, y + j, z + k);
 
-				Vec3d vpos(v.x, v.y, v.z);
+				int index = voxelSet.find(v.x, v.y, v.z);
 
-				if(kd.has(v.x, v.y, v.z)){
-					result[kd.getData(&vpos[0])] = v;
+				if(index >= 0){
+					result[index] = v;
 				}
 			}
 		}
@@ -408,11 +493,8 @@ void Voxeler::grow()
 				for(int z = -1; z <= 1; z++){
 					Voxel v(curVoxel.x + x, curVoxel.y + y, curVoxel.z + z);
 
-					if(!kd.has(v.x,v.y,v.z))
-					{
-						kd.insert3(v.x, v.y, v.z, voxels.size());
+					if(voxelSet.insert(v.x, v.y, v.z, voxels.size()))
 						voxels.push_back( v );
-					}
 				}
 			}
 		}
@@ -466,15 +548,7 @@ int Voxeler::getEnclosingVoxel( Vec3d point )
 
 int Voxeler::getVoxelIndex( Voxel v )
 {
-	for(int i = 0; i < (int) voxels.size(); i++)
-	{
-		Voxel w = voxels[i];
-
-		if(w.x == v.x && w.y == v.y && w.z == v.z)
-			return i;
-	}
-
-	return -1;
+	return voxelSet.find(v.x, v.y, v.z);
 }
 
 std::vector< Point > Voxeler::getVoxelCenters()
@@ -3,6 +3,7 @@
 #include "GraphicsLibrary/Mesh/QSurfaceMesh.h"
 #include "GraphicsLibrary/SpacePartition/kdtree.h"
 #include "Voxel.h"
+#include "VoxelSet.h"
 #include "MathLibrary/Bounding/BoundingBox.h"
 
 #define glv glVertex3dv
@@ -12,10 +13,19 @@ class Voxeler
 {
 private:
 	QSurfaceMesh * mesh;
-	KDTree kd;
+
+	// Index in \voxels of each voxel
+	VoxelSet voxelSet;
 
 	// Special voxels
-	KDTree outerVoxels, innerVoxels;
+	VoxelSet outerVoxels, innerVoxels;
+
+	// Labels of the box one voxel larger than the bounds, x slowest.
+	// With \isFloodOutside the empty voxels connected to the corner are outside.
+	enum{ EMPTY_VOXEL, SURFACE_VOXEL, OUTSIDE_VOXEL };
+	std::vector<char> labelGrid( bool isFloodOutside );
+	Voxel gridVoxel( int index );
+	Voxel gridSize();
 
 public:
 	Voxeler( QSurfaceMesh * src_mesh, double voxel_size, bool verbose = false);
@@ -31,8 +41,8 @@ public:
 
 	// Find inside and outside of mesh surface
 	std::vector< Voxel > fillOther();
-	void fillInsideOut(KDTree & inside, KDTree & outside);
-	void fillOuter(KDTree & outside);
+	void fillInsideOut(VoxelSet & inside, VoxelSet & outside);
+	void fillOuter(VoxelSet & outside);
 
 	// Intersection
 	std::vector<Voxel> Intersects(Voxeler * other);
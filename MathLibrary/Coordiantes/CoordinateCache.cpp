@@ -0,0 +1,202 @@
+#include "CoordinateCache.h"
+#include "GraphicsLibrary/Mesh/QSurfaceMesh.h"
+
+#include <QDir>
+#include <QFile>
+#include <QTemporaryFile>
+#include <cstring>
+
+#ifdef Q_OS_WIN
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#define COORDINATE_CACHE_VERSION 1
+#define COORDINATE_CACHE_MAX_SIZE (qint64(1) << 30)		// Bytes on disk
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+bool CoordinateCache::isEnabled = true;
+QString CoordinateCache::directory = QDir::tempPath() + "/StackerCoordinates";
+qint64 CoordinateCache::maxSize = COORDINATE_CACHE_MAX_SIZE;
+
+struct CoordinateCacheHeader
+{
+	char magic[8];
+	quint32 version;
+	quint32 numMatrices;
+	quint64 key;
+	quint64 checksum;
+};
+
+// FNV-1a over 64 bit words
+static inline quint64 hashWords( quint64 h, const void * data, size_t numWords )
+{
+	const char * bytes = (const char *) data;
+
+	for(size_t i = 0; i < numWords; i++)
+	{
+		quint64 word;
+		memcpy(&word, bytes + i * sizeof(quint64), sizeof(quint64));
+		h = (h ^ word) * FNV_PRIME;
+	}
+
+	return h;
+}
+
+static inline quint64 hashValue( quint64 h, quint64 value )
+{
+	return hashWords(h, &value, 1);
+}
+
+quint64 CoordinateCache::key( QSurfaceMesh * mesh, CoordinateType type, const std::vector<double> & parameters )
+{
+	quint64 h = hashValue(FNV_OFFSET, type);
+
+	// Geometry
+	Surface_mesh::Vertex_property<Point> points = mesh->vertex_property<Point>("v:point");
+	h = hashValue(h, mesh->n_vertices());
+	for(uint i = 0; i < mesh->n_vertices(); i++)
+		h = hashWords(h, points[Surface_mesh::Vertex(i)].data(), 3);
+
+	// Connectivity
+	Surface_mesh::Face_iterator fit, fend = mesh->faces_end();
+	h = hashValue(h, mesh->n_faces());
+	for(fit = mesh->faces_begin(); fit != fend; ++fit)
+	{
+		std::vector<uint> faceVrts = mesh->faceVerts(fit);
+		for(int k = 0; k < (int)faceVrts.size(); k++)
+			h = hashValue(h, faceVrts[k]);
+	}
+
+	// Cage
+	h = hashValue(h, parameters.size());
+	if(parameters.size()) h = hashWords(h, &parameters[0], parameters.size());
+
+	return h;
+}
+
+QString CoordinateCache::fileName( quint64 key )
+{
+	return directory + "/" + QString::number(key, 16) + ".coord";
+}
+
+bool CoordinateCache::load( quint64 key, const QVector<CoordinateMatrix*> & matrices )
+{
+	if(!isEnabled || directory.isEmpty()) return false;
+
+	QFile file(fileName(key));
+	if(!file.open(QIODevice::ReadOnly)) return false;
+
+	qint64 headerSize = sizeof(CoordinateCacheHeader) + matrices.size() * 2 * sizeof(qint64);
+	if(file.size() < headerSize) return false;
+
+	uchar * data = file.map(0, file.size());
+	if(!data) return false;
+
+	CoordinateCacheHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	bool isValid = memcmp(header.magic, "STKCOORD", 8) == 0 && header.version == COORDINATE_CACHE_VERSION
+		&& header.numMatrices == (quint32)matrices.size() && header.key == key;
+
+	// Sizes, the file has to hold exactly these values
+	std::vector<qint64> sizes(2 * matrices.size());
+	if(sizes.size()) memcpy(&sizes[0], data + sizeof(header), sizes.size() * sizeof(qint64));
+
+	qint64 numValues = 0;
+	for(int i = 0; isValid && i < matrices.size(); i++)
+	{
+		isValid = sizes[2*i] >= 0 && sizes[2*i+1] >= 0;
+		numValues += sizes[2*i] * sizes[2*i+1];
+	}
+
+	isValid = isValid && file.size() == headerSize + numValues * (qint64)sizeof(double);
+	isValid = isValid && hashWords(FNV_OFFSET, data + headerSize, numValues) == header.checksum;
+
+	if(isValid)
+	{
+		const uchar * values = data + headerSize;
+
+		for(int i = 0; i < matrices.size(); i++)
+		{
+			matrices[i]->resize(sizes[2*i], sizes[2*i+1]);
+
+			size_t numBytes = matrices[i]->size() * sizeof(double);
+			if(numBytes) memcpy(matrices[i]->data(), values, numBytes);
+			values += numBytes;
+		}
+	}
+
+	file.unmap(data);
+
+	// Modification time is the last use
+	if(isValid) utime(QFile::encodeName(file.fileName()).constData(), NULL);
+
+	return isValid;
+}
+
+bool CoordinateCache::save( quint64 key, const QVector<const CoordinateMatrix*> & matrices )
+{
+	if(!isEnabled || directory.isEmpty()) return false;
+
+	QDir().mkpath(directory);
+
+	CoordinateCacheHeader header;
+	memcpy(header.magic, "STKCOORD", 8);
+	header.version = COORDINATE_CACHE_VERSION;
+	header.numMatrices = matrices.size();
+	header.key = key;
+	header.checksum = FNV_OFFSET;
+
+	std::vector<qint64> sizes;
+	foreach(const CoordinateMatrix * m, matrices)
+	{
+		sizes.push_back(m->rows());
+		sizes.push_back(m->cols());
+		header.checksum = hashWords(header.checksum, m->data(), m->size());
+	}
+
+	// Written aside under a unique name then renamed, a reader never sees a partial file
+	// and writers of the same key don't share the temporary one
+	QString name = fileName(key);
+	QTemporaryFile file(name + ".XXXXXX");
+	if(!file.open()) return false;
+	file.setAutoRemove(false);
+
+	bool isWritten = file.write((const char *)&header, sizeof(header)) == sizeof(header);
+	if(sizes.size()) isWritten = isWritten && file.write((const char *)&sizes[0], sizes.size() * sizeof(qint64)) == qint64(sizes.size() * sizeof(qint64));
+
+	foreach(const CoordinateMatrix * m, matrices)
+	{
+		qint64 numBytes = m->size() * sizeof(double);
+		if(numBytes) isWritten = isWritten && file.write((const char *)m->data(), numBytes) == numBytes;
+	}
+
+	file.close();
+
+	QFile::remove(name);
+	if(!isWritten || !file.rename(name))
+	{
+		file.remove();
+		return false;
+	}
+
+	evict();
+
+	return true;
+}
+
+void CoordinateCache::evict()
+{
+	QFileInfoList files = QDir(directory).entryInfoList(QStringList() << "*.coord", QDir::Files, QDir::Time);
+
+	// Most recently used first, the files past the limit are removed
+	qint64 total = 0;
+	foreach(QFileInfo info, files)
+	{
+		total += info.size();
+		if(total > maxSize) QFile::remove(info.absoluteFilePath());
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+#include "CoordinateMatrix.h"
+
+class QSurfaceMesh;
+
+enum CoordinateType{ MVC_COORDINATES, GREEN_COORDINATES };
+
+// Deformation coordinates kept on disk between sessions, so reopening a shape skips their computation.
+// A file is named by a hash of the mesh geometry and of the cage, its header repeats the key,
+// the matrix sizes and a checksum. The values follow unchanged and are read through a memory map.
+// Above \maxSize bytes the least recently used files are removed, a load marks a file as used.
+class CoordinateCache
+{
+public:
+	// Key of the coordinates of \mesh against a cage given by \parameters
+	static quint64 key( QSurfaceMesh * mesh, CoordinateType type, const std::vector<double> & parameters );
+
+	// False when there is no valid file for \key, the matrices are left unchanged
+	static bool load( quint64 key, const QVector<CoordinateMatrix*> & matrices );
+	static bool save( quint64 key, const QVector<const CoordinateMatrix*> & matrices );
+
+	static bool isEnabled;
+	static QString directory;
+	static qint64 maxSize;
+
+private:
+	static QString fileName( quint64 key );
+	static void evict();
+};
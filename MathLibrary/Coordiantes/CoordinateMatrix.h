@@ -0,0 +1,165 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <Eigen/Core>
+#include "GraphicsLibrary/Mesh/SurfaceMesh/Surface_mesh.h"
+
+// Coordinates of many points against a cage, one row per point
+typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>	CoordinateMatrix;
+
+// Positions or vectors, one row per point
+typedef Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor>	PointMatrix;
+typedef Eigen::Map<PointMatrix>										PointMatrixMap;
+
+#define COORDINATES_BLOCK_SIZE 1024		// Rows per block of the deformation product
+
+// Which coordinates of a point are kept, the others are dropped
+struct CoordinateTruncation
+{
+	CoordinateTruncation( int k = 0, double eps = 0 ) : topK(k), epsilon(eps) {}
+	bool isEnabled() const { return topK > 0 || epsilon > 0; }
+
+	int topK;			// At most this many per point, 0 for no limit
+	double epsilon;		// Smaller in magnitude are dropped
+};
+
+// Truncated coordinates of many points in compressed sparse rows
+struct SparseCoordinates
+{
+	SparseCoordinates() : numCols(0), rowStart(1, 0) {}
+
+	int rows() const { return rowStart.size() - 1; }
+	int nonZeros() const { return values.size(); }
+	size_t memory() const { return rowStart.size() * sizeof(int) + cols.size() * sizeof(int) + values.size() * sizeof(double); }
+
+	int numCols;
+	std::vector<int> rowStart;	// Entries of row i are [rowStart[i], rowStart[i+1])
+	std::vector<int> cols;
+	std::vector<double> values;
+};
+
+// Magnitude order, for selecting the largest coordinates
+struct LargerCoordinate
+{
+	const std::vector<double> * row;
+	bool operator () ( int a, int b ) const { return fabs((*row)[a]) > fabs((*row)[b]); }
+};
+
+// Keep the entries of \row selected by \truncation. With \keepSum the kept ones are
+// scaled to the sum of the full row, so partition of unity still holds.
+inline void truncateRow( const std::vector<double> & row, const CoordinateTruncation & truncation, bool keepSum,
+						std::vector<int> & cols, std::vector<double> & values )
+{
+	std::vector<int> ids;
+	double sum = 0;
+
+	for(int j = 0; j < (int)row.size(); j++)
+	{
+		sum += row[j];
+		if(fabs(row[j]) >= truncation.epsilon && row[j] != 0) ids.push_back(j);
+	}
+
+	// The largest one is kept even when under epsilon
+	if(ids.empty())
+	{
+		int largest = 0;
+		for(int j = 1; j < (int)row.size(); j++)
+			if(fabs(row[j]) > fabs(row[largest])) largest = j;
+		if(row.size()) ids.push_back(largest);
+	}
+
+	if(truncation.topK > 0 && (int)ids.size() > truncation.topK)
+	{
+		LargerCoordinate larger; larger.row = &row;
+		std::nth_element(ids.begin(), ids.begin() + truncation.topK, ids.end(), larger);
+		ids.resize(truncation.topK);
+	}
+
+	std::sort(ids.begin(), ids.end());
+
+	double keptSum = 0;
+	for(int k = 0; k < (int)ids.size(); k++)
+		keptSum += row[ids[k]];
+
+	double scale = (keepSum && fabs(keptSum) > 1e-12) ? sum / keptSum : 1.0;
+
+	cols = ids;
+	values.resize(ids.size());
+	for(int k = 0; k < (int)ids.size(); k++)
+		values[k] = row[ids[k]] * scale;
+}
+
+// Pack rows built separately, one pair of \cols and \values per point
+inline SparseCoordinates packRows( const std::vector< std::vector<int> > & cols, const std::vector< std::vector<double> > & values, int numCols )
+{
+	SparseCoordinates result;
+	result.numCols = numCols;
+	result.rowStart.resize(cols.size() + 1, 0);
+
+	for(int i = 0; i < (int)cols.size(); i++)
+		result.rowStart[i + 1] = result.rowStart[i] + cols[i].size();
+
+	result.cols.reserve(result.rowStart.back());
+	result.values.reserve(result.rowStart.back());
+
+	for(int i = 0; i < (int)cols.size(); i++)
+	{
+		result.cols.insert(result.cols.end(), cols[i].begin(), cols[i].end());
+		result.values.insert(result.values.end(), values[i].begin(), values[i].end());
+	}
+
+	return result;
+}
+
+// The vertex positions of \mesh, written in place
+inline PointMatrixMap vertexMatrix( Surface_mesh * mesh )
+{
+	Surface_mesh::Vertex_property<Point> points = mesh->vertex_property<Point>("v:point");
+	double * data = mesh->n_vertices() ? &points[Surface_mesh::Vertex(0)][0] : NULL;
+
+	return PointMatrixMap(data, mesh->n_vertices(), 3);
+}
+
+inline PointMatrix toPointMatrix( const std::vector<Vec3d> & points )
+{
+	PointMatrix result(points.size(), 3);
+
+	for(int i = 0; i < (int)points.size(); i++)
+		for(int j = 0; j < 3; j++)
+			result(i, j) = points[i][j];
+
+	return result;
+}
+
+// \result += \coordinates * \cage, one matrix product per block of rows, blocks in parallel
+inline void addCoordinateProduct( const CoordinateMatrix & coordinates, const PointMatrix & cage, PointMatrixMap & result )
+{
+	int numRows = coordinates.rows();
+	int numBlocks = (numRows + COORDINATES_BLOCK_SIZE - 1) / COORDINATES_BLOCK_SIZE;
+
+	#pragma omp parallel for
+	for(int b = 0; b < numBlocks; b++)
+	{
+		int start = b * COORDINATES_BLOCK_SIZE;
+		int count = std::min(COORDINATES_BLOCK_SIZE, numRows - start);
+
+		result.middleRows(start, count).noalias() += coordinates.middleRows(start, count) * cage;
+	}
+}
+
+// \result += \coordinates * \cage, reading only the kept entries of each row
+inline void addCoordinateProduct( const SparseCoordinates & coordinates, const PointMatrix & cage, PointMatrixMap & result )
+{
+	#pragma omp parallel for
+	for(int i = 0; i < coordinates.rows(); i++)
+	{
+		Eigen::RowVector3d p(0, 0, 0);
+
+		for(int k = coordinates.rowStart[i]; k < coordinates.rowStart[i + 1]; k++)
+			p += coordinates.values[k] * cage.row(coordinates.cols[k]);
+
+		result.row(i) += p;
+	}
+}
@@ -1,9 +1,25 @@
 #include "GCDeformation.h"
+#include "CoordinateCache.h"
 
 // Only needed for one task (when points outside cage case)
 #include <Eigen/Geometry>
 using namespace Eigen;
 
+#define GC_PACKET_SIZE 8		// Points computed together against each cage face
+#define GC_MAX_RETRY 10			// Attempts to move a degenerate point
+#define GC_NUDGE 1e-6			// Move of a degenerate point, relative to the cage radius
+#define GC_EPSILON 1e-12		// Relative size under which a triangle or plane distance is degenerate
+
+CoordinateTruncation GCDeformation::truncation;
+
+static inline bool isFinite( double x ) { return x - x == 0; }
+
+static inline Vec3d safeNormalized( const Vec3d & v )
+{
+	double len = v.norm();
+	return len > 0 ? v / len : Vec3d(0,0,0);
+}
+
 GCDeformation::GCDeformation( QSurfaceMesh * forShape, QSurfaceMesh * usingCage )
 {
 	this->shape = forShape;
@@ -12,176 +28,350 @@ GCDeformation::GCDeformation( QSurfaceMesh * forShape, QSurfaceMesh * usingCage
 	orginalCagePos = cage->clonePoints();
 	orginalCageNormal = cage->cloneFaceNormals();
 
-	coords.resize(shape->n_vertices());
+	isSparse = truncation.isEnabled();
+	truncationError = 0;
+
+	std::vector< std::vector<int> > colsV, colsN;
+	std::vector< std::vector<double> > valuesV, valuesN;
 
-	// For all points in shape, compute coordinates
+	if(isSparse)
+	{
+		colsV.resize(shape->n_vertices()); valuesV.resize(shape->n_vertices());
+		colsN.resize(shape->n_vertices()); valuesN.resize(shape->n_vertices());
+	}
+	else
+	{
+		coordV = CoordinateMatrix::Zero(shape->n_vertices(), cage->n_vertices());
+		coordN = CoordinateMatrix::Zero(shape->n_vertices(), cage->n_faces());
+	}
+
+	// For all points in shape, compute coordinates, a packet of points at a time
 	std::vector<Point> shapePoints = shape->clonePoints();
-	
-	#pragma omp parallel for
-	for (int i = 0; i < (int)shapePoints.size(); i++)
+
+	// Same shape and cage as a previous session, truncated coordinates are not kept
+	std::vector<double> cageParameters;
+	for (int i = 0; i < (int)orginalCagePos.size(); i++) cageParameters.insert(cageParameters.end(), orginalCagePos[i].data(), orginalCagePos[i].data() + 3);
+	for (int j = 0; j < (int)orginalCageNormal.size(); j++) cageParameters.insert(cageParameters.end(), orginalCageNormal[j].data(), orginalCageNormal[j].data() + 3);
+
+	quint64 cacheKey = CoordinateCache::key(shape, GREEN_COORDINATES, cageParameters);
+	if(!isSparse && CoordinateCache::load(cacheKey, QVector<CoordinateMatrix*>() << &coordV << &coordN))
 	{
-		int numRetry = 0;
+		printf(" GC coordinates: loaded from cache. ");
+		return;
+	}
+
+	CageFaces faces = cageFaces();
 
-		GreenCoordiante gc = computeCoordinates( shapePoints[i]);
-		
-		// Numerical issue, solved by adding small noise to point
-		while(!gc.valid){
-			double t = 1e-6;
-			Point q = shapePoints[i] + Vec3d(uniform(0,t), uniform(0,t), uniform(0,t));
-			gc = computeCoordinates(q);
+	int numPoints = shapePoints.size();
+	int numPackets = (numPoints + GC_PACKET_SIZE - 1) / GC_PACKET_SIZE;
+
+	CreateTimer(timer);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int b = 0; b < numPackets; b++)
+	{
+		int start = b * GC_PACKET_SIZE;
+		int count = Min(GC_PACKET_SIZE, numPoints - start);
 
-			numRetry++;
+		GreenCoordiante packet[GC_PACKET_SIZE];
+		computeCoordinates(faces, &shapePoints[start], count, packet);
 
-			if(numRetry > 10)
-				break;
+		for (int l = 0; l < count; l++)
+		{
+			int i = start + l;
+			GreenCoordiante & gc = packet[l];
+
+			if(isSparse)
+			{
+				// Vertex coordinates sum to one, kept so after truncation
+				truncateRow(gc.coord_v, truncation, true, colsV[i], valuesV[i]);
+				truncateRow(gc.coord_n, truncation, false, colsN[i], valuesN[i]);
+			}
+			else
+			{
+				coordV.row(i) = Map<RowVectorXd>(gc.coord_v.data(), gc.coord_v.size());
+				coordN.row(i) = Map<RowVectorXd>(gc.coord_n.data(), gc.coord_n.size());
+			}
 		}
+	}
+
+	int elapsed = Max(1, (int)timer.elapsed());
+	printf(" GC coordinates: %d points in %d ms, %.0f coordinates per second. ", numPoints, elapsed,
+		numPoints * double(cage->n_vertices() + cage->n_faces()) * 1000.0 / elapsed);
+
+	if(!isSparse)
+		CoordinateCache::save(cacheKey, QVector<const CoordinateMatrix*>() << &coordV << &coordN);
+
+	if(isSparse)
+	{
+		sparseV = packRows(colsV, valuesV, cage->n_vertices());
+		sparseN = packRows(colsN, valuesN, cage->n_faces());
+
+		truncationError = measureTruncation(shapePoints);
 
-		coords[i].coord_v = gc.coord_v;
-		coords[i].coord_n = gc.coord_n;
+		int numFull = shape->n_vertices() * (cage->n_vertices() + cage->n_faces());
+		printf(" GC coordinates: kept %d of %d (%.2f MB), error %g. ", sparseV.nonZeros() + sparseN.nonZeros(), 
+			numFull, (sparseV.memory() + sparseN.memory()) / (1024.0 * 1024.0), truncationError);
 	}
 }
 
-GCDeformation::GreenCoordiante GCDeformation::computeCoordinates(Vec3d point)
+double GCDeformation::measureTruncation( const std::vector<Point> & shapePoints )
 {
-	GreenCoordiante gc;
+	// Rest cage, normals are not scaled
+	PointMatrix rest = PointMatrix::Zero(shapePoints.size(), 3);
+	PointMatrixMap restMap(rest.data(), rest.rows(), 3);
 
-	Surface_mesh::Face_iterator fit, fend = cage->faces_end();
+	addCoordinateProduct(sparseV, toPointMatrix(orginalCagePos), restMap);
+	addCoordinateProduct(sparseN, toPointMatrix(orginalCageNormal), restMap);
+
+	double maxError = 0;
+	for (int i = 0; i < (int)shapePoints.size(); i++)
+	{
+		Vector3d p(shapePoints[i][0], shapePoints[i][1], shapePoints[i][2]);
+		maxError = Max(maxError, (rest.row(i).transpose() - p).norm());
+	}
 
-	gc.coord_v.resize(cage->n_vertices(), 0);
-	gc.coord_n.resize(cage->n_faces(), 0);
+	return maxError;
+}
 
-	gc.insideCage = true;
-	gc.valid = true;
+GCDeformation::CageFaces GCDeformation::cageFaces()
+{
+	CageFaces faces;
 
-	// For each face in cage
-	for(fit = cage->faces_begin(); fit != fend; ++fit)
+	int NF = cage->n_faces();
+	for (int k = 0; k < 3; k++)
 	{
-		Vec3d v[3], s, I, II, N[3], Zero(0,0,0);
+		faces.x[k].resize(NF); faces.y[k].resize(NF); faces.z[k].resize(NF);
+		faces.vid[k].resize(NF);
+	}
+	faces.nx.resize(NF); faces.ny.resize(NF); faces.nz.resize(NF);
 
+	Surface_mesh::Face_iterator fit, fend = cage->faces_end();
+	for(fit = cage->faces_begin(); fit != fend; ++fit)
+	{
 		std::vector<Vec3d> facePnts = cage->facePoints(fit);
 		std::vector<uint> faceVrts = cage->faceVerts(fit);
 		uint fi = Surface_mesh::Face(fit).idx();
-		Vec3d n = orginalCageNormal[ fi ];
-		
-		// 1) First "foreach"
-		for (int l = 0; l < 3; l++)
-			v[l] = (facePnts[l] - point);
-
-		// 2 ) Assign "p"
-		Vec3d p = dot(v[0], n) * n;
 
-		// 3) For each vertex 1, 2, 3
-		for (int l = 0; l < 3; l++) 
+		for (int k = 0; k < 3; k++)
 		{
-			int l1 = (l + 1) % 3;
+			faces.x[k][fi] = facePnts[k].x();
+			faces.y[k][fi] = facePnts[k].y();
+			faces.z[k][fi] = facePnts[k].z();
+			faces.vid[k][fi] = faceVrts[k];
+		}
 
-			double DOT = dot((cross((v[l] - p), (v[l1] - p))), n);
-			s [l] = DOT < 0.0 ? -1.0 : 1.0;  // Sign
+		faces.nx[fi] = orginalCageNormal[fi].x();
+		faces.ny[fi] = orginalCageNormal[fi].y();
+		faces.nz[fi] = orginalCageNormal[fi].z();
+	}
 
-			I [l] = GCTriInt(p,    v[l], v[l1], Zero);
-			II[l] = GCTriInt(Zero, v[l1], v[l], Zero);
+	std::vector<Point> cagePoints = cage->clonePoints();
 
-			N [l] = cross(v[l1] , v[l]).normalized();
-		}
+	faces.center = Vec3d(0,0,0);
+	for (int i = 0; i < (int)cagePoints.size(); i++)
+		faces.center += cagePoints[i];
+	faces.center /= Max(1, (int)cagePoints.size());
 
-		// 4) Psi
-		double& psi = gc.coord_n[ fi ];
-		for (int k = 0; k < 3; k++)
-			psi += s[k] * I[k];
+	faces.radius = 0;
+	for (int i = 0; i < (int)cagePoints.size(); i++)
+		faces.radius = Max(faces.radius, (cagePoints[i] - faces.center).norm());
 
-		psi = abs(psi);
+	return faces;
+}
 
-		// Robustness check (bug?)
-		if(psi != psi)
-		{
-			gc.valid = false;
-			return gc;
-		}
+GCDeformation::GreenCoordiante GCDeformation::computeCoordinates(Vec3d point)
+{
+	CageFaces faces = cageFaces();
 
-		// 5) "w"
-		Vec3d w = -psi * n;
-		for (int k = 0; k < 3; k++)
-			w += II[k] * N[k];
+	GreenCoordiante gc;
+	Point p = point;
+	computeCoordinates(faces, &p, 1, &gc);
+
+	return gc;
+}
+
+void GCDeformation::computeCoordinates( const CageFaces & faces, const Point * points, int count, GreenCoordiante * result )
+{
+	computePacket(faces, points, count, result);
 
-		// 6) Phi
-		for (int l = 0; l < 3; l++)
+	// Numerical issue, solved by moving the point slightly towards the cage center
+	for (int l = 0; l < count; l++)
+	{
+		GreenCoordiante & gc = result[l];
+
+		for (int numRetry = 1; !gc.valid && numRetry <= GC_MAX_RETRY; numRetry++)
 		{
-			int l1 = (l + 1) % 3;
+			Vec3d toCenter = safeNormalized(faces.center - points[l]);
+			if(toCenter.sqrnorm() == 0) toCenter = Vec3d(1,0,0);
 
-			double& phi = gc.coord_v[ faceVrts[l] ];
-			phi += dot(N[l1], w) / dot(N[l1], v[l]);
+			Point q = points[l] + toCenter * (faces.radius * GC_NUDGE * numRetry);
+			computePacket(faces, &q, 1, &gc);
 		}
-	}
 
-	double coord_v_sum = 0;
+		// Give up, no contribution from bad values
+		if(!gc.valid)
+		{
+			for (int i = 0; i < (int)gc.coord_v.size(); i++) if(!isFinite(gc.coord_v[i])) gc.coord_v[i] = 0;
+			for (int j = 0; j < (int)gc.coord_n.size(); j++) if(!isFinite(gc.coord_n[j])) gc.coord_n[j] = 0;
+		}
+	}
+}
 
-	for (int i = 0; i < cage->n_vertices(); ++i)
-		coord_v_sum += gc.coord_v[i];
+void GCDeformation::computePacket( const CageFaces & faces, const Point * points, int count, GreenCoordiante * result )
+{
+	int NV = cage->n_vertices(), NF = faces.size();
 
-	if(coord_v_sum < 0.5f)	gc.insideCage = false;
+	for (int l = 0; l < count; l++)
+	{
+		result[l].coord_v.assign(NV, 0);
+		result[l].coord_n.assign(NF, 0);
+		result[l].insideCage = true;
+		result[l].valid = true;
+	}
 
-	// Check if vertex is exterior to the cage
-	if (!gc.insideCage) 
+	// For each face in cage
+	for (int fi = 0; fi < NF; fi++)
 	{
-		Surface_mesh::Face closestFace;
-		double dist_min = DBL_MAX;
+		Vec3d face[3], n(faces.nx[fi], faces.ny[fi], faces.nz[fi]), Zero(0,0,0);
+		for (int k = 0; k < 3; k++)
+			face[k] = Vec3d(faces.x[k][fi], faces.y[k][fi], faces.z[k][fi]);
 
-		// find the nearest face (naive, based on Euclid distance)
-		for(fit = cage->faces_begin(); fit != fend; ++fit)
+		// For each point of the packet
+		for (int pi = 0; pi < count; pi++)
 		{
-			double dist = 0;
+			GreenCoordiante & gc = result[pi];
+			Vec3d v[3], s, I, II, N[3];
+
+			// 1) First "foreach"
+			for (int l = 0; l < 3; l++)
+				v[l] = (face[l] - points[pi]);
+
+			// 2 ) Assign "p"
+			Vec3d p = dot(v[0], n) * n;
 
-			dist += (cage->faceCenter(fit) - point).norm();
+			// 3) For each vertex 1, 2, 3
+			for (int l = 0; l < 3; l++) 
+			{
+				int l1 = (l + 1) % 3;
 
-			if (dist < dist_min){
-				dist_min = dist;
-				closestFace = fit;
+				double DOT = dot((cross((v[l] - p), (v[l1] - p))), n);
+				s [l] = DOT < 0.0 ? -1.0 : 1.0;  // Sign
+
+				I [l] = GCTriInt(p,    v[l], v[l1], Zero);
+				II[l] = GCTriInt(Zero, v[l1], v[l], Zero);
+
+				N [l] = safeNormalized(cross(v[l1] , v[l]));
 			}
-		}
 
-		// Get face points and vertex indices
-		std::vector<Vec3d> facePnts = cage->facePoints(closestFace);
-		std::vector<uint> faceVrts = cage->faceVerts(closestFace);
-		uint fi = Surface_mesh::Face(closestFace).idx();
+			// 4) Psi
+			double psi = fabs(s[0] * I[0] + s[1] * I[1] + s[2] * I[2]);
+			gc.coord_n[ fi ] += psi;
+
+			// 5) "w"
+			Vec3d w = -psi * n;
+			for (int k = 0; k < 3; k++)
+				w += II[k] * N[k];
 
-		// compute alpha[3] and beta
-		Matrix4d A;
+			// 6) Phi
+			for (int l = 0; l < 3; l++)
+			{
+				int l1 = (l + 1) % 3;
 
-		for (int i = 0; i < 3; i++){
-			Vector4d fp; fp << facePnts[i].x(), facePnts[i].y(), facePnts[i].z(), 1.0;
-			A.col(i) = fp;
+				// Point in the plane of the face, moved away below
+				double denom = dot(N[l1], v[l]);
+				if(fabs(denom) <= GC_EPSILON * v[l].norm()) gc.valid = false;
+
+				gc.coord_v[ faces.vid[l][fi] ] += dot(N[l1], w) / denom;
+			}
 		}
+	}
 
-		Vector4d fn; fn << orginalCageNormal[ fi ].x(), orginalCageNormal[ fi ].y(), orginalCageNormal[ fi ].z(), 0.0;
-		A.col(3) = fn;
+	for (int pi = 0; pi < count; pi++)
+	{
+		GreenCoordiante & gc = result[pi];
+
+		double coord_v_sum = 0, coord_n_sum = 0;
+		for (int i = 0; i < NV; ++i) coord_v_sum += gc.coord_v[i];
+		for (int j = 0; j < NF; ++j) coord_n_sum += gc.coord_n[j];
 
-		Vector4d pnt; pnt << point.x(), point.y(), point.z(), 1.0;
+		// Robustness check
+		gc.valid = gc.valid && isFinite(coord_v_sum + coord_n_sum);
+		if(!gc.valid) continue;
 
-		Vector4d x = A.fullPivLu().solve(pnt);
+		if(coord_v_sum < 0.5f)	gc.insideCage = false;
 
-		// Set special coordinates
-		for (int i = 0; i < 3; i++)
-			gc.coord_v[ faceVrts[i] ] += x[i];
-		gc.coord_n[ fi ] += x[3];
+		// Check if vertex is exterior to the cage
+		if (!gc.insideCage)
+			setExterior(faces, points[pi], gc);
 	}
+}
 
-	return gc;
+void GCDeformation::setExterior( const CageFaces & faces, const Vec3d & point, GreenCoordiante & gc )
+{
+	// find the nearest face (naive, based on Euclid distance)
+	int fi = 0;
+	double dist_min = DBL_MAX;
+
+	for (int f = 0; f < faces.size(); f++)
+	{
+		Vec3d faceCenter((faces.x[0][f] + faces.x[1][f] + faces.x[2][f]) / 3.0,
+			(faces.y[0][f] + faces.y[1][f] + faces.y[2][f]) / 3.0,
+			(faces.z[0][f] + faces.z[1][f] + faces.z[2][f]) / 3.0);
+
+		double dist = (faceCenter - point).norm();
+
+		if (dist < dist_min){
+			dist_min = dist;
+			fi = f;
+		}
+	}
+
+	// compute alpha[3] and beta
+	Matrix4d A;
+
+	for (int i = 0; i < 3; i++){
+		Vector4d fp; fp << faces.x[i][fi], faces.y[i][fi], faces.z[i][fi], 1.0;
+		A.col(i) = fp;
+	}
+
+	Vector4d fn; fn << faces.nx[fi], faces.ny[fi], faces.nz[fi], 0.0;
+	A.col(3) = fn;
+
+	Vector4d pnt; pnt << point.x(), point.y(), point.z(), 1.0;
+
+	Vector4d x = A.fullPivLu().solve(pnt);
+
+	// Set special coordinates
+	for (int i = 0; i < 3; i++)
+		gc.coord_v[ faces.vid[i][fi] ] += x[i];
+	gc.coord_n[ fi ] += x[3];
 }
 
 double GCDeformation::GCTriInt(const Vec3d& p, const Vec3d& v1, const Vec3d& v2, const Vec3d& e)
 {
-	const double alpha = acos( RANGED(-1.0, dot((v2 - v1).normalized() , (p - v1).normalized()), 1.0) );
-	const double beta  = acos( RANGED(-1.0, dot((v1 - p ).normalized() , (v2 -p ).normalized()), 1.0) );
-	const double lambda = (p - v1).sqrnorm() * sin(alpha) * sin(alpha);
+	// Angles by their cosine and sine only
+	const double cosAlpha = RANGED(-1.0, dot(safeNormalized(v2 - v1) , safeNormalized(p - v1)), 1.0);
+	const double cosBeta  = RANGED(-1.0, dot(safeNormalized(v1 - p ) , safeNormalized(v2 -p )), 1.0);
+	const double sinAlpha = sqrt(1.0 - cosAlpha * cosAlpha);
+	const double sinBeta  = sqrt(1.0 - cosBeta * cosBeta);
+	const double lambda = (p - v1).sqrnorm() * sinAlpha * sinAlpha;
+
+	// Flat triangle, nothing to integrate
+	if(lambda <= GC_EPSILON * (v2 - v1).sqrnorm()) return 0;
 	const double c      = (p - e).sqrnorm();
-	const double theta[2] = { M_PI - alpha, M_PI - alpha - beta };
+	const double sqrtC = sqrt(c), sqrtLambda = sqrt(lambda);
+
+	// theta = { PI - alpha, PI - alpha - beta }
+	const double sinTheta[2] = { sinAlpha, sinAlpha * cosBeta + cosAlpha * sinBeta };
+	const double cosTheta[2] = { -cosAlpha, sinAlpha * sinBeta - cosAlpha * cosBeta };
 
 	Vec2d I(0,0);
 
 	for (int i = 0; i < 2; ++i)
 	{
-		double S = sin(theta[i]);
-		double C = cos(theta[i]);
+		double S = sinTheta[i];
+		double C = cosTheta[i];
 
 		double sign = S < 0 ? -1.0 : 0 < S ? 1.0 : 0.0;
 
@@ -190,9 +380,9 @@ double GCDeformation::GCTriInt(const Vec3d& p, const Vec3d& v1, const Vec3d& v2,
 		else
 		{
 			double M = (-sign / 2.0);
-			double N = 2 * sqrt(c) * atan((sqrt(c) * C) / sqrt(lambda + (S * S * c)));
-			double O = sqrt(lambda);
-			double P = (2 * sqrt(lambda) * S * S) / pow(1.0 - C, 2);
+			double N = (c > 0) ? 2 * sqrtC * atan((sqrtC * C) / sqrt(lambda + (S * S * c))) : 0;
+			double O = sqrtLambda;
+			double P = (2 * sqrtLambda * S * S) / ((1.0 - C) * (1.0 - C));
 			double denom = ( (c*(1+C) + lambda + sqrt((lambda * lambda) + (lambda * c * S * S)) ));
 			double Q = (2 * c * C) / denom;
 			double R = 1.0 - Q;
@@ -201,7 +391,8 @@ double GCDeformation::GCTriInt(const Vec3d& p, const Vec3d& v1, const Vec3d& v2,
 		}
 	}
 
-    double ret = (-0.25 / M_PI) * abs(I[0] - I[1] - sqrt(c) * beta);
+	double beta = (c > 0) ? acos(cosBeta) : 0;
+    double ret = (-0.25 / M_PI) * abs(I[0] - I[1] - sqrtC * beta);
 	
 	return ret;
 }
@@ -214,6 +405,8 @@ void GCDeformation::initDeform()
 	deformedCagePos = cage->clonePoints();
 
 	// Compute scale factor per face
+	S.resize(cage->n_faces());
+
 	Surface_mesh::Face_iterator fit, fend = cage->faces_end();
 	for(fit = cage->faces_begin(); fit != fend; ++fit)
 	{
@@ -227,7 +420,7 @@ void GCDeformation::initDeform()
 		Vec3d u0 = p01 - p00; Vec3d u1 = p11 - p10;
 		Vec3d v0 = p02 - p00; Vec3d v1 = p12 - p10;
 
-		S.push_back(sqrt(u1.sqrnorm() * v0.sqrnorm() - 2.0f * dot(u1, v1) * dot(u0, v0) + v1.sqrnorm() * u0.sqrnorm()) 
+		S[Surface_mesh::Face(fit).idx()] = (sqrt(u1.sqrnorm() * v0.sqrnorm() - 2.0f * dot(u1, v1) * dot(u0, v0) + v1.sqrnorm() * u0.sqrnorm()) 
 			/ (sqrt(8.0f) * cage->faceArea(fit)));
 	}
 }
@@ -250,10 +443,23 @@ void GCDeformation::deform()
 {
 	initDeform();
 
-	std::vector<Point> shapePoints = shape->clonePoints();
-	
-	for (uint i = 0; i < shapePoints.size(); i++)
-		shapePoints[i] = deformedPoint( coords[i] );
+	// Scaled normals of the deformed cage
+	PointMatrix cageN = toPointMatrix(deformedCageNormal);
+	for (uint j = 0; j < cage->n_faces(); j++)
+		cageN.row(j) *= S[j];
+
+	// All vertices at once, straight into the vertex buffer
+	PointMatrixMap vertices = vertexMatrix(shape);
 
-	shape->setFromPoints(shapePoints);
+	vertices.setZero();
+	if(isSparse)
+	{
+		addCoordinateProduct(sparseV, toPointMatrix(deformedCagePos), vertices);
+		addCoordinateProduct(sparseN, cageN, vertices);
+	}
+	else
+	{
+		addCoordinateProduct(coordV, toPointMatrix(deformedCagePos), vertices);
+		addCoordinateProduct(coordN, cageN, vertices);
+	}
 }
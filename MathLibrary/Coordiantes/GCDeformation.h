@@ -1,6 +1,7 @@
 #pragma once
 
 #include "GraphicsLibrary/Mesh/QSurfaceMesh.h"
+#include "CoordinateMatrix.h"
 
 class GCDeformation{
 
@@ -23,13 +24,38 @@ public:
 		bool valid;
 	};
 
-	std::vector< GreenCoordiante > coords;
+	// Coordinates of all shape vertices, against cage vertices and cage faces
+	CoordinateMatrix coordV, coordN;
+
+	// Only the largest coordinates, when \truncation is enabled
+	SparseCoordinates sparseV, sparseN;
+	bool isSparse;
+	double truncationError;		// Largest distance of the rest shape to its reconstruction
+
+	static CoordinateTruncation truncation;
 
 	void initDeform();
 
 	Point deformedPoint(GreenCoordiante gc);
 
+	// Cage faces in separate arrays, loaded once per face for a whole packet of points
+	struct CageFaces{
+		std::vector<double> x[3], y[3], z[3];	// Corners
+		std::vector<double> nx, ny, nz;			// Rest normals
+		std::vector<int> vid[3];
+		Vec3d center;							// Bounding sphere of the cage
+		double radius;
+		int size() const { return nx.size(); }
+	};
+
+	CageFaces cageFaces();
+
+	// Coordinates of \count points at once, degenerate points are moved inside deterministically
+	void computeCoordinates( const CageFaces & faces, const Point * points, int count, GreenCoordiante * result );
 	GCDeformation::GreenCoordiante computeCoordinates(Vec3d point);
 private:
+	void computePacket( const CageFaces & faces, const Point * points, int count, GreenCoordiante * result );
+	void setExterior( const CageFaces & faces, const Vec3d & point, GreenCoordiante & gc );
+	double measureTruncation( const std::vector<Point> & shapePoints );
 	double GCTriInt(const Vec3d& p, const Vec3d& v1, const Vec3d& v2, const Vec3d& e);
 };
@@ -1,6 +1,5 @@
 #include "Skinning.h"
 #include "GraphicsLibrary/Basic/Line.h"
-#include "DualQuat.h"
 #include "Utility/Macros.h"
 #include "GraphicsLibrary/Basic/Plane.h"
 
@@ -76,17 +75,51 @@ void Skinning::computeMeshCoordinates()
 {
 	// The coordinates are computed based the original GC \origGC
 	Surface_mesh::Vertex_property<Point> points = mesh->vertex_property<Point>("v:point");
-	Surface_mesh::Vertex_iterator vit, vend = mesh->vertices_end();
+	int numVertices = mesh->n_vertices();
 
-	coordinates.clear();
-	for (vit = mesh->vertices_begin(); vit != vend; ++vit)
+	coordinates.resize(numVertices);
+
+	#pragma omp parallel for
+	for (int vi = 0; vi < numVertices; vi++)
 	{
-		Vec3d v = points[vit];
-		coordinates.push_back(computeCoordinates(&origGC, v));
+		Vec3d v = points[Surface_mesh::Vertex(vi)];
+		coordinates[vi] = computeCoordinates(&origGC, v);
 	}
+
+	// Order the vertices by segment, a node on its own has key 2 * n1
+	int numKeys = 2 * origGC.crossSection.size();
+	std::vector<int> segmentStart(numKeys + 1, 0);
+
+	for (int vi = 0; vi < numVertices; vi++)
+		segmentStart[2 * coordinates[vi].n1 + (coordinates[vi].n1 != coordinates[vi].n2) + 1]++;
+
+	for (int k = 0; k < numKeys; k++)
+		segmentStart[k + 1] += segmentStart[k];
+
+	std::vector<int> cursor(segmentStart.begin(), segmentStart.end() - 1);
+	segmentVertices.resize(numVertices);
+
+	for (int vi = 0; vi < numVertices; vi++)
+		segmentVertices[cursor[2 * coordinates[vi].n1 + (coordinates[vi].n1 != coordinates[vi].n2)]++] = vi;
+}
+
+DualQuat Skinning::transformOfCurve( GeneralizedCylinder &orig_gc, int cid )
+{
+	Matrix3d R = rotationOfCurve(cid);
+	Vector3d T = V2E(currGC->crossSection[cid].center) - R * V2E(orig_gc.crossSection[cid].center);
+
+	DualQuat dq;
+	dq.SetTransform(R, T);
+
+	return dq;
 }
 
 Point Skinning::fromCoordinates( GeneralizedCylinder &orig_gc, SkinningCoord coords )
+{
+	return fromCoordinates(orig_gc, coords, transformOfCurve(orig_gc, coords.n1), transformOfCurve(orig_gc, coords.n2));
+}
+
+Point Skinning::fromCoordinates( GeneralizedCylinder &orig_gc, const SkinningCoord & coords, const DualQuat & dq1, const DualQuat & dq2 )
 {
 	int i1 = coords.n1;
 	int i2 = coords.n2;
@@ -121,15 +154,7 @@ Point Skinning::fromCoordinates( GeneralizedCylinder &orig_gc, SkinningCoord coo
 
 	// Rotation and translation 
 	// Using dual quaternion blending
-	Matrix3d R1 = rotationOfCurve(i1);
-	Matrix3d R2 = rotationOfCurve(i2);
-	Vector3d T1 = V2E(c1.center) - R1 * V2E(orig_c1.center);
-	Vector3d T2 = V2E(c2.center) - R2 * V2E(orig_c2.center);
-
-	DualQuat dq1, dq2, dqb;
-	dq1.SetTransform(R1, T1);
-	dq2.SetTransform(R2, T2);
-	dqb = dq1*(1-w)  +  dq2*w;
+	DualQuat dqb = dq1*(1-w)  +  dq2*w;
 
 	Matrix3d R; Vector3d T;
 	dqb.GetTransform(R, T); 
@@ -238,12 +263,20 @@ Matrix3d Skinning::rotationOfCurve( int cid )
 void Skinning::deform()
 {
 	Surface_mesh::Vertex_property<Point> points = mesh->vertex_property<Point>("v:point");
-	Surface_mesh::Vertex_iterator vit, vend = mesh->vertices_end();
 
-	for (vit = mesh->vertices_begin(); vit != vend; ++vit)
-	{		
-		int vi = Surface_mesh::Vertex(vit).idx();
-		points[vit] = fromCoordinates(origGC, coordinates[vi]);
+	// The transforms depend only on the cross sections
+	std::vector<DualQuat> transforms(currGC->crossSection.size());
+	for (int i = 0; i < (int)transforms.size(); i++)
+		transforms[i] = transformOfCurve(origGC, i);
+
+	// In segment order, neighboring vertices read the same two transforms
+	#pragma omp parallel for
+	for (int j = 0; j < (int)segmentVertices.size(); j++)
+	{
+		int vi = segmentVertices[j];
+		const SkinningCoord & c = coordinates[vi];
+
+		points[Surface_mesh::Vertex(vi)] = fromCoordinates(origGC, c, transforms[c.n1], transforms[c.n2]);
 	}
 }
 
@@ -2,6 +2,7 @@
 
 #include "GraphicsLibrary/Mesh/QSurfaceMesh.h"
 #include "GraphicsLibrary/Skeleton/GeneralizedCylinder.h"
+#include "DualQuat.h"
 #include <Eigen/Geometry>
 using namespace Eigen;
 
@@ -31,12 +32,17 @@ public:
 private:
 	SkinningCoord	computeCoordinates(GeneralizedCylinder *gc,  Point& v);
 	Point			fromCoordinates(GeneralizedCylinder &orig_gc, SkinningCoord coords);
+	Point			fromCoordinates(GeneralizedCylinder &orig_gc, const SkinningCoord & coords, const DualQuat & dq1, const DualQuat & dq2);
 	void			computeMeshCoordinates();
 	Matrix3d		rotationOfCurve(int cid);
+	DualQuat		transformOfCurve(GeneralizedCylinder &orig_gc, int cid);
 
 private:
 	QSurfaceMesh * mesh;
 	GeneralizedCylinder * currGC;
 	GeneralizedCylinder origGC;
 	std::vector< SkinningCoord > coordinates;
+
+	// Vertex indices ordered by their segment (n1, n2)
+	std::vector<int> segmentVertices;
 };
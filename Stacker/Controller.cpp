@@ -3,6 +3,9 @@
 #include <QQueue>
 #include <QTime>
 #include <QTextStream>
+#include <QVarLengthArray>
+#include <sstream>
+#include <algorithm>
 
 #include "Offset.h"
 #include "Cuboid.h"
@@ -21,28 +24,7 @@
 
 Controller::Controller( QSegMesh* mesh, bool useAABB /*= true*/, QString loadFromFile /* = ""*/ )
 {
-	m_mesh = mesh;
-
-	// BB
-	m_mesh->computeBoundingBox();
-	original_bbmin = m_mesh->bbmin;
-	original_bbmax = m_mesh->bbmax;
-
-	primTypeNames.push_back("CUBOID");
-	primTypeNames.push_back("GC");
-	primTypeNames.push_back("WIRE");
-
-	// GC along axis
-	GC_SKELETON_JOINTS_NUM = 16;
-
-	// Group types
-	groupTypes.push_back("SYMMETRY");
-	groupTypes.push_back("POINTJOINT");
-	groupTypes.push_back("LINEJOINT");
-	groupTypes.push_back("CONCENTRIC");
-	groupTypes.push_back("COPLANNAR");
-	groupTypes.push_back("SELF_SYMMETRY");
-	groupTypes.push_back("SELF_ROT_SYMMETRY");
+	setup(mesh);
 
 	if(loadFromFile.isEmpty())
 	{
@@ -60,12 +42,80 @@ Controller::Controller( QSegMesh* mesh, bool useAABB /*= true*/, QString loadFro
 	assignIds();
 }
 
+Controller::Controller( QSegMesh* mesh, std::istream &inF )
+{
+	setup(mesh);
+	load(inF);
+	assignIds();
+}
+
+void Controller::setup( QSegMesh* mesh )
+{
+	m_mesh = mesh;
+
+	// BB
+	m_mesh->computeBoundingBox();
+	original_bbmin = m_mesh->bbmin;
+	original_bbmax = m_mesh->bbmax;
+
+	setupTypeNames();
+
+	// GC along axis
+	GC_SKELETON_JOINTS_NUM = 16;
+}
+
 Controller::~Controller()
 {
 	foreach(Primitive * prim, primitives)
 		delete prim;
 }
 
+Controller * Controller::clone( QSegMesh * mesh )
+{
+	// Round trip through the file format, in memory and without normalization
+	std::stringstream primStream, groupStream;
+	primStream.precision(17);
+	groupStream.precision(17);
+	save(primStream);
+	saveGroups(groupStream);
+
+	Controller * c = new Controller(*this);
+	c->m_mesh = mesh;
+	c->primitives.clear();
+	c->groups.clear();
+	c->primitiveIdNum.clear();
+	c->stateLayout.clear();
+	c->groupSnapshots.clear();
+	c->debugPoints.clear();
+	c->debugLines.clear();
+
+	c->load(primStream, Vec3d(0,0,0), 1.0);
+	c->loadGroups(groupStream, Vec3d(0,0,0), 1.0);
+	c->assignIds();
+
+	// Distortion is still measured from the original shape
+	foreach(Primitive * prim, c->primitives)
+		prim->originalVolume = primitives[prim->id]->originalVolume;
+
+	return c;
+}
+
+void Controller::setupTypeNames()
+{
+	primTypeNames.push_back("CUBOID");
+	primTypeNames.push_back("GC");
+	primTypeNames.push_back("WIRE");
+
+	// Group types
+	groupTypes.push_back("SYMMETRY");
+	groupTypes.push_back("POINTJOINT");
+	groupTypes.push_back("LINEJOINT");
+	groupTypes.push_back("CONCENTRIC");
+	groupTypes.push_back("COPLANNAR");
+	groupTypes.push_back("SELF_SYMMETRY");
+	groupTypes.push_back("SELF_ROT_SYMMETRY");
+}
+
 void Controller::assignIds()
 {
 	foreach(Primitive * prim, primitives)
@@ -314,19 +364,61 @@ QVector<Primitive*> Controller::getPrimitives()
 	return results;
 }
 
+void Controller::updateStateLayout()
+{
+	bool isValid = (stateLayout.size() == primitives.size());
+
+	foreach(Primitive * prim, primitives)
+	{
+		if(!isValid) break;
+
+		StateSlot slot = stateLayout.value(prim->id);
+		isValid = stateLayout.contains(prim->id) && slot.type == prim->primType && slot.size == prim->stateSize();
+	}
+
+	if(isValid) return;
+
+	stateLayout.clear();
+	int offset = 0;
+
+	foreach(Primitive * prim, primitives)
+	{
+		StateSlot slot;
+		slot.type = prim->primType;
+		slot.offset = offset;
+		slot.size = prim->stateSize();
+		stateLayout[prim->id] = slot;
+
+		offset += slot.size;
+	}
+}
+
 ShapeState Controller::getShapeState()
 {
 	ShapeState state;
 
+	// Geometry, one block from the arena
+	updateStateLayout();
+	state.allocate(stateLayout);
+
 	foreach(Primitive * prim, primitives)
-		state.primStates[prim->id] = prim->getState();
+		prim->getState(state.primValues(prim->id));
 
 	state.stacking_shift = m_mesh->vec["stacking_shift"];
 	state.stackability = m_mesh->val["stackability"];
 
-	// Groups
+	// Groups, only the ones edited since the last snapshot are copied
+	foreach(QString gid, groupSnapshots.keys())
+		if(!groups.contains(gid)) groupSnapshots.remove(gid);
+
 	foreach (Group* g, groups)
-		state.groups[g->id] = g->clone();
+	{
+		QSharedPointer<Group> snapshot = groupSnapshots.value(g->id);
+		if(snapshot.isNull() || snapshot->revision != g->revision)
+			groupSnapshots[g->id] = QSharedPointer<Group>(g->clone());
+	}
+
+	state.groups = groupSnapshots;
 
 	return state;
 }
@@ -335,18 +427,159 @@ void Controller::setShapeState(const ShapeState &shapeState )
 {
 	foreach(Primitive * prim, primitives)
 	{
-		prim->setState(shapeState.primStates[prim->id]);
+		prim->setState(shapeState.primState(prim->id));
 	}
 
 	m_mesh->vec["stacking_shift"] = shapeState.stacking_shift;
 	m_mesh->val["stackability"] = shapeState.stackability;
 
-	// Groups
-	this->groups = shapeState.groups;
+	restoreGroups(shapeState);
 
 	m_mesh->computeBoundingBox();
 }
 
+// Groups, only the ones edited since the snapshot are copied back
+void Controller::restoreGroups( const ShapeState &shapeState )
+{
+	foreach(QString gid, groups.keys())
+	{
+		if(shapeState.groups.contains(gid)) continue;
+		delete groups[gid];
+		groups.remove(gid);
+	}
+
+	foreach(QSharedPointer<Group> snapshot, shapeState.groups)
+	{
+		Group * g = groups.value(snapshot->id);
+		if(g && g->revision == snapshot->revision) continue;
+
+		Group * copy = snapshot->clone();
+		if(g)
+			copy->nodes = g->nodes;
+		else
+			for (int i = 0; i < copy->nodes.size(); i++)
+				copy->nodes[i] = primitives[copy->nodes[i]->id];
+
+		delete g;
+		groups[snapshot->id] = copy;
+	}
+
+	groupSnapshots = shapeState.groups;
+}
+
+void Controller::beginEdit()
+{
+	journal = getShapeState();
+
+	journalBBmin = m_mesh->bbmin;
+	journalBBmax = m_mesh->bbmax;
+	journalCenter = m_mesh->center;
+	journalRadius = m_mesh->radius;
+}
+
+void Controller::rollbackEdit()
+{
+	// Only the edited primitives are deformed back
+	foreach(Primitive * prim, primitives)
+	{
+		PrimitiveState saved = journal.primState(prim->id);
+		if(saved.isNull() || saved.size != prim->stateSize()) continue;
+
+		QVarLengthArray<double, 64> current(saved.size);
+		prim->getState(current.data());
+
+		if(!std::equal(saved.values, saved.values + saved.size, current.data()))
+			prim->setState(saved);
+	}
+
+	m_mesh->vec["stacking_shift"] = journal.stacking_shift;
+	m_mesh->val["stackability"] = journal.stackability;
+
+	restoreGroups(journal);
+
+	// Same vertices as at \beginEdit()
+	m_mesh->bbmin = journalBBmin;
+	m_mesh->bbmax = journalBBmax;
+	m_mesh->center = journalCenter;
+	m_mesh->radius = journalRadius;
+}
+
+void Controller::setDeferredDeformation( bool isDeferred )
+{
+	bool isDeformed = false;
+
+	foreach(Primitive * prim, primitives)
+	{
+		isDeformed = isDeformed || (!isDeferred && prim->isMeshDirty);
+		prim->setDeferred(isDeferred);
+	}
+
+	if(isDeformed) m_mesh->computeBoundingBox();
+}
+
+void Controller::updateProxy( QSegMesh * proxy )
+{
+	int i = 0;
+
+	foreach(Primitive * prim, primitives)
+	{
+		QSurfaceMesh geometry = prim->getGeometry();
+
+		if(i < (int)proxy->nbSegments() && proxy->getSegment(i)->n_vertices() == geometry.n_vertices())
+		{
+			// Same topology, only the positions change
+			Surface_mesh::Vertex_property<Point> from = geometry.vertex_property<Point>("v:point");
+			Surface_mesh::Vertex_property<Point> to = proxy->getSegment(i)->vertex_property<Point>("v:point");
+
+			for(uint v = 0; v < geometry.n_vertices(); v++)
+				to[Surface_mesh::Vertex(v)] = from[Surface_mesh::Vertex(v)];
+		}
+		else
+		{
+			QSurfaceMesh * segment = new QSurfaceMesh(geometry);
+			segment->setObjectName(prim->id);
+
+			if(i < (int)proxy->nbSegments())
+			{
+				delete proxy->getSegment(i);
+				proxy->setSegment(i, segment);
+				proxy->segmentName[i] = prim->id;
+			}
+			else
+			{
+				proxy->insertCopyMesh(segment);
+				proxy->getSegment(i)->setObjectName(prim->id);
+				proxy->segmentName.push_back(prim->id);
+				delete segment;
+			}
+		}
+
+		i++;
+	}
+
+	proxy->computeBoundingBox();
+}
+
+void Controller::adoptGroups( ShapeState & state )
+{
+	foreach(QString gid, state.groups.keys())
+	{
+		QSharedPointer<Group> g = state.groups[gid];
+
+		bool isForeign = false;
+		foreach(Primitive * node, g->nodes)
+			if(primitives.value(node->id) != node) isForeign = true;
+
+		if(!isForeign) continue;
+
+		Group * copy = g->clone();
+		for (int i = 0; i < copy->nodes.size(); i++)
+			copy->nodes[i] = primitives[copy->nodes[i]->id];
+
+		state.groups[gid] = QSharedPointer<Group>(copy);
+	}
+}
+
 QVector< Group * > Controller::groupsOf( QString id )
 {
 	QVector< Group * > result;
@@ -385,13 +618,29 @@ double Controller::similarity( ShapeState state1, ShapeState state2 )
 	foreach(Primitive* prim, primitives)
 	{
 		QString id = prim->id;
-		result += prim->similarity(state1.primStates[id], state2.primStates[id]);
+		result += prim->similarity(state1.primState(id), state2.primState(id));
 	}
 
 	return result;
 }
 
-void Controller::save( std::ofstream &outF )
+// Points of all primitives in the current state, \similarity is the sum of their distances
+std::vector<double> Controller::stateFeature()
+{
+	std::vector<double> feature;
+
+	foreach(Primitive* prim, primitives)
+	{
+		std::vector<Point> pnts = prim->points();
+		for (int i = 0; i < (int)pnts.size(); i++)
+			for (int j = 0; j < 3; j++)
+				feature.push_back(pnts[i][j]);
+	}
+
+	return feature;
+}
+
+void Controller::save( std::ostream &outF )
 {
 	foreach(Primitive * prim, primitives)
 	{
@@ -405,7 +654,12 @@ void Controller::save( std::ofstream &outF )
 	}
 }
 
-void Controller::load( std::ifstream &inF )
+void Controller::load( std::istream &inF )
+{
+	load(inF, m_mesh->translation, m_mesh->scaleFactor);
+}
+
+void Controller::load( std::istream &inF, Vec3d translation, double scaleFactor )
 {
 	clearPrimitives();
 
@@ -428,7 +682,7 @@ void Controller::load( std::ifstream &inF )
             case GCYLINDER: primitives[primId] = new GCylinder(m_mesh->getSegment(primId), primId, false); break;
 		}
 
-		primitives[primId]->load(inF, m_mesh->translation, m_mesh->scaleFactor);
+		primitives[primId]->load(inF, translation, scaleFactor);
 	}
 }
 
@@ -516,7 +770,12 @@ double Controller::meshRadius()
 	return m_mesh->radius;
 }
 
-void Controller::loadGroups( std::ifstream &inF )
+void Controller::loadGroups( std::istream &inF )
+{
+	loadGroups(inF, m_mesh->translation, m_mesh->scaleFactor);
+}
+
+void Controller::loadGroups( std::istream &inF, Vec3d translation, double scaleFactor )
 {
 	if (!inF) return;
 
@@ -575,7 +834,7 @@ void Controller::loadGroups( std::ifstream &inF )
 				inF >> str;
 				segments.push_back(getPrimitive(str.c_str()));
 			}
-			newGroup->loadParameters(inF, m_mesh->translation, m_mesh->scaleFactor);
+			newGroup->loadParameters(inF, translation, scaleFactor);
 			newGroup->process(segments);
 
 			QString id = QString::number(groupID++);
@@ -585,7 +844,7 @@ void Controller::loadGroups( std::ifstream &inF )
 	}
 }
 
-void Controller::saveGroups( std::ofstream &outF )
+void Controller::saveGroups( std::ostream &outF )
 {
 	foreach(Group* group, groups)
 	{
@@ -16,8 +16,12 @@ class Controller
 {
 public:
 	Controller(QSegMesh* mesh, bool useAABB = true, QString loadFromFile = "" );
+	Controller(QSegMesh* mesh, std::istream &inF);
 	~Controller();
 
+	// Independent copy of this controller on \mesh, a copy of the controlled mesh
+	Controller * clone( QSegMesh * mesh );
+
 public:
 
 	// Primitives
@@ -60,6 +64,7 @@ public:
 	// Shape state
 	ShapeState	getShapeState();
     void		setShapeState( const ShapeState &shapeState );
+	void		adoptGroups( ShapeState &state );
 	double		volume();
 	double		originalVolume();
 	double		getDistortion();
@@ -67,20 +72,32 @@ public:
 
 	// Similarity between two shape state
 	double similarity(ShapeState state1, ShapeState state2);
+	std::vector<double> stateFeature();
+
+	// Edit journal, a trial edit is undone by restoring only what it changed
+	void beginEdit();
+	void rollbackEdit();
+
+	// Deferred deformation, the primitives are edited without deforming the mesh.
+	// \proxy is a coarse stand-in of the mesh, one segment per primitive geometry.
+	void setDeferredDeformation( bool isDeferred );
+	void updateProxy( QSegMesh * proxy );
 	
 	// Flags
 	void setPrimitivesFrozen(bool isFrozen = false);
 
 	// Save and load
-	void save(std::ofstream &outF);
-	void load(std::ifstream &inF);
+	void save(std::ostream &outF);
+	void load(std::istream &inF);
+	void load(std::istream &inF, Vec3d translation, double scaleFactor);
 	QString serialize();
 	void unserialize(QString &content);
 
 	// Save and load groups
 	QVector<QString> groupTypes;
-	void saveGroups( std::ofstream &outF );
-	void loadGroups(std::ifstream &inF);
+	void saveGroups( std::ostream &outF );
+	void loadGroups(std::istream &inF);
+	void loadGroups(std::istream &inF, Vec3d translation, double scaleFactor);
 
 	// Debug items
 	std::vector<Point> debugPoints;
@@ -102,7 +119,20 @@ private:
 
 	QMap<int, QString> primitiveIdNum;
 
+	void setup(QSegMesh* mesh);
 	void assignIds();
+	void setupTypeNames();
+
+	// Shape state, reused by every snapshot while the primitives and groups are the same
+	StateLayout stateLayout;
+	QMap<QString, QSharedPointer<Group> > groupSnapshots;
+	void updateStateLayout();
+	void restoreGroups( const ShapeState &shapeState );
+
+	// State at \beginEdit()
+	ShapeState journal;
+	Point journalBBmin, journalBBmax, journalCenter;
+	double journalRadius;
 
 };
 
@@ -8,6 +8,7 @@ using namespace Eigen;
 #include "MathLibrary/Bounding/OBB_PCA.h"
 #include "MathLibrary/Bounding/OBB_Volume.h"
 #include "MathLibrary/Coordiantes/MeanValueCoordinates.h"
+#include "MathLibrary/Coordiantes/CoordinateCache.h"
 
 #include <QTextStream>
 
@@ -100,20 +101,29 @@ void Cuboid::fit( bool useAABB, int obb_method )
 void Cuboid::computeMeshCoordinates()
 {
 	// Compute the OBB coordinates for all vertices
-	coordinates.clear();
 	Surface_mesh::Vertex_property<Point> points = m_mesh->vertex_property<Point>("v:point");
 	Surface_mesh::Vertex_iterator vit, vend = m_mesh->vertices_end();
 
 	QSurfaceMesh cubeMesh = getGeometry();
 	cubeMesh.fillTrianglesList();
 
-	coordinates.resize(m_mesh->n_vertices(), std::vector<double>(cubeMesh.n_vertices()));
+	// Same segment and box as a previous session
+	std::vector<double> corners;
+	foreach(Point p, cubeMesh.clonePoints()) corners.insert(corners.end(), p.data(), p.data() + 3);
+
+	quint64 cacheKey = CoordinateCache::key(m_mesh, MVC_COORDINATES, corners);
+	if(CoordinateCache::load(cacheKey, QVector<CoordinateMatrix*>() << &coordinates)) return;
+
+	coordinates.resize(m_mesh->n_vertices(), cubeMesh.n_vertices());
 
 	#pragma omp parallel for
 	for(int i = 0; i < m_mesh->n_vertices(); i++)
 	{
-		coordinates[i] = MeanValueCooridnates::weights(points[Surface_mesh::Vertex(i)], &cubeMesh);
+		std::vector<double> w = MeanValueCooridnates::weights(points[Surface_mesh::Vertex(i)], &cubeMesh);
+		for(int j = 0; j < (int)w.size(); j++) coordinates(i, j) = w[j];
 	}
+
+	CoordinateCache::save(cacheKey, QVector<const CoordinateMatrix*>() << &coordinates);
 }
 
 Vec3d Cuboid::getCoordinatesInUniformBox( Box3 &box, Vec3d &p )
@@ -139,26 +149,24 @@ Vec3d Cuboid::getPositionInBox( std::vector<Vec3d> & pnts, int vidx )
 	Vec3d p(0,0,0);
 
 	for(int i = 0; i < pnts.size(); i++)
-		p += (pnts[i] * coordinates[vidx][i]);
+		p += (pnts[i] * coordinates(vidx, i));
 
 	return p;
 }
 
 void Cuboid::deformMesh()
 {
-	Surface_mesh::Vertex_property<Point> points = m_mesh->vertex_property<Point>("v:point");
+	if(isDeferred){ isMeshDirty = true; return; }
 
-	std::vector<Vec3d> pnts = getBoxCorners(currBox);
+	// All vertices at once, straight into the vertex buffer
+	PointMatrix corners = toPointMatrix(getBoxCorners(currBox));
+	PointMatrixMap vertices = vertexMatrix(m_mesh);
 
-	#pragma omp parallel for
-	for(int i = 0; i < m_mesh->n_vertices(); i++)
-	{
-		Surface_mesh::Vertex vit(i);
-		int vidx = vit.idx();
-		points[vit] = getPositionInBox(pnts, vidx);
-	}
+	vertices.setZero();
+	addCoordinateProduct(coordinates, corners, vertices);
 
 	m_mesh->computeBoundingBox();
+	isMeshDirty = false;
 }
 
 std::vector<Point> Cuboid::getUniformBoxCorners( Box3 &box )
@@ -636,15 +644,30 @@ std::vector <Vec3d> Cuboid::majorAxis()
 }
 
 
-void* Cuboid::getState()
+int Cuboid::stateSize()
+{
+	return 21;
+}
+
+void Cuboid::getState( double * state )
 {
-	Box3 *box = new Box3(currBox);
-	return (void*)box;
+	for(int j = 0; j < 3; j++)	*state++ = currBox.Center[j];
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++)	*state++ = currBox.Axis[i][j];
+	for(int j = 0; j < 3; j++)	*state++ = currBox.Extent[j];
+	for(int i = 0; i < 6; i++)	*state++ = currBox.faceScaling[i];
 }
 
-void Cuboid::setState( void* toState)
+void Cuboid::setState( PrimitiveState toState )
 {
-	currBox = *( (Box3*) toState );
+	if(toState.type != CUBOID || toState.size != stateSize()) return;
+
+	const double * state = toState.values;
+	for(int j = 0; j < 3; j++)	currBox.Center[j] = *state++;
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++)	currBox.Axis[i][j] = *state++;
+	for(int j = 0; j < 3; j++)	currBox.Extent[j] = *state++;
+	for(int i = 0; i < 6; i++)	currBox.faceScaling[i] = *state++;
 
 	deformMesh();
 }
@@ -824,7 +847,7 @@ void Cuboid::scaleCurve( int cid, double s )
 	deformMesh();
 }
 
-void Cuboid::save( std::ofstream &outF )
+void Cuboid::save( std::ostream &outF )
 {
 	outF << this->currBox.Center << "\t" 
 		<< this->currBox.Axis[0] << "\t" 
@@ -840,7 +863,7 @@ void Cuboid::save( std::ofstream &outF )
 }
 
 
-void Cuboid::load( std::ifstream &inF, Vec3d translation, double scaleFactor )
+void Cuboid::load( std::istream &inF, Vec3d translation, double scaleFactor )
 {
 	this->currBox.faceScaling = std::vector<double>(6, 1.0);
 
@@ -2,6 +2,7 @@
 #include "Primitive.h"
 #include "MathLibrary/Bounding/MinOBB3.h"
 #include <Eigen/Dense>
+#include "MathLibrary/Coordiantes/CoordinateMatrix.h"
 
 //		  7-----------6                     Y
 //		 /|          /|                   f2^   /f5
@@ -52,8 +53,9 @@ public:
 	Point fromCoordinate(std::vector<double> &coords);
 
 	// Primitive state
-	void*	getState();
-	void	setState( void* toState);
+	int		stateSize();
+	void	getState( double * state );
+	void	setState( PrimitiveState state );
 
 	// Primitive geometry
 	double volume();
@@ -76,8 +78,8 @@ public:
 	Point getSelectedCurveCenter();
 
 	// Save and load
-	void save(std::ofstream &outF);
-	void load(std::ifstream &inF, Vec3d translation, double scaleFactor);
+	void save(std::ostream &outF);
+	void load(std::istream &inF, Vec3d translation, double scaleFactor);
 	void	serialize( QTextStream &out);
 	void	unserialize( QTextStream &in);
 
@@ -98,7 +100,7 @@ private:
 	bool isUsedAABB;
 
 public:
-	std::vector< std::vector<double> > coordinates;
+	CoordinateMatrix coordinates;	// Vertices x box corners
 
 	Box3 originalBox, currBox;
 };
@@ -0,0 +1,429 @@
+#include "DepthRasterizer.h"
+#include "Numeric.h"
+
+// == Camera
+void RasterCamera::setup( ObjectTranformation & ot, int w, int h )
+{
+	width = w;
+	height = h;
+
+	// Rotation of the object, \matrix() is column major
+	const double * m = ot.rot.matrix();
+	for (int r = 0; r < 3; r++)
+		for (int c = 0; c < 3; c++)
+			rot(r, c) = m[c * 4 + r];
+
+	t = Vec3d(ot.t.x, ot.t.y, ot.t.z);
+
+	// Same fitting as HiddenViewer::preDraw()
+	Point center = (ot.bbmin + ot.bbmax) / 2;
+	std::vector<Point> corner = cornersOfAABB(ot.bbmin - center, ot.bbmax - center);
+	for (int i = 0; i < 8; i++)
+		corner[i] = objectToWorld(corner[i] - t);
+
+	Point new_bbmin, new_bbmax;
+	computeAABB(corner, new_bbmin, new_bbmax);
+	double s = 1.5;
+	new_bbmin[2] *= 2;
+	new_bbmax[2] *= 2;
+	Vec3d diag = (new_bbmax - new_bbmin) * s;
+
+	// Camera::fitBoundingBox() then Camera::fitSphere() for orthographic camera
+	double radius = 0.5 * MaxOf(fabs(diag[0]), fabs(diag[1]), fabs(diag[2]));
+	distance = radius / RASTER_ORTHO_COEF;
+
+	// Camera::getOrthoWidthHeight()
+	double aspect = double(w) / h;
+	halfWidth = radius * ((aspect < 1.0) ? 1.0 : aspect);
+	halfHeight = radius * ((aspect < 1.0) ? 1.0 / aspect : 1.0);
+
+	// Camera::zNear() and Camera::zFar()
+	double zClip = RASTER_Z_CLIPPING_COEF * RASTER_SCENE_RADIUS;
+	zNear = distance - zClip;
+	if (zNear < RASTER_Z_NEAR_COEF * zClip) zNear = 0.0;
+	zFar = distance + zClip;
+}
+
+Vec3d RasterCamera::objectToWorld( const Point & p )
+{
+	Vec3d q = p + t;
+	Eigen::Vector3d r = rot * V2E(q);
+	return E2V(r);
+}
+
+Vec3d RasterCamera::worldToObject( const Vec3d & p )
+{
+	Eigen::Vector3d r = rot.transpose() * V2E(p);
+	return E2V(r) - t;
+}
+
+Vec3d RasterCamera::projectedCoordinatesOf( const Vec3d & p )
+{
+	double x = (p[0] / halfWidth + 1) * 0.5 * width;
+	double y = (p[1] / halfHeight + 1) * 0.5 * height;
+	double z = (distance - p[2] - zNear) / (zFar - zNear);
+
+	return Vec3d(x, height - y, z);
+}
+
+Vec3d RasterCamera::unprojectedCoordinatesOf( const Vec3d & src )
+{
+	double x = (2.0 * src[0] / width - 1) * halfWidth;
+	double y = (2.0 * (height - src[1]) / height - 1) * halfHeight;
+	double z = distance - (zNear + src[2] * (zFar - zNear));
+
+	return Vec3d(x, y, z);
+}
+
+
+// == Rasterizer
+void RasterTarget::reset( int size, double background, bool withFaces, int firstRow )
+{
+	y0 = firstRow;
+	z.assign(size, background);
+
+	faces.clear();
+	barycentric.clear();
+
+	if (withFaces)
+	{
+		faces.resize(size, -1);
+		barycentric.resize(size, Vec2f(0, 0));
+	}
+}
+
+DepthRasterizer::DepthRasterizer( int w, int h )
+{
+	TILE_SIZE = 32;
+
+	setResolution(w, h);
+}
+
+void DepthRasterizer::setResolution( int w, int h )
+{
+	this->w = Max(1, w);
+	this->h = Max(1, h);
+
+	depth.clear();
+}
+
+int DepthRasterizer::width()
+{
+	return w;
+}
+
+int DepthRasterizer::height()
+{
+	return h;
+}
+
+void DepthRasterizer::collectTriangles( QSegMesh * mesh )
+{
+	screenPoints.clear();
+	triangles.clear();
+
+	for (uint i = 0; i < mesh->nbSegments(); i++)
+		addSegment(mesh->getSegment(i));
+}
+
+void DepthRasterizer::addSegment( QSurfaceMesh * seg )
+{
+	uint offset = screenPoints.size();
+
+	if(!seg->triangles.size()) seg->fillTrianglesList();
+
+	Surface_mesh::Vertex_property<Point> points = seg->vertex_property<Point>("v:point");
+	int nbV = seg->n_vertices();
+
+	screenPoints.resize(offset + nbV);
+
+	#pragma omp parallel for
+	for (int vi = 0; vi < nbV; vi++)
+	{
+		Vec3d p = camera.objectToWorld(points[Surface_mesh::Vertex(vi)]);
+
+		// Pixel coordinates in OpenGL format, depth kept in world
+		double x = (p[0] / camera.halfWidth + 1) * 0.5 * w;
+		double y = (p[1] / camera.halfHeight + 1) * 0.5 * h;
+
+		screenPoints[offset + vi] = Vec3d(x, y, p[2]);
+	}
+
+	for (int j = 0; j < (int)seg->triangles.size(); j++)
+		triangles.push_back(offset + seg->triangles[j]);
+}
+
+void DepthRasterizer::binTriangles()
+{
+	int tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+
+	tileBins.clear();
+	tileBins.resize(tilesX * tilesY);
+
+	int nbTri = triangles.size() / 3;
+
+	for (int i = 0; i < nbTri; i++)
+	{
+		Vec3d & a = screenPoints[triangles[3*i + 0]];
+		Vec3d & b = screenPoints[triangles[3*i + 1]];
+		Vec3d & c = screenPoints[triangles[3*i + 2]];
+
+		// Pixels whose center is covered by the triangle bounds
+		int minX = Max(0,   (int)ceil(Min(a[0], Min(b[0], c[0])) - 0.5));
+		int maxX = Min(w-1, (int)floor(Max(a[0], Max(b[0], c[0])) - 0.5));
+		int minY = Max(0,   (int)ceil(Min(a[1], Min(b[1], c[1])) - 0.5));
+		int maxY = Min(h-1, (int)floor(Max(a[1], Max(b[1], c[1])) - 0.5));
+
+		if (minX > maxX || minY > maxY) continue;
+
+		for (int ty = minY / TILE_SIZE; ty <= maxY / TILE_SIZE; ty++)
+			for (int tx = minX / TILE_SIZE; tx <= maxX / TILE_SIZE; tx++)
+				tileBins[ty * tilesX + tx].push_back(i);
+	}
+}
+
+void DepthRasterizer::rasterizeTile( int tx, int ty, RasterTarget & front, RasterTarget * back )
+{
+	bool hasFaces = !front.faces.empty();
+
+	int tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+	std::vector<uint> & bin = tileBins[ty * tilesX + tx];
+
+	int x0 = tx * TILE_SIZE, x1 = Min(w, x0 + TILE_SIZE) - 1;
+	int y0 = ty * TILE_SIZE, y1 = Min(h, y0 + TILE_SIZE) - 1;
+
+	for (int i = 0; i < (int)bin.size(); i++)
+	{
+		Vec3d & a = screenPoints[triangles[3*bin[i] + 0]];
+		Vec3d & b = screenPoints[triangles[3*bin[i] + 1]];
+		Vec3d & c = screenPoints[triangles[3*bin[i] + 2]];
+
+		double area = (b[0]-a[0]) * (c[1]-a[1]) - (b[1]-a[1]) * (c[0]-a[0]);
+		if (fabs(area) < DBL_EPSILON) continue;
+
+		// No face culling in HiddenViewer, accept both windings
+		double s = (area > 0) ? 1.0 : -1.0;
+		double invArea = 1.0 / fabs(area);
+
+		int minX = Max(x0, (int)ceil(Min(a[0], Min(b[0], c[0])) - 0.5));
+		int maxX = Min(x1, (int)floor(Max(a[0], Max(b[0], c[0])) - 0.5));
+		int minY = Max(y0, (int)ceil(Min(a[1], Min(b[1], c[1])) - 0.5));
+		int maxY = Min(y1, (int)floor(Max(a[1], Max(b[1], c[1])) - 0.5));
+
+		// Edge functions, stepped along x
+		double e0dx = s * (b[1] - c[1]), e1dx = s * (c[1] - a[1]), e2dx = s * (a[1] - b[1]);
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			double px = minX + 0.5, py = y + 0.5;
+
+			double e0 = s * ((c[0]-b[0]) * (py-b[1]) - (c[1]-b[1]) * (px-b[0]));
+			double e1 = s * ((a[0]-c[0]) * (py-c[1]) - (a[1]-c[1]) * (px-c[0]));
+			double e2 = s * ((b[0]-a[0]) * (py-a[1]) - (b[1]-a[1]) * (px-a[0]));
+
+			int offset = (y - front.y0) * w;
+
+			for (int x = minX; x <= maxX; x++, e0 += e0dx, e1 += e1dx, e2 += e2dx)
+			{
+				if (e0 < 0 || e1 < 0 || e2 < 0) continue;
+
+				double z = (e0 * a[2] + e1 * b[2] + e2 * c[2]) * invArea;
+
+				// Nearest to the camera wins
+				if (z > front.z[offset + x])
+				{
+					front.z[offset + x] = z;
+
+					if (hasFaces)
+					{
+						front.faces[offset + x] = bin[i];
+						front.barycentric[offset + x] = Vec2f(e1 * invArea, e2 * invArea);
+					}
+				}
+
+				// Farthest for the opposite camera
+				if (back && z < back->z[offset + x])
+				{
+					back->z[offset + x] = z;
+
+					if (hasFaces)
+					{
+						back->faces[offset + x] = bin[i];
+						back->barycentric[offset + x] = Vec2f(e1 * invArea, e2 * invArea);
+					}
+				}
+			}
+		}
+	}
+}
+
+void DepthRasterizer::render( QSegMesh * mesh, ObjectTranformation & ot )
+{
+	rasterize(mesh, ot, false);
+}
+
+void DepthRasterizer::renderDual( QSegMesh * mesh, ObjectTranformation & ot )
+{
+	rasterize(mesh, ot, true);
+}
+
+bool DepthRasterizer::hasBackDepth()
+{
+	return !backDepth.empty();
+}
+
+void DepthRasterizer::prepare( QSegMesh * mesh, ObjectTranformation & ot )
+{
+	camera.setup(ot, w, h);
+
+	collectTriangles(mesh);
+	binTriangles();
+}
+
+void DepthRasterizer::rasterizeRows( int y0, int y1, RasterTarget & front, RasterTarget * back )
+{
+	int tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+	int ty0 = y0 / TILE_SIZE;
+	int nbTiles = tilesX * ((y1 - 1) / TILE_SIZE - ty0 + 1);
+
+	// Tiles do not overlap, no locking is needed
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < nbTiles; i++)
+		rasterizeTile(i % tilesX, ty0 + i / tilesX, front, back);
+}
+
+float DepthRasterizer::depthOf( double z )
+{
+	if (z == RASTER_BACKGROUND) return 1.0f;
+
+	return RANGED(0.0, (camera.distance - z - camera.zNear) / (camera.zFar - camera.zNear), 1.0);
+}
+
+float DepthRasterizer::backDepthOf( double z )
+{
+	if (z == -RASTER_BACKGROUND) return 1.0f;
+
+	return RANGED(0.0, (camera.distance + z - camera.zNear) / (camera.zFar - camera.zNear), 1.0);
+}
+
+void DepthRasterizer::rasterize( QSegMesh * mesh, ObjectTranformation & ot, bool isDual )
+{
+	prepare(mesh, ot);
+
+	// Triangles are in the order of the faces, their index is the global face id
+	RasterTarget front, back;
+	front.reset(w * h, RASTER_BACKGROUND, true);
+	if (isDual) back.reset(w * h, -RASTER_BACKGROUND, true);
+
+	rasterizeRows(0, h, front, isDual ? &back : NULL);
+
+	faceIds.swap(front.faces);
+	barycentric.swap(front.barycentric);
+
+	// Convert to OpenGL depth values
+	depth.resize(w * h);
+	backDepth.clear();
+	backFaceIds.clear();
+	backBarycentric.clear();
+
+	if (isDual)
+	{
+		backDepth.resize(w * h);
+		backFaceIds.resize(w * h);
+		backBarycentric.resize(w * h);
+	}
+
+	#pragma omp parallel for
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			int i = y * w + x;
+
+			depth[i] = depthOf(front.z[i]);
+
+			if (!isDual) continue;
+
+			// The opposite camera is rotated by PI around Y: x and z flip, the frustum stays the same
+			int j = y * w + (w-1-x);
+
+			backDepth[j] = backDepthOf(back.z[i]);
+
+			backFaceIds[j] = back.faces[i];
+			backBarycentric[j] = back.barycentric[i];
+		}
+	}
+}
+
+void DepthRasterizer::renderSegment( QSurfaceMesh * seg, RasterCamera & cam, SegmentDepth & result )
+{
+	camera = cam;
+	setResolution(cam.width, cam.height);
+
+	screenPoints.clear();
+	triangles.clear();
+	addSegment(seg);
+	binTriangles();
+
+	RasterTarget front, back;
+	front.reset(w * h, RASTER_BACKGROUND, false);
+	back.reset(w * h, -RASTER_BACKGROUND, false);
+
+	int tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+
+	for (int i = 0; i < tilesX * tilesY; i++)
+		if (!tileBins[i].empty())
+			rasterizeTile(i % tilesX, i / tilesX, front, &back);
+
+	// Crop to the covered pixels
+	int minX = w, maxX = -1, minY = h, maxY = -1;
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			if (front.z[y * w + x] == RASTER_BACKGROUND) continue;
+
+			minX = Min(minX, x); maxX = Max(maxX, x);
+			minY = Min(minY, y); maxY = Max(maxY, y);
+		}
+	}
+
+	result.x0 = minX;
+	result.y0 = minY;
+	result.width = Max(0, maxX - minX + 1);
+	result.height = Max(0, maxY - minY + 1);
+	result.nearZ.assign(result.width * result.height, -FLT_MAX);
+	result.farZ.assign(result.width * result.height, FLT_MAX);
+
+	for (int y = 0; y < result.height; y++)
+	{
+		for (int x = 0; x < result.width; x++)
+		{
+			int i = (minY + y) * w + (minX + x);
+			if (front.z[i] == RASTER_BACKGROUND) continue;
+
+			result.nearZ[y * result.width + x] = front.z[i];
+			result.farZ[y * result.width + x] = back.z[i];
+		}
+	}
+}
+
+float* DepthRasterizer::readDepthBuffer()
+{
+	float * data = new float[w*h];
+
+	std::copy(depth.begin(), depth.end(), data);
+
+	return data;
+}
+
+float* DepthRasterizer::readBackDepthBuffer()
+{
+	float * data = new float[w*h];
+
+	std::copy(backDepth.begin(), backDepth.end(), data);
+
+	return data;
+}
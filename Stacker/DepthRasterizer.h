@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <Eigen/Dense>
+
+#include "GraphicsLibrary/Mesh/QSegMesh.h"
+#include "HiddenViewer.h"
+
+// QGLViewer camera defaults that HiddenViewer relies on
+#define RASTER_ORTHO_COEF 0.41421356237309503	// tan(fieldOfView / 2), fieldOfView = PI/4
+#define RASTER_SCENE_RADIUS 10.0				// HiddenViewer::preDraw() sets it
+#define RASTER_Z_CLIPPING_COEF 1.7320508075688772	// sqrt(3)
+#define RASTER_Z_NEAR_COEF 0.005
+#define RASTER_BACKGROUND -DBL_MAX				// World z of empty pixels in the front pass
+
+// The orthographic camera that HiddenViewer::preDraw() fits around \objectTransformation
+// Coordinates follow QGLViewer: "world" is the space after the object transformation,
+// window coordinates have origin at the left top conner
+struct RasterCamera
+{
+	int width, height;
+	double halfWidth, halfHeight;
+	double distance;				// Camera to scene center, camera looks along -Z
+	double zNear, zFar;
+
+	Eigen::Matrix3d rot;
+	Vec3d t;
+
+	void setup( ObjectTranformation & ot, int w, int h );
+
+	Vec3d objectToWorld( const Point & p );
+	Vec3d worldToObject( const Vec3d & p );
+	Vec3d projectedCoordinatesOf( const Vec3d & p );
+	Vec3d unprojectedCoordinatesOf( const Vec3d & src );
+};
+
+// Nearest and farthest world z of one segment, cropped to the pixels it covers
+struct SegmentDepth
+{
+	int x0, y0, width, height;
+	std::vector<float> nearZ, farZ;
+
+	SegmentDepth() : x0(0), y0(0), width(0), height(0) {}
+};
+
+// Per pixel result of a pass, in the layout of the rendering camera
+// Holds the screen rows starting at \y0, all of them unless rendered in bands
+struct RasterTarget
+{
+	int y0;
+	std::vector<double> z;
+	std::vector<int> faces;
+	std::vector<Vec2f> barycentric;
+
+	void reset( int size, double background, bool withFaces, int firstRow = 0 );
+};
+
+// Software z-buffer that replaces the HV_DEPTH pass of HiddenViewer
+// No GL context needed. The screen is split into tiles which are rasterized in parallel
+class DepthRasterizer
+{
+public:
+	DepthRasterizer(int w = 200, int h = 200);
+
+	void setResolution(int w, int h);
+	int width();
+	int height();
+
+	// Render \mesh as seen by HiddenViewer with the object transformation \ot
+	void render( QSegMesh * mesh, ObjectTranformation & ot );
+
+	// Nearest and farthest depth in one pass. The farthest depth is what the
+	// opposite camera (side = -1) sees, stored in its own horizontally flipped layout
+	void renderDual( QSegMesh * mesh, ObjectTranformation & ot );
+	bool hasBackDepth();
+
+	// Memory bounded rendering: \prepare() once, then any band of rows [y0, y1) at a time
+	// Bands start and end on tile rows (or the last row), \front and \back keep their rows only
+	void prepare( QSegMesh * mesh, ObjectTranformation & ot );
+	void rasterizeRows( int y0, int y1, RasterTarget & front, RasterTarget * back );
+
+	// World z of a pass to the depth values of \depth and \backDepth
+	float depthOf( double z );
+	float backDepthOf( double z );
+
+	// Render a single segment with a given camera, used by the incremental stackability
+	void renderSegment( QSurfaceMesh * seg, RasterCamera & cam, SegmentDepth & result );
+
+	// Same as HiddenViewer::readBuffer(GL_DEPTH_COMPONENT, GL_FLOAT), the caller deletes it
+	float* readDepthBuffer();
+	float* readBackDepthBuffer();
+
+	RasterCamera camera;
+
+	// Depth values in [0, 1], OpenGL layout (origin at the left bottom conner)
+	std::vector<float> depth;
+	std::vector<float> backDepth;
+
+	// Global face index of the visible triangle (-1 for background) and the
+	// barycentric weights of its 2nd and 3rd vertices, same layout as \depth
+	std::vector<int> faceIds;
+	std::vector<int> backFaceIds;
+	std::vector<Vec2f> barycentric;
+	std::vector<Vec2f> backBarycentric;
+
+	int TILE_SIZE;
+
+private:
+	int w, h;
+
+	// Screen space vertices: (x, y) in pixels, z in world
+	std::vector<Vec3d> screenPoints;
+	std::vector<uint> triangles;
+	std::vector< std::vector<uint> > tileBins;
+
+	void collectTriangles( QSegMesh * mesh );
+	void addSegment( QSurfaceMesh * seg );
+	void binTriangles();
+	void rasterizeTile( int tx, int ty, RasterTarget & front, RasterTarget * back );
+	void rasterize( QSegMesh * mesh, ObjectTranformation & ot, bool isDual );
+};
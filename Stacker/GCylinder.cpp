@@ -90,6 +90,8 @@ void GCylinder::computeMeshCoordinates()
 
 void GCylinder::deformMesh()
 {
+	if(isDeferred){ isMeshDirty = true; return; }
+
 	// Deform the underlying geometry using deformer
 
 	if(deformer == GREEN_COORDIANTES) 
@@ -99,6 +101,7 @@ void GCylinder::deformMesh()
 		skinner->deform();
 
 	m_mesh->computeBoundingBox();
+	isMeshDirty = false;
 }
 
 void GCylinder::draw()
@@ -423,23 +426,26 @@ QSurfaceMesh GCylinder::getGeometry()
 	return *cage;
 }
 
-void* GCylinder::getState()
+int GCylinder::stateSize()
+{
+	return curveScales.size() * 7;
+}
+
+void GCylinder::getState( double * state )
 {
-	std::vector<double> state;
-	for(int i = 0; i < curveScales.size(); i++)
+	for(int i = 0, k = 0; i < curveScales.size(); i++)
 	{		
-		for(int j = 0; j < 3; j++)	state.push_back(basicGC.crossSection[i].center[j]); // P		
-		for(int j = 0; j < 3; j++)	state.push_back(curveTranslation[i][j]); // T		
-		state.push_back(curveScales[i]); // S
+		for(int j = 0; j < 3; j++)	state[k++] = basicGC.crossSection[i].center[j]; // P		
+		for(int j = 0; j < 3; j++)	state[k++] = curveTranslation[i][j]; // T		
+		state[k++] = curveScales[i]; // S
 	}
-	return new std::vector<double>(state);
 }
 
-void GCylinder::setState( void* toState)
+void GCylinder::setState( PrimitiveState toState )
 {
-	std::vector<double> & state = *(std::vector<double> *)toState;
+	if(toState.type != GCYLINDER || toState.size != stateSize()) return;
 
-	if(state.size() != curveScales.size() * 7) return;
+	const double * state = toState.values;
 
 	for(int k = 0, i = 0; i < curveScales.size() * 7; k++)
 	{		
@@ -667,7 +673,7 @@ void GCylinder::movePoint( Point p, Vec3d T )
 	}
 }
 
-void GCylinder::save( std::ofstream &outF )
+void GCylinder::save( std::ostream &outF )
 {
 	outF << this->cageScale << '\t';
 	outF << this->cageSides << '\t';
@@ -687,7 +693,7 @@ void GCylinder::save( std::ofstream &outF )
 	}
 }
 
-void GCylinder::load( std::ifstream &inF, Vec3d translation, double scaleFactor )
+void GCylinder::load( std::istream &inF, Vec3d translation, double scaleFactor )
 {
 	inF >> this->cageScale;
 	inF >> this->cageSides;
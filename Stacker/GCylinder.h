@@ -75,8 +75,9 @@ public:
 	void drawNames(int name, bool isDrawCurves = false);
 
 	// Primitive state
-	void*	getState();
-	void	setState( void* toState);
+	int		stateSize();
+	void	getState( double * state );
+	void	setState( PrimitiveState state );
 
 	// Symmetry
 	void	setSymmetryPlanes(int nb_fold);
@@ -85,8 +86,8 @@ public:
 	Point	getSelectedCurveCenter();
 	
 	// Save and load
-	void save(std::ofstream &outF);
-	void load(std::ifstream &inF, Vec3d translation, double scaleFactor);
+	void save(std::ostream &outF);
+	void load(std::istream &inF, Vec3d translation, double scaleFactor);
 	void	serialize( QTextStream &out);
 	void	unserialize( QTextStream &in);
 public:
@@ -1,25 +1,35 @@
 #include "Group.h"
 #include "Utility/SimpleDraw.h"
 #include "Primitive.h"
+#include <QAtomicInt>
 
 Group::Group(GroupType newType)
 {
 	this->type = newType;
 	this->isDraw = true;
+	this->revision = newRevision();
+}
+
+int Group::newRevision()
+{
+	static QAtomicInt lastRevision(0);
+	return lastRevision.fetchAndAddOrdered(1) + 1;
 }
 
 void Group::process( QVector< Primitive* > segments )
 {
 	// Store the nodes
 	nodes = segments;
+
+	revision = newRevision();
 }
 
-void Group::loadParameters( std::ifstream &inF, Vec3d translation, double scaleFactor )
+void Group::loadParameters( std::istream &inF, Vec3d translation, double scaleFactor )
 {
 	// Please reload this method if there are parameters to load
 }
 
-void Group::saveParameters( std::ofstream &outF )
+void Group::saveParameters( std::ostream &outF )
 {
 	// Please reload this method if there are parameters to save
 }
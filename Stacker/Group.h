@@ -16,6 +16,7 @@ enum GroupType{ SYMMETRY, POINTJOINT, LINEJOINT, CONCENTRIC, COPLANNAR, SELF_SYM
 class Group{
 public:
 	Group(GroupType newType);
+	virtual ~Group(){}
 
 	// Compute group properties
 	virtual void process(QVector< Primitive* > segments);
@@ -28,16 +29,20 @@ public:
 	void drawDebug();
 
 	// Group specified parameters
-	virtual void saveParameters(std::ofstream &outF);
-	virtual void loadParameters(std::ifstream &inF, Vec3d translation, double scaleFactor);
+	virtual void saveParameters(std::ostream &outF);
+	virtual void loadParameters(std::istream &inF, Vec3d translation, double scaleFactor);
 
 	// Others
 	bool has(QString id);
 	QVector<QString> getNodes();
 
-	// Clone
+	// Clone, the copy keeps the \revision
 	virtual Group* clone() = 0;
 
+	// Changes on every edit of the group parameters, unique across all groups
+	int revision;
+	static int newRevision();
+
 protected:
 	// Get the frozen and non_frozen primitives
 	bool getRegroupDirection(Primitive* &frozen, Primitive* &non_frozen);
@@ -5,9 +5,13 @@
 
 HiddenViewer::HiddenViewer( QWidget * parent ) : QGLViewer (parent)
 {
-	// Restrict the size of the window
+	// Restrict the size of the window, only for display
 	setFixedSize(200, 200);
 
+	// Envelopes are rendered offscreen
+	fbo = NULL;
+	bufferW = bufferH = 200;
+
 	// No active scene when initializing
 	this->_activeObject = NULL;
 
@@ -21,6 +25,11 @@ HiddenViewer::HiddenViewer( QWidget * parent ) : QGLViewer (parent)
 	objectTransformation.bbmin = Vec3d(-1,-1,-1);
 }
 
+HiddenViewer::~HiddenViewer()
+{
+	delete fbo;
+}
+
 void HiddenViewer::init()
 {
 	setBackgroundColor(backColor = palette().color(QPalette::Window));
@@ -89,6 +98,46 @@ void HiddenViewer::preDraw()
 	QGLViewer::preDraw();
 }
 
+void HiddenViewer::resizeGL( int width, int height )
+{
+	QGLViewer::resizeGL(width, height);
+
+	// The camera always projects to the offscreen buffer
+	camera()->setScreenWidthAndHeight(bufferW, bufferH);
+}
+
+void HiddenViewer::renderToBuffer()
+{
+	makeCurrent();
+
+	if(!fbo || fbo->width() != bufferW || fbo->height() != bufferH)
+	{
+		delete fbo;
+		fbo = new QGLFramebufferObject(bufferW, bufferH, QGLFramebufferObject::Depth);
+	}
+
+	fbo->bind();
+	glViewport(0, 0, bufferW, bufferH);
+	camera()->setScreenWidthAndHeight(bufferW, bufferH);
+
+	preDraw();
+	draw();
+	glFinish();
+
+	fbo->release();
+	glViewport(0, 0, width(), height());
+}
+
+int HiddenViewer::bufferWidth()
+{
+	return bufferW;
+}
+
+int HiddenViewer::bufferHeight()
+{
+	return bufferH;
+}
+
 void HiddenViewer::draw()
 {
 	glPushMatrix();
@@ -143,8 +192,8 @@ void* HiddenViewer::readBuffer( GLenum format, GLenum type )
 {
 	void * data = NULL;
 
-	int w = this->width();
-	int h = this->height();
+	int w = bufferW;
+	int h = bufferH;
 
 	switch(format)
 	{
@@ -157,12 +206,25 @@ void* HiddenViewer::readBuffer( GLenum format, GLenum type )
 		break;
 	}
 
+	makeCurrent();
+
+	if(fbo) fbo->bind();
 	glReadPixels(0, 0, w, h, format, type, data);
+	if(fbo) fbo->release();
 
 	return data;
 }
 
 void HiddenViewer::setResolution( int newRes )
 {
-	setFixedSize(newRes,newRes);
+	setBufferSize(newRes, newRes);
+}
+
+void HiddenViewer::setBufferSize( int w, int h )
+{
+	bufferW = Max(1, w);
+	bufferH = Max(1, h);
+
+	// The widget keeps its size
+	camera()->setScreenWidthAndHeight(bufferW, bufferH);
 }
@@ -3,6 +3,8 @@
 #include "GUI/Viewer/libQGLViewer/QGLViewer/qglviewer.h"
 using namespace qglviewer;
 
+#include <QGLFramebufferObject>
+
 #include "GraphicsLibrary/Mesh/SurfaceMesh/Vector.h"
 
 enum HVMode { HV_NONE, HV_DEPTH, HV_FACEUNIQUE };
@@ -24,10 +26,14 @@ private:
 	QColor backColor;
 	QSegMesh * _activeObject;
 	HVMode mode;
-	int size;
+
+	// Offscreen target, independent of the widget size
+	QGLFramebufferObject * fbo;
+	int bufferW, bufferH;
 
 public:
 	HiddenViewer(QWidget * parent = 0);
+	~HiddenViewer();
 
 	void init();
 	void setupCamera();
@@ -35,6 +41,12 @@ public:
 	
 	void preDraw();
 	void draw();
+	void resizeGL(int width, int height);
+
+	// Draw the current mode into the offscreen buffer, \readBuffer() reads it back
+	void renderToBuffer();
+	int bufferWidth();
+	int bufferHeight();
 
 	void setMode(HVMode toMode);
 	QSegMesh* activeObject();
@@ -46,5 +58,6 @@ public:
 public slots:
 	void setActiveObject(QSegMesh * changedObject);
 	void setResolution( int newRes );
+	void setBufferSize( int w, int h );
 
 };
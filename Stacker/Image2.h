@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+// Contiguous 2D image, \image[y][x] is the pixel (x, y)
+// Rows are padded to 16 bytes so that each one starts aligned for SSE
+template< typename T >
+class Image2
+{
+public:
+	typedef Eigen::Array<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> ArrayType;
+	typedef Eigen::Array<T, Eigen::Dynamic, 1> RowType;
+	typedef Eigen::Map<ArrayType, Eigen::Unaligned, Eigen::OuterStride<> > MapType;
+	typedef Eigen::Map<const ArrayType, Eigen::Unaligned, Eigen::OuterStride<> > ConstMapType;
+	typedef Eigen::Map<RowType, Eigen::Aligned> RowMapType;
+	typedef Eigen::Map<const RowType, Eigen::Aligned> ConstRowMapType;
+
+	Image2() : w(0), h(0), s(0) {}
+	Image2( int width, int height, T initial = T() ) : w(0), h(0), s(0) { resize(width, height, initial); }
+
+	// Storage is kept when the size does not grow
+	void resize( int width, int height )
+	{
+		int packet = std::max(1, 16 / (int)sizeof(T));
+
+		w = width;
+		h = height;
+		s = ((w + packet - 1) / packet) * packet;
+
+		pixels.resize(s * h);
+	}
+
+	void resize( int width, int height, T value )
+	{
+		resize(width, height);
+		fill(value);
+	}
+
+	void fill( T value )	{ std::fill(pixels.begin(), pixels.end(), value); }
+	void clear()			{ w = h = s = 0; pixels.clear(); }
+	bool empty() const		{ return w == 0 || h == 0; }
+
+	int width() const		{ return w; }
+	int height() const		{ return h; }
+	int stride() const		{ return s; }
+
+	T* data()				{ return pixels.empty() ? NULL : &pixels[0]; }
+	const T* data() const	{ return pixels.empty() ? NULL : &pixels[0]; }
+
+	T* operator[]( int y )				{ return &pixels[y * s]; }
+	const T* operator[]( int y ) const	{ return &pixels[y * s]; }
+
+	// Eigen views for the vectorized kernels
+	MapType map()						{ return MapType(data(), h, w, Eigen::OuterStride<>(s)); }
+	ConstMapType map() const			{ return ConstMapType(data(), h, w, Eigen::OuterStride<>(s)); }
+	RowMapType row( int y )				{ return RowMapType((*this)[y], w); }
+	ConstRowMapType row( int y ) const	{ return ConstRowMapType((*this)[y], w); }
+
+	T maxValue() const	{ return map().maxCoeff(); }
+	T minValue() const	{ return map().minCoeff(); }
+
+private:
+	int w, h, s;
+	std::vector< T, Eigen::aligned_allocator<T> > pixels;
+};
@@ -5,6 +5,7 @@
 #include "Controller.h"
 #include "Propagator.h"
 #include "EditPath.h"
+#include <omp.h>
 
 Improver::Improver( Offset *offset )
 {
@@ -15,6 +16,13 @@ Improver::Improver( Offset *offset )
 	BB_TOLERANCE = 1.2;
 	TARGET_STACKABILITY = 0.4;
 	LOCAL_RADIUS = 1;
+	UNIQUE_THRESHOLD = 0.01;
+
+	// Parallel search
+	isParallel = false;
+	NUM_PARALLEL_CANDIDATES = omp_get_max_threads();
+
+	isDeferred = false;
 }
 
 QSegMesh* Improver::activeObject()
@@ -47,6 +55,21 @@ void Improver::setLocalRadius( int R )
 	LOCAL_RADIUS = R;
 }
 
+void Improver::setUniqueThreshold( double threshold )
+{
+	UNIQUE_THRESHOLD = threshold;
+}
+
+void Improver::setParallelSearch( bool isParallel )
+{
+	this->isParallel = isParallel;
+}
+
+void Improver::setDeferredDeformation( bool isDeferred )
+{
+	this->isDeferred = isDeferred;
+}
+
 bool Improver::satisfyBBConstraint()
 {
 	bool result = true;
@@ -70,42 +93,19 @@ bool Improver::satisfyBBConstraint()
 	return result;
 }
 
-bool Improver::isUnique( ShapeState state, double threshold )
+bool Improver::isUnique( const std::vector<double> & feature, double threshold )
 {
-	// dissimilar to \solutions
-	foreach(ShapeState ss, solutions){
-		if (ctrl()->similarity(ss, state) < threshold)
-			return false;
-	}
-
-	// dissimilar to used candidate solutions
-	foreach(ShapeState ss, usedCandidateSolutions){
-		if (ctrl()->similarity(ss, state) < threshold)
-			return false;
-	}
-
-	// dissimilar to candidate solutions
-	PQShapeStateLessEnergy candSolutionsCopy = candidateSolutions;
-	while(!candSolutionsCopy.empty())
-	{
-		ShapeState ss = candSolutionsCopy.top();
-
-		if (ctrl()->similarity(ss, state) < threshold)
-			return false;
-
-		candSolutionsCopy.pop();
-	}
-
-	return true;
+	// dissimilar to \solutions, used and current candidate solutions
+	return !visitedStates.hasWithin(feature, threshold);
 }
 
-void Improver::setPositionalConstriants( HotSpot& fixedHS )
+void Improver::setPositionalConstriants( SearchContext & c, HotSpot& fixedHS )
 {
-	std::vector<HotSpot> fixedHotspots = activeOffset->getHotspots(fixedHS.side);
+	std::vector<HotSpot> fixedHotspots = c.offset->getHotspots(fixedHS.side);
 
 	foreach(HotSpot hs, fixedHotspots)
 	{
-		Primitive* prim = ctrl()->getPrimitive(hs.segmentID);
+		Primitive* prim = c.ctrl->getPrimitive(hs.segmentID);
 
 		// Make them fixed
 		foreach(Point p, hs.rep)
@@ -116,19 +116,30 @@ void Improver::setPositionalConstriants( HotSpot& fixedHS )
 	}
 }
 
-void Improver::recordSolution(Point handleCenter, Vec3d localMove)
+// Stackability of the shape of \c, of its proxy with deferred deformation
+double Improver::computeStackability( SearchContext & c )
 {
-	activeOffset->computeStackability();
-	double stackability = activeObject()->val["stackability"];
+	if (!c.proxy) return c.offset->computeStackability();
+
+	c.ctrl->updateProxy(c.proxy);
+	double stackability = c.offset->computeStackability();
+
+	// Shape states are read from the mesh
+	c.mesh->val["stackability"] = c.proxy->val["stackability"];
+	c.mesh->vec["stacking_shift"] = c.proxy->vec["stacking_shift"];
 
-	ShapeState state = ctrl()->getShapeState();
+	return stackability;
+}
+
+void Improver::recordSolution( SearchContext & c, Point handleCenter, Vec3d localMove )
+{
+	double stackability = computeStackability(c);
 
-	// \state has to be unique
-//	if (!isUnique(state, 0)) return;
+	ShapeState state = c.ctrl->getShapeState();
 
 	// Properties
 	state.deltaStackability = stackability - origStackability;
-	state.distortion = ctrl()->getDistortion();
+	state.distortion = c.ctrl->getDistortion();
 
 	EditPath path;
 	path.center = handleCenter;
@@ -137,8 +148,9 @@ void Improver::recordSolution(Point handleCenter, Vec3d localMove)
 
 	state.path = path;
 
-	// Store the state
-	candidateSolutions.push(state);	
+	// Store the state, merged into \candidateSolutions by \execute() if it is unique
+	c.children.push_back(state);
+	c.childFeatures.push_back(c.ctrl->stateFeature());
 }
 
 QVector<double> Improver::getLocalScales( HotSpot& HS )
@@ -158,7 +170,7 @@ QVector<double> Improver::getLocalScales( HotSpot& HS )
 	return scales;
 }
 
-QVector<Vec3d> Improver::getLocalMoves( HotSpot& HS )
+QVector<Vec3d> Improver::getLocalMoves( SearchContext & c, HotSpot& HS )
 {
 	// Debug
 //	std::cout << "Local radius = " << LOCAL_RADIUS << std::endl;
@@ -174,7 +186,7 @@ QVector<Vec3d> Improver::getLocalMoves( HotSpot& HS )
 	// Horizontal moves
 	if (HS.type == POINT_HOTSPOT)
 	{
-		Primitive* prim = ctrl()->getPrimitive(HS.segmentID);
+		Primitive* prim = c.ctrl->getPrimitive(HS.segmentID);
 		if (!(prim->primType == GCYLINDER && prim->symmPlanes.size() == 1))
 		{
 			double min_x = - step[0] * LOCAL_RADIUS;
@@ -226,28 +238,31 @@ QVector<Vec3d> Improver::getLocalMoves( HotSpot& HS )
 	return result;
 }
 
-void Improver::deformNearPointLineHotspot( int side )
+void Improver::deformNearPointLineHotspot( SearchContext & c, int side )
 {
 	// The first pair of hot spots
-	HotSpot& freeHS = activeOffset->getHotspot(side, 0);
-	HotSpot& fixedHS = activeOffset->getHotspot(-side, 0);
-	Primitive* free_prim = ctrl()->getPrimitive(freeHS.segmentID);
-	Primitive* fixed_prim = ctrl()->getPrimitive(fixedHS.segmentID);
+	HotSpot& freeHS = c.offset->getHotspot(side, 0);
+	HotSpot& fixedHS = c.offset->getHotspot(-side, 0);
+	Primitive* free_prim = c.ctrl->getPrimitive(freeHS.segmentID);
+	Primitive* fixed_prim = c.ctrl->getPrimitive(fixedHS.segmentID);
 	QVector<Point> free_handle = freeHS.rep;
 	QVector<Point> fixed_hanble = fixedHS.rep;
 
 	// Move the hotspot locally
-	Propagator propagator(ctrl());
-	QVector<Vec3d> Ts = getLocalMoves(freeHS);
+	Propagator propagator(c.ctrl);
+	QVector<Vec3d> Ts = getLocalMoves(c, freeHS);
 
 	//// debug
 	//Ts.clear();
 	//Ts.push_back(Vec3d(0,0.2,0));
 
+	// Each move is undone from the journal of the current candidate
+	c.ctrl->beginEdit();
+
 	foreach ( Vec3d T, Ts)
 	{
-		ctrl()->setPrimitivesFrozen(false);	// Clear flags
-		setPositionalConstriants(fixedHS); // Fix one end
+		c.ctrl->setPrimitivesFrozen(false);	// Clear flags
+		setPositionalConstriants(c, fixedHS); // Fix one end
 
 		// Move the other end
 		if (freeHS.type == POINT_HOTSPOT)
@@ -268,37 +283,40 @@ void Improver::deformNearPointLineHotspot( int side )
 
 		// Record the shape state
 		if (freeHS.type == POINT_HOTSPOT)
-			recordSolution(free_handle.first(), T);
+			recordSolution(c, free_handle.first(), T);
 		else
-			recordSolution( (free_handle.first()+free_handle.last())/2, T);
+			recordSolution(c, (free_handle.first()+free_handle.last())/2, T);
 
 		// Restore the shape state of current candidate
-		ctrl()->setShapeState(currentCandidate);
+		c.ctrl->rollbackEdit();
 	}
 }
 
-void Improver::deformNearRingHotspot( int side )
+void Improver::deformNearRingHotspot( SearchContext & c, int side )
 {
 	// The first pair of hot spots
-	HotSpot& freeHS = activeOffset->getHotspot(side, 0);
-	HotSpot& fixedHS = activeOffset->getHotspot(-side, 0);
-	Primitive* free_prim = ctrl()->getPrimitive(freeHS.segmentID);
-	Primitive* fixed_prim = ctrl()->getPrimitive(fixedHS.segmentID);
+	HotSpot& freeHS = c.offset->getHotspot(side, 0);
+	HotSpot& fixedHS = c.offset->getHotspot(-side, 0);
+	Primitive* free_prim = c.ctrl->getPrimitive(freeHS.segmentID);
+	Primitive* fixed_prim = c.ctrl->getPrimitive(fixedHS.segmentID);
 	int free_cid = free_prim->detectHotCurve(freeHS.hotSamples);
 	Point free_curve_center = free_prim->curveCenter(free_cid);
 
 	// Scale the ring hot spot
-	Propagator propagator(ctrl());
+	Propagator propagator(c.ctrl);
 	QVector<double> scales = getLocalScales(freeHS);
 
 	// debug
 	//scales.clear();
 	//scales.push_back(0.5);
 
+	// Each scale is undone from the journal of the current candidate
+	c.ctrl->beginEdit();
+
 	foreach (double scale, scales)
 	{
-		ctrl()->setPrimitivesFrozen(false);	// Clear flags
-		setPositionalConstriants(fixedHS); // Fix one end
+		c.ctrl->setPrimitivesFrozen(false);	// Clear flags
+		setPositionalConstriants(c, fixedHS); // Fix one end
 
 		// Scale the other end
 		free_prim->scaleCurve(free_cid, scale);
@@ -318,27 +336,152 @@ void Improver::deformNearRingHotspot( int side )
 		else
 			delta = free_curve_center - hotSample;
 
-		recordSolution(hotSample, delta.normalized()/10);
+		recordSolution(c, hotSample, delta.normalized()/10);
 
 		// Restore the shape state of current candidate
-		ctrl()->setShapeState(currentCandidate);
+		c.ctrl->rollbackEdit();
 	}
 }
 
-void Improver::deformNearHotspot( int side )
+void Improver::deformNearHotspot( SearchContext & c, int side )
 {
-	switch (activeOffset->getHotspot(side, 0).type)
+	switch (c.offset->getHotspot(side, 0).type)
 	{
 	case POINT_HOTSPOT:
 	case LINE_HOTSPOT:
-		deformNearPointLineHotspot(side);
+		deformNearPointLineHotspot(c, side);
 		break;
 	case RING_HOTSPOT:
-		deformNearRingHotspot(side);
+		deformNearRingHotspot(c, side);
 		break;
 	}
 }
 
+void Improver::expandCandidate( SearchContext & c, bool isExpanding )
+{
+	c.children.clear();
+	c.childFeatures.clear();
+
+	c.ctrl->setShapeState(c.candidate);
+	c.stackability = computeStackability(c);
+
+	// Solutions are not expanded, the ones of proxies may be rejected at full resolution
+	if ((c.stackability >= TARGET_STACKABILITY && !isDeferred) || !isExpanding) return;
+
+	// Detect hot spots
+	c.offset->detectHotspots();
+	if (c.offset->upperHotSpots.empty() || c.offset->lowerHotSpots.empty())
+		std::cout << "\nWARNING: Hot spot detection failed.\n";
+
+	// Local modification
+	deformNearHotspot(c, 1);
+	deformNearHotspot(c, -1);
+}
+
+// === Shape copies
+// Software evaluator with the settings of the active one
+Offset * Improver::createOffset( QSegMesh * mesh )
+{
+	Offset * offset = new Offset(NULL);
+	offset->setActiveObject(mesh);
+	offset->setEnvelopeResolution(activeOffset->bufferWidth(), activeOffset->bufferHeight());
+	offset->setSearchType(activeOffset->searchType);
+	offset->setSearchDensity(activeOffset->searchDensity);
+	offset->setConeSize(activeOffset->coneSize);
+	offset->setTiledEnvelope(activeOffset->isTiledEnvelope);
+	offset->setIncremental(true);
+
+	return offset;
+}
+
+void Improver::createContexts( int count )
+{
+	for (int i = 0; i < count; i++)
+	{
+		SearchContext c;
+		c.proxy = NULL;
+
+		if (count == 1)
+		{
+			// Serial search runs on the active shape
+			c.mesh = activeObject();
+			c.ctrl = ctrl();
+			c.offset = activeOffset;
+		}
+		else
+		{
+			// Isolated copies with their own evaluator, in the state the search starts from
+			// The active evaluator may need the GL context of the main thread, it is left alone
+			c.mesh = new QSegMesh(*activeObject());
+			c.ctrl = ctrl()->clone(c.mesh);
+			c.mesh->ptr["controller"] = c.ctrl;
+			c.offset = createOffset(c.mesh);
+		}
+
+		// The envelopes are the ones of the primitives, the mesh is not deformed
+		if (isDeferred)
+		{
+			c.proxy = new QSegMesh();
+			c.proxy->setObjectName(c.mesh->objectName() + "-proxy");
+			c.ctrl->updateProxy(c.proxy);
+			c.proxy->ptr["controller"] = c.ctrl;
+			c.ctrl->setDeferredDeformation(true);
+
+			if (c.offset == activeOffset)
+				c.offset = createOffset(c.proxy);
+			else
+				c.offset->setActiveObject(c.proxy);
+		}
+
+		contexts.push_back(c);
+	}
+}
+
+void Improver::destroyContexts()
+{
+	for (int i = 0; i < contexts.size(); i++)
+	{
+		SearchContext & c = contexts[i];
+
+		// Pending deformations of the active shape are applied, clones are dropped as they are
+		if (c.proxy)
+		{
+			if (c.ctrl == ctrl()) c.ctrl->setDeferredDeformation(false);
+
+			foreach(QSurfaceMesh * segment, c.proxy->getSegments())
+				delete segment;
+			delete c.proxy;
+		}
+
+		if (c.offset == activeOffset) continue;
+		delete c.offset;
+
+		if (c.ctrl == ctrl()) continue;
+		delete c.ctrl;
+		delete c.mesh;
+	}
+
+	contexts.clear();
+}
+
+// Solutions found on proxies are deformed and evaluated at full resolution
+bool Improver::confirmSolution( ShapeState & solution, double fullStackability )
+{
+	// Only the primitives edited since the last state are deformed
+	ctrl()->setShapeState(solution);
+	ctrl()->setDeferredDeformation(false);
+
+	double stackability = activeOffset->computeStackability();
+	solution.stackability = stackability;
+	solution.deltaStackability = stackability - fullStackability;
+	solution.stacking_shift = activeObject()->vec["stacking_shift"];
+
+	// The serial search keeps working on the primitives of the active shape
+	if (contexts.front().ctrl == ctrl()) ctrl()->setDeferredDeformation(true);
+
+	return stackability >= TARGET_STACKABILITY;
+}
+
 // === Main access
 void Improver::execute(int level)
 {
@@ -346,64 +489,114 @@ void Improver::execute(int level)
 	solutions.clear();
 	usedCandidateSolutions.clear();
 	candidateSolutions = PQShapeStateLessEnergy();
+	visitedStates.clear();
 
 	// The bounding box constraint is hard
 	constraint_bbmin = activeObject()->bbmin * BB_TOLERANCE;
 	constraint_bbmax = activeObject()->bbmax * BB_TOLERANCE;
 
+	// Only the edited segments are rendered again while searching
+	bool wasIncremental = activeOffset->isIncremental;
+	activeOffset->setIncremental(true);
+
 	// The original stackability
 	origStackability = activeOffset->computeStackability();
 
 	// Push the current shape as the initial candidate solution
 	ShapeState origState = ctrl()->getShapeState();
 	candidateSolutions.push(origState);
-	double currentStackability = 0;
+	visitedStates.insert(ctrl()->stateFeature());
+
+	// One shape per candidate expanded at once
+	createContexts(isParallel ? Max(1, NUM_PARALLEL_CANDIDATES) : 1);
+
+	// Candidates are compared on proxies
+	double fullStackability = origStackability;
+	if (isDeferred) origStackability = computeStackability(contexts.front());
 
 // Timer
 timer.restart();
+	bool isDone = false;
 	while( ( level>0 || level==IMPROVER_MAGIC_NUMBER )	// Suggest || Improve
-		&& !candidateSolutions.empty())
+		&& !candidateSolutions.empty() && !isDone)
 	{
-		// Set current
-		currentCandidate = candidateSolutions.top();
-		candidateSolutions.pop();
-		ctrl()->setShapeState(currentCandidate);
-		currentStackability = activeOffset->computeStackability();
+		// The best candidates, no more than the remaining levels
+		int k = contexts.size();
+		if (level != IMPROVER_MAGIC_NUMBER) k = Min(k, level);
 
-		std::cout << "CurrStackability = " << currentStackability << "\n";
+		QVector<ShapeState> batch;
+		while (batch.size() < k && !candidateSolutions.empty())
+		{
+			batch.push_back(candidateSolutions.top());
+			candidateSolutions.pop();
+		}
 
-		// Solution or not
-		if (currentStackability >= TARGET_STACKABILITY)
+		// Expand them at the same time, each on its own shape
+		bool isExpanding = solutions.size() < NUM_EXPECTED_SOLUTION;
+
+		#pragma omp parallel for schedule(dynamic) if(batch.size() > 1)
+		for (int i = 0; i < batch.size(); i++)
 		{
-			solutions.push_back(currentCandidate);
-			//std::cout << solutions.size() << " solutions have been found. \n";
-			continue;
+			contexts[i].candidate = batch[i];
+			expandCandidate(contexts[i], isExpanding);
 		}
 
-		// #solutions 	
-		if (solutions.size() >= NUM_EXPECTED_SOLUTION) break;
+		// Merge in the order of the batch, the result does not depend on the threads
+		for (int i = 0; i < batch.size(); i++)
+		{
+			SearchContext & c = contexts[i];
 
-		// Detect hot spots
-		activeOffset->detectHotspots();
-		if (activeOffset->upperHotSpots.empty() || activeOffset->lowerHotSpots.empty())
-			std::cout << "\nWARNING: Hot spot detection failed.\n";
+			std::cout << "CurrStackability = " << c.stackability << "\n";
 
-		// Local modification
-		deformNearHotspot(1);
-		deformNearHotspot(-1);
+			// Solution or not, proxy scores are confirmed on the deformed shape
+			if (c.stackability >= TARGET_STACKABILITY && (!isDeferred || confirmSolution(c.candidate, fullStackability)))
+			{
+				solutions.push_back(c.candidate);
+				//std::cout << solutions.size() << " solutions have been found. \n";
+				continue;
+			}
+
+			// #solutions 	
+			if (solutions.size() >= NUM_EXPECTED_SOLUTION)
+			{
+				isDone = true;
+				break;
+			}
 
-		// Decrease the suggesting level
-		if (level != IMPROVER_MAGIC_NUMBER) level--;
+			// Unique children, the ones of a copy are moved onto the active shape
+			for (int j = 0; j < c.children.size(); j++)
+			{
+				if (!isUnique(c.childFeatures[j], UNIQUE_THRESHOLD)) continue;
+				visitedStates.insert(c.childFeatures[j]);
+
+				ShapeState child = c.children[j];
+				ctrl()->adoptGroups(child);
+				candidateSolutions.push(child);
+			}
 
+			// Decrease the suggesting level
+			if (level != IMPROVER_MAGIC_NUMBER) level--;
+		}
 
-		//std::cout << "One level: E = " << currentCandidate.energy() << ", currS = " << currentStackability;
 		//std::cout << " #Cand = " << candidateSolutions.size() << std::endl;
 	}
 
 std::cout << "Total time = " <<(double)timer.elapsed()/60000 << " min\n";
 
+	if (isDeferred)
+	{
+		// Only the segments edited since the original are deformed back
+		ctrl()->setShapeState(origState);
+		destroyContexts();
+
+		origStackability = fullStackability;
+	}
+	else
+		destroyContexts();
+
 	// Restore the original
 	ctrl()->setShapeState(origState);
+	activeOffset->setIncremental(wasIncremental);
 	std::cout << "Searching completed.\n" << std::endl;
 }
 
@@ -4,6 +4,7 @@
 
 #include "HotSpot.h"
 #include "ShapeState.h"
+#include "StateIndex.h"
 
 class Offset;
 class QSegMesh;
@@ -12,6 +13,20 @@ class Propagator;
 
 #define IMPROVER_MAGIC_NUMBER -99999
 
+// A shape on which candidates are expanded, the active one or an isolated copy
+struct SearchContext
+{
+	QSegMesh * mesh;
+	Controller * ctrl;
+	Offset * offset;
+	QSegMesh * proxy;		// Evaluated instead of \mesh with deferred deformation
+
+	ShapeState candidate;
+	double stackability;
+	QVector<ShapeState> children;
+	QVector< std::vector<double> > childFeatures;	// Controller::stateFeature() of each child
+};
+
 class Improver : public QObject
 {
 	Q_OBJECT
@@ -24,31 +39,46 @@ public:
 	double BB_TOLERANCE;
 	double TARGET_STACKABILITY;
 	int LOCAL_RADIUS;
+	double UNIQUE_THRESHOLD;		// Closer states are dropped, see Controller::similarity()
+	int NUM_PARALLEL_CANDIDATES;	// Candidates expanded at once in parallel mode
+	bool isParallel;
+	bool isDeferred;				// Search on the primitives, only solutions deform the mesh
 
 	// Execute improving
 	void execute(int level = IMPROVER_MAGIC_NUMBER);
 
 private:
-	void setPositionalConstriants( HotSpot& fixedHS );
+	void setPositionalConstriants( SearchContext & c, HotSpot& fixedHS );
 	bool satisfyBBConstraint();
-	bool isUnique( ShapeState state, double threshold );
-	void recordSolution(Point handleCenter, Vec3d localMove);
+	bool isUnique( const std::vector<double> & feature, double threshold );
+	void recordSolution( SearchContext & c, Point handleCenter, Vec3d localMove );
+	double computeStackability( SearchContext & c );
+	bool confirmSolution( ShapeState & solution, double fullStackability );
 
-	QVector<Vec3d> getLocalMoves( HotSpot& HS );
+	QVector<Vec3d> getLocalMoves( SearchContext & c, HotSpot& HS );
 	QVector<double> getLocalScales( HotSpot& HS );
-	void deformNearPointLineHotspot( int side );
-	void deformNearRingHotspot( int side );
-	void deformNearHotspot( int side );
+	void deformNearPointLineHotspot( SearchContext & c, int side );
+	void deformNearRingHotspot( SearchContext & c, int side );
+	void deformNearHotspot( SearchContext & c, int side );
+	void expandCandidate( SearchContext & c, bool isExpanding );
+
+	// Shapes of the search, the active one or copies of it in parallel mode
+	QVector<SearchContext> contexts;
+	Offset * createOffset( QSegMesh * mesh );
+	void createContexts( int count );
+	void destroyContexts();
 
 public:
 	// Best first Searching
 	double origStackability;
 	Vec3d constraint_bbmin, constraint_bbmax;
-	ShapeState currentCandidate;
 	PQShapeStateLessEnergy candidateSolutions;
 	QVector<ShapeState> usedCandidateSolutions;
 	QVector<ShapeState> solutions;
 
+	// Every state that entered \candidateSolutions
+	StateIndex visitedStates;
+
 private:
 	Offset* activeOffset;
 	QSegMesh* activeObject();
@@ -61,6 +91,9 @@ public slots:
 	void setBBTolerance(double tol);
 	void setNumExpectedSolutions(int num);
 	void setLocalRadius(int R);
+	void setUniqueThreshold(double threshold);
+	void setParallelSearch(bool isParallel);
+	void setDeferredDeformation(bool isDeferred);
 
 signals:
 	void printMessage( QString );
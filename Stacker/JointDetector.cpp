@@ -7,6 +7,8 @@
 
 #include <algorithm>
 #include "GraphicsLibrary/Voxel/Voxeler.h"
+#include "GraphicsLibrary/Voxel/VoxelBitset.h"
+#include "GraphicsLibrary/SpacePartition/AABBTree.h"
 #include "MathLibrary/Bounding/MinOBB3.h"
 #include "Numeric.h"
 
@@ -30,35 +32,65 @@ QVector<Group*> JointDetector::detect( QVector<Primitive*> primitives )
 		voxels.push_back( Voxeler(&mesh, JOINT_THRESHOLD) );
 	}
 
-	for(uint i = 0; i < primitives.size(); i++)
+	// Broad phase, only primitives with overlapping voxel bounds are intersected
+	std::vector<BoundingBox> bounds;
+	std::vector<int> nonEmpty;
+	int originZ = INT_MAX;
+
+	for(int i = 0; i < (int)voxels.size(); i++)
 	{
-		Primitive * a = primitives[i];
+		if(voxels[i].voxels.empty()) continue;
 
-		for (uint j = i + 1; j < primitives.size(); j++)
-		{
-			Primitive * b = primitives[j];
+		// The constructor leaves the bounds unset
+		voxels[i].computeBounds();
+
+		Vec3d half(0.5, 0.5, 0.5);
+		bounds.push_back(BoundingBox((Vec3d(voxels[i].minVox) - half) * JOINT_THRESHOLD, (Vec3d(voxels[i].maxVox) + half) * JOINT_THRESHOLD));
+		nonEmpty.push_back(i);
+		originZ = Min(originZ, voxels[i].minVox.z);
+	}
+
+	std::vector< std::pair<int,int> > pairs = AABBTree(bounds).overlappingPairs();
+
+	// Narrow phase, the occupancy of both primitives is intersected word by word
+	std::vector<VoxelBitset> occupancy(voxels.size());
+	for(int k = 0; k < (int)nonEmpty.size(); k++)
+		occupancy[nonEmpty[k]] = VoxelBitset(voxels[nonEmpty[k]].voxels, originZ);
 
-			std::vector<Voxel> intersection = voxels[i].Intersects(&voxels[j]);
+	std::vector< std::vector<Voxel> > intersections(pairs.size());
 
-			if(!intersection.empty())
-			{
-				// Voxel positions
-				std::vector<Point> points;
-				foreach( Voxel v, intersection){
-					points.push_back(Point(v.x, v.y, v.z) * JOINT_THRESHOLD);
-				}
+	#pragma omp parallel for schedule(dynamic)
+	for(int p = 0; p < (int)pairs.size(); p++)
+	{
+		int i = nonEmpty[pairs[p].first], j = nonEmpty[pairs[p].second];
+		intersections[p] = occupancy[i].intersection(occupancy[j]);
+	}
 
-				//// Debug: visualize the intersection
-				//foreach (Point p, points)
-				//	a->debugPoints.push_back(p);
+	// Joints in the order of the pairs
+	for(int p = 0; p < (int)pairs.size(); p++)
+	{
+		std::vector<Voxel> & intersection = intersections[p];
 
-				// Analyze the pair-wise intersection
-				QVector<Group*> pairwiseJoints = analyzeIntersection(a, b, points);
+		if(!intersection.empty())
+		{
+			Primitive * a = primitives[nonEmpty[pairs[p].first]];
+			Primitive * b = primitives[nonEmpty[pairs[p].second]];
 
-				foreach(Group* g, pairwiseJoints)
-					Joints.push_back(g);
+			// Voxel positions
+			std::vector<Point> points;
+			foreach( Voxel v, intersection){
+				points.push_back(Point(v.x, v.y, v.z) * JOINT_THRESHOLD);
 			}
 
+			//// Debug: visualize the intersection
+			//foreach (Point p, points)
+			//	a->debugPoints.push_back(p);
+
+			// Analyze the pair-wise intersection
+			QVector<Group*> pairwiseJoints = analyzeIntersection(a, b, points);
+
+			foreach(Group* g, pairwiseJoints)
+				Joints.push_back(g);
 		}
 	}
 
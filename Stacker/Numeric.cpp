@@ -13,24 +13,38 @@ double GC_GAUSSIAN_SIGMA = 0.2;
 // Extreme
 double getMaxValue( Buffer2d& image )
 {
-	int h = image.size();
-
-	std::vector< double > row_max;
-	for (int y = 0; y < h; y++)
-		row_max.push_back(MaxElement(image[y]));
-
-	return MaxElement(row_max);
+	return image.maxValue();
 }
 
 double getMinValue( Buffer2d& image )
 {
-	int h = image.size();
+	return image.minValue();
+}
+
+// Pixel-wise
+// The lower envelope is horizontally flipped, background pixels have zero offset
+void offsetOfEnvelopes( Buffer2d& upper, Buffer2d& lower, double background, Buffer2d& offset )
+{
+	int w = upper.width();
+	int h = upper.height();
+
+	offset.resize(w, h);
 
-	std::vector< double > row_min;
+	#pragma omp parallel for
 	for (int y = 0; y < h; y++)
-		row_min.push_back(MinElement(image[y]));
+	{
+		Buffer2d::RowMapType U = upper.row(y);
+		Buffer2d::RowMapType L = lower.row(y);
+
+		offset.row(y) = (U == -background || L.reverse() == background).select(0.0, U - L.reverse());
+	}
+}
+
+void thresholdImage( Buffer2d& image, double threshold, Buffer2b& mask )
+{
+	mask.resize(image.width(), image.height());
 
-	return MinElement(row_min);
+	mask.map() = (image.map() > threshold).cast<unsigned char>();
 }
 
 // Regions
@@ -108,7 +122,7 @@ std::vector< double > getValuesInRegion( Buffer2d& image,
 {
 	std::vector< double > values;
 
-	int w = image[0].size();
+	int w = image.width();
 	uint x, y;
 	for (int i = 0; i < region.size(); i++)
 	{
@@ -122,86 +136,140 @@ std::vector< double > getValuesInRegion( Buffer2d& image,
 	return values;
 }
 
-std::vector< Vec2i > getRegionGreaterThan( Buffer2d& image, Buffer2b& mask, Vec2i seed, double threshold )
+// Union-find with path halving
+static int findRoot( std::vector<int>& uf, int i )
 {
-	std::vector< Vec2i > region;
+	while (uf[i] != i)
+	{
+		uf[i] = uf[uf[i]];
+		i = uf[i];
+	}
 
-	int w = image[0].size();
-	int h = image.size();		
+	return i;
+}
 
-	// Push the \seed to stack
-	std::stack<Vec2i> activePnts;
-	activePnts.push(seed);
-	mask[seed.y()][seed.x()] = true;
+int labelComponents( Buffer2b& mask, Buffer2i& labels )
+{
+	int w = mask.width();
+	int h = mask.height();
 
-	while (!activePnts.empty())
-	{
-		// Add one active point to \region
-		Vec2i currP = activePnts.top();
-		region.push_back(currP);
-		activePnts.pop();
-
-		// Push all its unvisited neighbors to the stack
-		int min_x = RANGED(0, currP.x()-1 ,w-1);
-		int max_x = RANGED(0, currP.x()+1, w-1);
-		int min_y = RANGED(0, currP.y()-1 ,h-1);
-		int max_y = RANGED(0, currP.y()+1, h-1);
-
-		for (int y = min_y; y <= max_y; y++)
-			for (int x = min_x; x <= max_x; x++)
-			{
-				if (!mask[y][x] && image[y][x]>threshold)
-				{
-					activePnts.push( Vec2i(x, y) );
-					mask[y][x] = true;
+	labels.resize(w, h, -1);
+	std::vector<int> uf;
+
+	// First pass: provisional labels from the visited neighbors
+	for (int y = 0; y < h; y++){
+		for (int x = 0; x < w; x++){
+			if (!mask[y][x]) continue;
+
+			int label = -1;
+			for (int dy = -1; dy <= 0; dy++){
+				for (int dx = -1; dx <= 1; dx++){
+					if (dy == 0 && dx == 0) break;
+
+					int nx = x + dx, ny = y + dy;
+					if (nx < 0 || nx >= w || ny < 0) continue;
+
+					int n = labels[ny][nx];
+					if (n < 0) continue;
+
+					if (label < 0)
+						label = findRoot(uf, n);
+					else
+					{
+						// The smaller label wins, so roots are in raster order
+						int r1 = findRoot(uf, label), r2 = findRoot(uf, n);
+						label = Min(r1, r2);
+						uf[Max(r1, r2)] = label;
+					}
 				}
 			}
+
+			if (label < 0)
+			{
+				label = uf.size();
+				uf.push_back(label);
+			}
+
+			labels[y][x] = label;
+		}
 	}
 
-	return region;
+	// Second pass: consecutive labels in the order of first appearance
+	std::vector<int> finalLabel(uf.size(), -1);
+	int nbLabels = 0;
+
+	for (int y = 0; y < h; y++){
+		for (int x = 0; x < w; x++){
+			if (labels[y][x] < 0) continue;
+
+			int r = findRoot(uf, labels[y][x]);
+			if (finalLabel[r] < 0) finalLabel[r] = nbLabels++;
+
+			labels[y][x] = finalLabel[r];
+		}
+	}
+
+	return nbLabels;
 }
 
-std::vector< std::vector< Vec2i > > getRegionsGreaterThan( Buffer2d& image, double threshold )
+std::vector< std::vector< Vec2i > > regionsOfLabels( Buffer2i& labels )
 {
 	std::vector< std::vector< Vec2i > > regions;
+	std::map<int, int> regionOf;
 
-	int w = image[0].size();
-	int h = image.size();
+	for (int y = 0; y < labels.height(); y++){
+		for (int x = 0; x < labels.width(); x++){
+			int label = labels[y][x];
+			if (label < 0) continue;
 
-	std::vector< std::vector< bool > > mask = createImage(w, h, false);
-
-	for(int y = 0; y < h; y++){
-		for(int x = 0; x < w; x++)	{
-			if (!mask[y][x] && image[y][x]>threshold)
+			if (!regionOf.count(label))
 			{
-				//saveAsImage(mask, "mask1.png");
-				std::vector< Vec2i > region = getRegionGreaterThan(image, mask, Vec2i(x, y), threshold);
-				regions.push_back(sampleRegion(region, 100));
-				//regions.push_back(region);
-				//saveAsImage(mask, "mask2.png");
+				regionOf[label] = regions.size();
+				regions.push_back(std::vector< Vec2i >());
 			}
-			mask[y][x] = true;
+
+			regions[regionOf[label]].push_back(Vec2i(x, y));
 		}
 	}
 
-	// If there are a lot of hot regions, regard them as one
-	std::vector< Vec2i > super_region, sampleSuper;
-	if (regions.size() > 10)
+	return regions;
+}
+
+// Sample the regions, if there are a lot of hot regions regard them as one
+static std::vector< std::vector< Vec2i > > hotRegionsOf( std::vector< std::vector< Vec2i > >& components )
+{
+	std::vector< std::vector< Vec2i > > regions;
+
+	if (components.size() > 10)
 	{
-		foreach(std::vector< Vec2i > r, regions)
-		{
-			foreach(Vec2i p, r)
-				super_region.push_back(p);
-		}
+		std::vector< Vec2i > super_region;
+		foreach(const std::vector< Vec2i > & r, components)
+			super_region.insert(super_region.end(), r.begin(), r.end());
 
-		regions.clear();
 		regions.push_back(sampleRegion(super_region, 100));
-		//regions.push_back(super_region);
+	}
+	else
+	{
+		for (int i = 0; i < (int)components.size(); i++)
+			regions.push_back(sampleRegion(components[i], 100));
 	}
 
 	return regions;
 }
 
+std::vector< std::vector< Vec2i > > getRegionsGreaterThan( Buffer2d& image, double threshold )
+{
+	Buffer2b above;
+	thresholdImage(image, threshold, above);
+
+	Buffer2i labels;
+	labelComponents(above, labels);
+
+	std::vector< std::vector< Vec2i > > components = regionsOfLabels(labels);
+
+	return hotRegionsOf(components);
+}
+
 
 
 // Shifting
@@ -254,8 +322,8 @@ std::vector< Vec2i > shiftRegionInBB( std::vector< Vec2i >& region, Vec2i delta,
 // Color
 void setRegionColor( Buffer2d& image, std::vector< Vec2i >& region, double color )
 {
-	uint w = image[0].size();
-	uint h = image.size();
+	uint w = image.width();
+	uint h = image.height();
 
 	for (int i = 0; i < region.size(); i++)
 	{
@@ -268,8 +336,8 @@ void setRegionColor( Buffer2d& image, std::vector< Vec2i >& region, double color
 
 void setPixelColor( Buffer2d& image, Vec2i pos, double color )
 {
-	uint w = image[0].size();
-	uint h = image.size();
+	uint w = image.width();
+	uint h = image.height();
 
 	uint x = RANGED(0, pos.x(), w-1);
 	uint y = RANGED(0, pos.y(), h-1);
@@ -290,7 +358,7 @@ QRgb jetColor( double val, double min, double max )
 // Visualize
 void visualizeRegions( int w, int h, std::vector< std::vector<Vec2i> >& regions, QString filename )
 {
-	std::vector< std::vector< double > > debugImg = createImage(w, h, 0.0);
+	Buffer2d debugImg(w, h, 0.0);
 	double step = 1.0 / regions.size();
 	for (int i=0;i<regions.size();i++)
 	{
@@ -307,8 +375,8 @@ std::vector< std::vector < T > > createImage( int w, int h, T intial )
 
 void saveAsImage( Buffer2d& image, QString fileName )
 {
-	int h = image.size();
-	int w = image[0].size();
+	int h = image.height();
+	int w = image.width();
 	QImage Output(w, h, QImage::Format_ARGB32);
 
 	double minV = getMinValue(image);
@@ -328,8 +396,8 @@ void saveAsImage( Buffer2d& image, QString fileName )
 
 void saveAsData( Buffer2d& image, double maxV, QString fileName )
 {
-	int h = image.size();
-	int w = image[0].size();
+	int h = image.height();
+	int w = image.width();
 
 	QFile file(fileName); 
 	file.open(QIODevice::WriteOnly | QIODevice::Text);
@@ -347,8 +415,8 @@ void saveAsData( Buffer2d& image, double maxV, QString fileName )
 
 void saveAsBinaryImage( Buffer2d& image, QString fileName )
 {
-	int h = image.size();
-	int w = image[0].size();
+	int h = image.height();
+	int w = image.width();
 	QImage Output(w, h, QImage::Format_ARGB32);
 
 	QRgb red = QColor::fromRgb(255, 0, 0).rgba();
@@ -535,48 +603,158 @@ std::vector<Point> uniformSampleCurve(std::vector<Point> & points)
 
 Vec3d maxMidMinValues( Buffer2d & image )
 {
-	//std::set<double> vals;
+	// The minimum, the next distinct value above it and the maximum
+	double minV = image.minValue();
+	double maxV = image.maxValue();
 
-	//int h = image.size();
-	//int w = image[0].size();
+	if (minV == maxV)
+		return Vec3d(minV, 0, 0);
 
-	//for(int y = 0; y < h; y++){
-	//	for(int x = 0; x < w; x++)	{
-	//		vals.insert(image);
-	//	}
-	//}
+	double midV = (image.map() > minV).select(image.map(), maxV).minCoeff();
 
-	//if(vals.size() > 1)
-	//	return Vec3d(*vals.begin(), *(vals.begin()++), *vals.rbegin());
-	//else
-	//	return Vec3d(*vals.begin(),0,0);
-	return Vec3d(0);
+	return Vec3d(minV, midV, maxV);
 }
 
 Buffer2v2i getMaximumRegions( Buffer2d &image )
 {
 	// Precondition: each pixel is greater or equal than 0
-	double maxV = getMaxValue(image);
-	Buffer2v2i regions;
+	MaxTree tree(image);
+	double maxV = tree.maxValue();
 	double hot_cap = 1.0;
 
-	while (regions.empty())
+	// Increase the cap until the hot regions are not too small,
+	// many tiny regions are merged into one by hotRegionsOf()
+	do
 	{
-		hot_cap -= 0.05; // increase the cap
-		regions = getRegionsGreaterThan(image, maxV * hot_cap);
+		hot_cap -= 0.05;
 
-		// If the hot regions are too small
-		int num = 0;
-		for (int i = 0; i < regions.size(); i++)
-		{
-			if (regions[i].size() > num) num = regions[i].size();
+		if (maxV <= 0) return Buffer2v2i();
+	}
+	while (tree.largestRegionGreaterThan(maxV * hot_cap) < 3 
+		&& tree.nbRegionsGreaterThan(maxV * hot_cap) <= 10);
+
+	std::vector< std::vector< Vec2i > > components = tree.regionsGreaterThan(maxV * hot_cap);
+
+	return hotRegionsOf(components);
+}
+
+// Max-tree
+struct greaterValue
+{
+	std::vector<double> * values;
+	bool operator () (int a, int b) const { return (*values)[a] > (*values)[b]; }
+};
+
+MaxTree::MaxTree( Buffer2d & image )
+{
+	w = image.width();
+	h = image.height();
+	int N = w * h;
+
+	values.resize(N);
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+			values[y * w + x] = image[y][x];
+
+	sorted.resize(N);
+	for (int i = 0; i < N; i++) sorted[i] = i;
+
+	greaterValue cmp;
+	cmp.values = &values;
+	std::stable_sort(sorted.begin(), sorted.end(), cmp);
+
+	// Union-find over the pixels added so far
+	parent.assign(N, -1);
+	largest.resize(N);
+	nbComponents.resize(N);
+
+	std::vector<int> uf(N, -1), area(N, 0);
+	int maxArea = 0, count = 0;
+
+	for (int i = 0; i < N; i++)
+	{
+		int p = sorted[i];
+		int px = p % w, py = p / w;
+
+		parent[p] = p;
+		uf[p] = p;
+		area[p] = 1;
+		count++;
+
+		for (int dy = -1; dy <= 1; dy++){
+			for (int dx = -1; dx <= 1; dx++){
+				int nx = px + dx, ny = py + dy;
+				if (nx < 0 || nx >= w || ny < 0 || ny >= h) continue;
+
+				int n = ny * w + nx;
+				if (uf[n] < 0) continue;
+
+				int r = findRoot(uf, n);
+				if (r == p) continue;
+
+				// \p is the lowest so far, it becomes the parent
+				parent[r] = p;
+				uf[r] = p;
+				area[p] += area[r];
+				count--;
+			}
 		}
 
-		if(num < 3) 
-			regions.clear();	
+		maxArea = Max(maxArea, area[p]);
+		largest[i] = maxArea;
+		nbComponents[i] = count;
 	}
+}
 
-	return regions;
+double MaxTree::maxValue()
+{
+	return sorted.empty() ? 0 : values[sorted.front()];
+}
+
+int MaxTree::nbPixelsGreaterThan( double threshold )
+{
+	// \sorted is decreasing, find the first value not greater than \threshold
+	int lo = 0, hi = sorted.size();
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (values[sorted[mid]] > threshold) lo = mid + 1; else hi = mid;
+	}
+
+	return lo;
+}
+
+int MaxTree::largestRegionGreaterThan( double threshold )
+{
+	int n = nbPixelsGreaterThan(threshold);
+	return n ? largest[n-1] : 0;
+}
+
+int MaxTree::nbRegionsGreaterThan( double threshold )
+{
+	int n = nbPixelsGreaterThan(threshold);
+	return n ? nbComponents[n-1] : 0;
+}
+
+std::vector< std::vector< Vec2i > > MaxTree::regionsGreaterThan( double threshold )
+{
+	int n = nbPixelsGreaterThan(threshold);
+
+	// Parents are added after their children, so walk from the lowest pixel up
+	Buffer2i labels(w, h, -1);
+
+	for (int i = n - 1; i >= 0; i--)
+	{
+		int p = sorted[i];
+		int q = parent[p];
+
+		if (q == p || values[q] <= threshold)
+			labels[p / w][p % w] = p;
+		else
+			labels[p / w][p % w] = labels[q / w][q % w];
+	}
+
+	return regionsOfLabels(labels);
 }
 
 
@@ -6,11 +6,14 @@
 #include <QString>
 
 #include <Eigen/Dense>
+#include "Image2.h"
 
 extern double GC_GAUSSIAN_SIGMA;
 
-typedef std::vector< std::vector<double> >	Buffer2d;
-typedef std::vector< std::vector<bool> >	Buffer2b;
+typedef Image2<double>			Buffer2d;
+typedef Image2<float>			Buffer2f;
+typedef Image2<unsigned char>	Buffer2b;
+typedef Image2<int>				Buffer2i;
 typedef std::vector< std::vector<Vec2i> >   Buffer2v2i;
 
 typedef Vec3d Point;
@@ -20,15 +23,22 @@ double getMinValue( Buffer2d & image );
 double getMaxValue( Buffer2d & image );
 Vec3d maxMidMinValues( Buffer2d & image );
 
+// Pixel-wise
+void offsetOfEnvelopes( Buffer2d & upper, Buffer2d & lower, double background, Buffer2d & offset );
+void thresholdImage( Buffer2d & image, double threshold, Buffer2b & mask );
+
 // Region
 double maxValueInRegion( Buffer2d& image,  std::vector< Vec2i >& region);
 Vec2i sizeofRegion( std::vector< Vec2i >& region );
 void BBofRegion( std::vector< Vec2i >& region, Vec2i &bbmin, Vec2i &bbmax );
 Vec2i centerOfRegion( std::vector< Vec2i >& region );
 std::vector< double > getValuesInRegion( Buffer2d& image, std::vector< Vec2i >& region, bool xFlipped = false );
-std::vector< Vec2i > getRegionGreaterThan( Buffer2d& image, Buffer2b& mask, Vec2i seed, double threshold);
 std::vector< std::vector< Vec2i > > getRegionsGreaterThan(Buffer2d& image, double threshold);
 
+// Connected components (8-neighbors)
+int labelComponents( Buffer2b& mask, Buffer2i& labels );
+std::vector< std::vector< Vec2i > > regionsOfLabels( Buffer2i& labels );
+
 // Shifting
 std::vector< Vec2i > deltaVectorsToKRing(int deltaX, int deltaY, int K);
 std::vector< Vec2i > shiftRegionInBB( std::vector< Vec2i >& region, Vec2i delta, Vec2i bbmin, Vec2i bbmax );
@@ -69,6 +79,28 @@ std::vector<Point> uniformSampleCurve(std::vector<Point> & points);
 // Adaptive maximum region detection
 Buffer2v2i getMaximumRegions(Buffer2d &image);
 
+// Components of all the upper level sets {image > t}, built once with union-find
+// Pixels are added from the highest value down, each one points to its parent in the tree
+class MaxTree
+{
+public:
+	MaxTree( Buffer2d & image );
+
+	double maxValue();
+	int nbPixelsGreaterThan( double threshold );
+	int largestRegionGreaterThan( double threshold );
+	int nbRegionsGreaterThan( double threshold );
+	std::vector< std::vector< Vec2i > > regionsGreaterThan( double threshold );
+
+private:
+	int w, h;
+	std::vector<double> values;		// Per pixel
+	std::vector<int> sorted;		// Pixels in decreasing order
+	std::vector<int> parent;
+	std::vector<int> largest;		// Largest component after adding sorted[i]
+	std::vector<int> nbComponents;	// Number of components after adding sorted[i]
+};
+
 // AABB
 std::vector<Point> cornersOfAABB(Vec3d bbmin, Vec3d bbmax);
 void computeAABB( std::vector<Point> &points, Vec3d &bbmin, Vec3d &bbmax);
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include <iomanip>
 
 #include <Eigen/Geometry>
+#include <omp.h>
 #include "GUI/Viewer/libQGLViewer/QGLViewer/qglviewer.h"
 using namespace qglviewer;
 
@@ -16,18 +17,56 @@ using namespace qglviewer;
 #define BIG_NUMBER 10
 #define DEPTH_EDGE_THRESHOLD 0.1
 
+// Adaptive direction search
+#define ADAPTIVE_STEP 4				// Coarse grid takes one of every \ADAPTIVE_STEP samples
+#define ADAPTIVE_CANDIDATES 3		// Coarse directions that are refined
+#define ADAPTIVE_COARSE_SCALE 0.25	// Envelope resolution of the coarse pass
+
+// Incremental stackability
+#define INCREMENTAL_BB_SCALE 1.2	// Room for edits before the cached cameras are refitted
+
+// Tiled envelopes
+#define TILED_BYTES_PER_PIXEL 16	// World z of the front and back pass
+
 
 Offset::Offset( HiddenViewer *viewer )
 {
 	activeViewer = viewer;
+	m_activeObject = NULL;
+
+	// Without a viewer the envelopes are rasterized on the CPU
+	rasterizer = new DepthRasterizer();
+	renderer = activeViewer ? HIDDEN_VIEWER : SOFTWARE_RASTERIZER;
 
 	searchDensity = 20;
 	searchType = NONE;
+	coneSize = 0.05;
+	isParallelSearch = true;
+	isIncremental = false;
+	isTiledEnvelope = false;
+	tiledMemoryBudget = 16;
+	searchEvaluations = searchSavedEvaluations = 0;
+}
+
+Offset::~Offset()
+{
+	delete rasterizer;
+
+	for (int i = 0; i < (int)rasterizerPool.size(); i++)
+		delete rasterizerPool[i];
 }
 
 QSegMesh* Offset::activeObject()
 {
-	return activeViewer->activeObject();
+	if (activeViewer)
+		return activeViewer->activeObject();
+	else
+		return m_activeObject;
+}
+
+void Offset::setActiveObject( QSegMesh * object )
+{
+	m_activeObject = object;
 }
 
 void Offset::clear()
@@ -39,6 +78,11 @@ void Offset::clear()
 	lowerDepth.clear();
 	upperDepth.clear();
 
+	lowerFaces.clear();
+	upperFaces.clear();
+	lowerBarycentric.clear();
+	upperBarycentric.clear();
+
 	hotRegions.clear();
 	hotPoints.clear();
 	upperHotSpots.clear();
@@ -53,93 +97,165 @@ void Offset::clear()
 // <-1, 1> + 2 = <1, 3> : The top and bottom setting for the entire shape
 // <-1, 1> + 3 = <2, 4> : The top and bottom setting for the zoomed in region
 
+// == Rendering
+void Offset::renderDepth( ObjectTranformation & transformation )
+{
+	CreateTimer(timer);
+
+	if (renderer == SOFTWARE_RASTERIZER)
+	{
+		rasterizer->render(activeObject(), transformation);
+	}
+	else
+	{
+		activeViewer->objectTransformation = transformation;
+		activeViewer->setMode(HV_DEPTH);
+		activeViewer->renderToBuffer();
+	}
+
+	addStageTime("render", timer);
+}
+
+int Offset::bufferWidth()
+{
+	return (renderer == SOFTWARE_RASTERIZER) ? rasterizer->width() : activeViewer->bufferWidth();
+}
+
+int Offset::bufferHeight()
+{
+	return (renderer == SOFTWARE_RASTERIZER) ? rasterizer->height() : activeViewer->bufferHeight();
+}
+
 // == Envelope
 void Offset::computeEnvelope(int side)
 {
 	// Switcher
-	std::vector< std::vector<double> > &envelope = (1 == side)? upperEnvelope : lowerEnvelope;
-	std::vector< std::vector<double> > &depth = (1 == side)? upperDepth : lowerDepth;
-	envelope.clear();
-	depth.clear();
+	Buffer2d &envelope = (1 == side)? upperEnvelope : lowerEnvelope;
+	Buffer2d &depth = (1 == side)? upperDepth : lowerDepth;
+
+	CreateTimer(timer);
 
 	// Read the buffer
-	GLfloat* depthBuffer = (GLfloat*)activeViewer->readBuffer(GL_DEPTH_COMPONENT, GL_FLOAT);
+	GLfloat* depthBuffer;
+	double zCamera, zNear, zFar;
+
+	if (renderer == SOFTWARE_RASTERIZER)
+	{
+		// The lower envelope may come from the same pass as the upper one
+		bool isBack = (side == -1 && rasterizer->hasBackDepth());
+		if (isBack)
+			depthBuffer = rasterizer->readBackDepthBuffer();
+		else
+			depthBuffer = rasterizer->readDepthBuffer();
+
+		// Face ids come with the depth
+		Buffer2i &faces = (1 == side)? upperFaces : lowerFaces;
+		Image2<Vec2f> &barycentric = (1 == side)? upperBarycentric : lowerBarycentric;
+		std::vector<int> &faceIds = isBack ? rasterizer->backFaceIds : rasterizer->faceIds;
+		std::vector<Vec2f> &weights = isBack ? rasterizer->backBarycentric : rasterizer->barycentric;
+
+		int w = rasterizer->width(), h = rasterizer->height();
+		faces.resize(w, h);
+		barycentric.resize(w, h);
+
+		for(int y = 0; y < h; y++)
+		{
+			std::copy(faceIds.begin() + y*w, faceIds.begin() + (y+1)*w, faces[y]);
+			std::copy(weights.begin() + y*w, weights.begin() + (y+1)*w, barycentric[y]);
+		}
+
+		zCamera = rasterizer->camera.distance * side;
+		zNear = rasterizer->camera.zNear;
+		zFar = rasterizer->camera.zFar;
+	}
+	else
+	{
+		depthBuffer = (GLfloat*)activeViewer->readBuffer(GL_DEPTH_COMPONENT, GL_FLOAT);
+		Vec c = activeViewer->camera()->position();
+		zCamera = Vec3d(c.x, c.y, c.z).norm() * side;
+		zNear = activeViewer->camera()->zNear();
+		zFar = activeViewer->camera()->zFar();
+	}
 
 	// Format the data
-	int w = activeViewer->width();
-	int h = activeViewer->height();
-	Vec c = activeViewer->camera()->position();
-	double zCamera = Vec3d(c.x, c.y, c.z).norm() * side;
-	double zNear = activeViewer->camera()->zNear();
-	double zFar = activeViewer->camera()->zFar();
-	envelope.resize(h);
-	depth.resize(h);
+	int w = bufferWidth();
+	int h = bufferHeight();
+	envelope.resize(w, h);
+	depth.resize(w, h);
+	double background = (side == 1) ? -BIG_NUMBER : BIG_NUMBER;
 
 	#pragma omp parallel for
 	for(int y = 0; y < h; y++)
 	{
-		envelope[y].resize(w);
-		depth[y].resize(w);
-
-		for(int x = 0;x < w; x++)
-		{
-			double zU = depthBuffer[(y*w) + x];
+		Eigen::ArrayXd zU = Eigen::Map<Eigen::ArrayXf>(depthBuffer + (y*w), w).cast<double>();
 
-			depth[y][x] = zU;
-
-			if (zU == 1.0)
-				envelope[y][x] = (side == 1) ? -BIG_NUMBER : BIG_NUMBER;
-			else
-				envelope[y][x] = zCamera - side * ( zU * zFar + (1-zU) * zNear );
-		}
+		depth.row(y) = zU;
+		envelope.row(y) = (zU == 1.0).select(background, zCamera - side * ( zU * zFar + (1-zU) * zNear ));
 	}
 
 	delete[] depthBuffer;
+
+	addStageTime("readback", timer);
 }
 
-void Offset::computeEnvelopeOfShape( int side, Vec3d up, Vec3d stacking_direction )
+ObjectTranformation Offset::envelopeTransformation( int side, Vec3d up, Vec3d direction, Vec3d bbmin, Vec3d bbmax )
 {
 	// Set virtual transformation of camera
-	Quaternion q1(side * Vec(0,0,1),Vec(stacking_direction));
+	Quaternion q1(side * Vec(0,0,1),Vec(direction));
 	Vec rotated_y = q1 * Vec(0,1,0);
 	Quaternion q2(rotated_y,Vec(up));
-	
-	activeViewer->objectTransformation.t = - Vec(activeObject()->center + stacking_direction);	
-	activeViewer->objectTransformation.rot = (q2 * q1).inverse();
-	activeViewer->objectTransformation.bbmin = activeObject()->bbmin;
-	activeViewer->objectTransformation.bbmax = activeObject()->bbmax;
+
+	Point center = (bbmin + bbmax) / 2;
+	ObjectTranformation transformation;
+	transformation.t = -Vec(center + direction);	
+	transformation.rot = (q2 * q1).inverse();
+	transformation.bbmin = bbmin;
+	transformation.bbmax = bbmax;
+
+	return transformation;
+}
+
+void Offset::computeEnvelopeOfShape( int side, Vec3d up, Vec3d stacking_direction )
+{
+	ObjectTranformation transformation = envelopeTransformation(side, up, stacking_direction, activeObject()->bbmin, activeObject()->bbmax);
 
 	// Save this new camera settings
-	objectTransformation[side+2] = activeViewer->objectTransformation;
+	objectTransformation[side+2] = transformation;
 
 	// Render
-	activeViewer->setMode(HV_DEPTH);
-	activeViewer->updateGL(); 
+	renderDepth(transformation);
 
 	// compute the envelope
 	computeEnvelope(side);
 
 }
 
-void Offset::computeEnvelopeOfRegion( int side , Vec3d up, Vec3d direction, Vec3d bbmin, Vec3d bbmax )
+void Offset::computeEnvelopesOfShape( Vec3d up, Vec3d stacking_direction )
 {
-	// Set virtual transformation of camera
-	Quaternion q1(side * Vec(0,0,1),Vec(direction));
-	Vec rotated_y = q1 * Vec(0,1,0);
-	Quaternion q2(rotated_y,Vec(up));
+	Vec3d bbmin = activeObject()->bbmin, bbmax = activeObject()->bbmax;
 
-	Point center = (bbmin + bbmax) / 2;
-	activeViewer->objectTransformation.t = -Vec(center + direction);	
-	activeViewer->objectTransformation.rot = (q2 * q1).inverse();
-	activeViewer->objectTransformation.bbmin = bbmin;
-	activeViewer->objectTransformation.bbmax = bbmax;
+	// Both cameras are saved, the lower one is only used for (un)projection
+	objectTransformation[3] = envelopeTransformation( 1, up, stacking_direction, bbmin, bbmax);
+	objectTransformation[1] = envelopeTransformation(-1, up, stacking_direction, bbmin, bbmax);
+
+	// Render once from the top, the lower envelope is the farthest depth
+	CreateTimer(timer);
+	rasterizer->renderDual(activeObject(), objectTransformation[3]);
+	addStageTime("render", timer);
+
+	computeEnvelope( 1);
+	computeEnvelope(-1);
+}
+
+void Offset::computeEnvelopeOfRegion( int side , Vec3d up, Vec3d direction, Vec3d bbmin, Vec3d bbmax )
+{
+	ObjectTranformation transformation = envelopeTransformation(side, up, direction, bbmin, bbmax);
 
 	// Save this new camera settings
-	objectTransformation[side+3] = activeViewer->objectTransformation;
+	objectTransformation[side+3] = transformation;
 
 	// Render
-	activeViewer->setMode(HV_DEPTH);
-	activeViewer->updateGL(); 
+	renderDepth(transformation);
 
 	// Compute
 	computeEnvelope(side);
@@ -149,22 +265,12 @@ void Offset::computeEnvelopeOfRegion( int side , Vec3d up, Vec3d direction, Vec3
 // == Offset
 void Offset::computeOffset()
 {
-	offset = upperEnvelope; 
+	CreateTimer(timer);
 
-	int h = upperEnvelope.size();
-	int w = upperEnvelope[0].size();
+	// Two envelopes are horizontally flipped
+	offsetOfEnvelopes(upperEnvelope, lowerEnvelope, BIG_NUMBER, offset);
 
-	#pragma omp parallel for
-	for (int y = 0; y < h; y++){
-		for (int x = 0; x < w; x++)
-		{
-			// Two envelopes are horizontally flipped
-			if (upperEnvelope[y][x]== -BIG_NUMBER | lowerEnvelope[y][(w-1)-x] == BIG_NUMBER)
-				offset[y][x] = 0.0; 
-			else
-				offset[y][x] = upperEnvelope[y][x] - lowerEnvelope[y][(w-1)-x];
-		}
-	}
+	addStageTime("offset", timer);
 }
 
 Vec3d Offset::computeCameraUpVector( Vec3d newZ )
@@ -195,8 +301,15 @@ void Offset::computeOffsetOfShape( Vec3d direction )
 //	std::cout <<"direction = " << direction << "up = " << up << '\n';
 
 	// Compute envelopes
-	computeEnvelopeOfShape( 1, up, direction);
-	computeEnvelopeOfShape(-1, up, direction);
+	if (renderer == SOFTWARE_RASTERIZER)
+	{
+		computeEnvelopesOfShape(up, direction);
+	}
+	else
+	{
+		computeEnvelopeOfShape( 1, up, direction);
+		computeEnvelopeOfShape(-1, up, direction);
+	}
 
 	// Offset
 	computeOffset();
@@ -220,24 +333,54 @@ double Offset::computeStackability()
 	double V0 = volumeOfBB(diag);
 
 	// Searching for the best stacking direction
+	QVector<Vec3d> directions = getDirectionsInCone(coneSize);
+	searchEvaluations = directions.size();
+	searchSavedEvaluations = 0;
+
+	CreateTimer(timer);
+
+	if (renderer == SOFTWARE_RASTERIZER && isIncremental)
+	{
+		computeMaxOffsetsIncremental(directions);
+	}
+	else if (renderer == SOFTWARE_RASTERIZER && searchType == ADAPTIVE_HEMESPHERE)
+	{
+		computeAdaptiveMaxOffsets(V0);
+	}
+	else if (renderer == SOFTWARE_RASTERIZER && isParallelSearch)
+	{
+		computeMaxOffsets(directions);
+	}
+	else
+	{
+		searchDirections = directions;
+		searchMaxOffset.resize(directions.size());
+
+		for (int i = 0; i < directions.size(); i++)
+		{
+			computeOffsetOfShape(directions[i]);
+			searchMaxOffset[i] = getMaxValue(offset);
+		}
+	}
+
+	addStageTime("search", timer);
+
+	// Compute stackability
 	double maxStackability = -1;
 	Vec3d bestStackingDirection(0, 0, 1);
-	QVector<Vec3d> directions = getDirectionsInCone(coneSize);
+	searchStackability.resize(searchDirections.size());
 
-	foreach(Vec3d vec, directions)
+	for (int i = 0; i < searchDirections.size(); i++)
 	{
-		computeOffsetOfShape(vec);
+		double om = searchMaxOffset[i];
+		double stackability = stackabilityOf(searchDirections[i], om, V0);
 
-		// Compute stackability
-		double om = getMaxValue(offset);
-		Vec3d extent = computeShapeExtents(vec);
-		double V1 = volumeOfBB(extent);
-		double stackability = 1.0 - (om / extent[2]) * (V1 / V0);
+		searchStackability[i] = stackability;
 
 		if (stackability > maxStackability)
 		{
 			maxStackability = stackability;
-			bestStackingDirection = vec;
+			bestStackingDirection = searchDirections[i];
 			O_max = om;
 		}
 	}
@@ -324,9 +467,336 @@ void Offset::computeOffsetOfRegion( Vec3d direction, std::vector< Vec2i >& regio
 	computeOffset();
 
 	// Save offset as image
-	saveAsImage(upperEnvelope, "upper.png");
-	saveAsImage(lowerEnvelope, "lower.png");
-	saveAsImage(offset, QString::number(direction.z()) + "_offset function of region.png");
+	//saveAsImage(upperEnvelope, "upper.png");
+	//saveAsImage(lowerEnvelope, "lower.png");
+	//saveAsImage(offset, QString::number(direction.z()) + "_offset function of region.png");
+}
+
+// == Batched search
+double Offset::computeMaxOffset( Vec3d direction, DepthRasterizer * r )
+{
+	Vec3d up = computeCameraUpVector(direction);
+	ObjectTranformation transformation = envelopeTransformation(1, up, direction, activeObject()->bbmin, activeObject()->bbmax);
+
+	int w = r->width();
+	int h = r->height();
+
+	// The whole screen at once, or bands of rows that fit in the memory budget
+	int bandRows = h;
+	if (isTiledEnvelope)
+	{
+		int rows = int((tiledMemoryBudget * 1048576.0) / (w * TILED_BYTES_PER_PIXEL));
+		bandRows = Min(h, Max(r->TILE_SIZE, rows - rows % r->TILE_SIZE));
+	}
+
+	r->prepare(activeObject(), transformation);
+
+	// Same as computeEnvelope() and computeOffset(), without keeping the buffers
+	double zCamera = r->camera.distance;
+	double zNear = r->camera.zNear;
+	double zFar = r->camera.zFar;
+
+	double om = -DBL_MAX;
+	RasterTarget front, back;
+
+	for (int y0 = 0; y0 < h; y0 += bandRows)
+	{
+		int size = w * (Min(h, y0 + bandRows) - y0);
+		front.reset(size, RASTER_BACKGROUND, false, y0);
+		back.reset(size, -RASTER_BACKGROUND, false, y0);
+
+		r->rasterizeRows(y0, y0 + size / w, front, &back);
+
+		// Both passes share the pixel, no flipping
+		for (int i = 0; i < size; i++)
+		{
+			double zU = r->depthOf(front.z[i]);
+			double zL = r->backDepthOf(back.z[i]);
+
+			double upper = zCamera - ( zU * zFar + (1-zU) * zNear );
+			double lower = -zCamera + ( zL * zFar + (1-zL) * zNear );
+			double o = (zU == 1.0 || zL == 1.0) ? 0.0 : upper - lower;
+
+			om = Max(om, o);
+		}
+	}
+
+	return om;
+}
+
+void Offset::computeMaxOffsets( QVector<Vec3d> & directions, double scale )
+{
+	searchDirections = directions;
+	searchMaxOffset.resize(directions.size());
+
+	prepareRasterizerPool(Max(1, int(rasterizer->width() * scale)), Max(1, int(rasterizer->height() * scale)));
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < directions.size(); i++)
+		searchMaxOffset[i] = computeMaxOffset(directions[i], rasterizerPool[omp_get_thread_num()]);
+}
+
+void Offset::prepareRasterizerPool( int w, int h )
+{
+	// One render target per thread
+	int nbThreads = omp_get_max_threads();
+	while ((int)rasterizerPool.size() < nbThreads)
+		rasterizerPool.push_back(new DepthRasterizer());
+
+	for (int i = 0; i < nbThreads; i++)
+		rasterizerPool[i]->setResolution(w, h);
+
+	// Triangle lists are shared by all threads
+	foreach(QSurfaceMesh * seg, activeObject()->getSegments())
+		if(!seg->triangles.size()) seg->fillTrianglesList();
+}
+
+double Offset::stackabilityOf( Vec3d direction, double om, double V0 )
+{
+	Vec3d extent = computeShapeExtents(direction);
+	double V1 = volumeOfBB(extent);
+
+	return 1.0 - (om / extent[2]) * (V1 / V0);
+}
+
+// == Adaptive search
+// Directions are indexed on the uniform grid of getDirectionsInCone():
+// (j, t) is the \j-th azimuth and \t-th elevation, t = thetas.size() is the Z direction
+Vec3d Offset::directionOnGrid( Vec2i g, QVector<double> & thetas )
+{
+	Vec3d Z(0.0, 0.0, 1.0);
+	if (g[1] == thetas.size()) return Z;
+
+	double phi = g[0] * M_PI / searchDensity;
+	double theta = thetas[g[1]];
+	Vec3d XY(cos(phi), sin(phi), 0.0);
+
+	return XY * cos(theta) + Z * sin(theta);
+}
+
+// Fine samples around \g that the coarse pass has not scored
+void Offset::fineNeighbours( Vec2i g, int nbPhi, int nbTheta, std::set< std::pair<int, int> > & coarse, std::set< std::pair<int, int> > & result )
+{
+	std::set< std::pair<int, int> > samples;
+
+	// All azimuths meet at Z, only the nearest ring is refined
+	if (g[1] == nbTheta)
+	{
+		for (int j = 0; j < nbPhi; j++)
+			samples.insert(std::make_pair(j, nbTheta - 1));
+	}
+	else
+	{
+		for (int t = Max(0, g[1] - ADAPTIVE_STEP + 1); t < Min(nbTheta, g[1] + ADAPTIVE_STEP); t++)
+			for (int dj = 1 - ADAPTIVE_STEP; dj < ADAPTIVE_STEP; dj++)
+				samples.insert(std::make_pair(((g[0] + dj) % nbPhi + nbPhi) % nbPhi, t));
+
+		if (g[1] + ADAPTIVE_STEP > nbTheta)
+			samples.insert(std::make_pair(0, nbTheta));
+	}
+
+	for (std::set< std::pair<int, int> >::iterator it = samples.begin(); it != samples.end(); it++)
+		if (!coarse.count(*it)) result.insert(*it);
+}
+
+void Offset::computeAdaptiveMaxOffsets( double V0 )
+{
+	QVector<double> thetas = getElevationsInCone(coneSize);
+	int nbPhi = 2 * searchDensity;
+	int nbTheta = thetas.size();
+	int nbUniform = nbPhi * nbTheta + 1;
+
+	// Coarse grid, anchored at the top of the cone
+	QVector<Vec2i> coarse;
+	std::set< std::pair<int, int> > coarseSet;
+	coarse.push_back(Vec2i(0, nbTheta));
+	for (int t = nbTheta - 1; t >= 0; t -= ADAPTIVE_STEP)
+		for (int j = 0; j < nbPhi; j += ADAPTIVE_STEP)
+			coarse.push_back(Vec2i(j, t));
+	foreach(Vec2i g, coarse) coarseSet.insert(std::make_pair(g[0], g[1]));
+
+	// Small grids are cheaper to sample uniformly, decided on the largest possible refinement
+	std::vector<int> sizes;
+	foreach(Vec2i g, coarse)
+	{
+		std::set< std::pair<int, int> > n;
+		fineNeighbours(g, nbPhi, nbTheta, coarseSet, n);
+		sizes.push_back(n.size());
+	}
+	std::sort(sizes.rbegin(), sizes.rend());
+
+	int worstCase = coarse.size();
+	for (int c = 0; c < Min(ADAPTIVE_CANDIDATES, (int)sizes.size()); c++)
+		worstCase += sizes[c];
+
+	if (worstCase >= nbUniform)
+	{
+		QVector<Vec3d> directions = getDirectionsInCone(coneSize);
+		searchEvaluations = directions.size();
+		searchSavedEvaluations = 0;
+		computeMaxOffsets(directions);
+		return;
+	}
+
+	QVector<Vec3d> coarseDirections;
+	foreach(Vec2i g, coarse) coarseDirections.push_back(directionOnGrid(g, thetas));
+
+	// Score them at low resolution
+	computeMaxOffsets(coarseDirections, ADAPTIVE_COARSE_SCALE);
+	QVector<double> coarseMaxOffset = searchMaxOffset;
+
+	std::vector< std::pair<double, int> > ranked;
+	for (int i = 0; i < coarse.size(); i++)
+		ranked.push_back(std::make_pair(stackabilityOf(coarseDirections[i], coarseMaxOffset[i], V0), i));
+	std::sort(ranked.rbegin(), ranked.rend());
+
+	// Refine with the fine samples around the best ones
+	std::set< std::pair<int, int> > refined;
+	for (int c = 0; c < Min(ADAPTIVE_CANDIDATES, (int)ranked.size()); c++)
+		fineNeighbours(coarse[ranked[c].second], nbPhi, nbTheta, coarseSet, refined);
+
+	QVector<Vec3d> directions;
+	for (std::set< std::pair<int, int> >::iterator it = refined.begin(); it != refined.end(); it++)
+		directions.push_back(directionOnGrid(Vec2i(it->first, it->second), thetas));
+
+	searchEvaluations = coarse.size() + directions.size();
+	searchSavedEvaluations = Max(0, nbUniform - searchEvaluations);
+
+	// Final scores at full resolution, the coarse samples are kept as they are
+	computeMaxOffsets(directions);
+	for (int i = 0; i < coarse.size(); i++)
+	{
+		searchDirections.push_back(coarseDirections[i]);
+		searchMaxOffset.push_back(coarseMaxOffset[i]);
+	}
+}
+
+// == Incremental search
+// Hash of the vertex positions, tells which segments have been edited
+uint segmentSignature( QSurfaceMesh * seg )
+{
+	Surface_mesh::Vertex_property<Point> points = seg->vertex_property<Point>("v:point");
+	const unsigned char * bytes = (const unsigned char *) points.data();
+	uint n = seg->n_vertices() * sizeof(Point);
+
+	// FNV-1a
+	uint hash = 2166136261u;
+	for (uint i = 0; i < n; i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+
+	return hash;
+}
+
+void Offset::computeMaxOffsetsIncremental( QVector<Vec3d> & directions )
+{
+	QSegMesh * mesh = activeObject();
+	int w = rasterizer->width();
+	int h = rasterizer->height();
+
+	// The cameras are frozen as long as the shape stays in the cached box
+	bool isValid = (searchDirections == directions) && (envelopeCache.size() == directions.size())
+		&& !envelopeCache.isEmpty() && envelopeCache.front().camera.width == w && envelopeCache.front().camera.height == h;
+
+	for (int i = 0; i < 3; i++)
+		isValid = isValid && mesh->bbmin[i] >= cacheBBmin[i] && mesh->bbmax[i] <= cacheBBmax[i];
+
+	if (!isValid)
+	{
+		Point center = (mesh->bbmin + mesh->bbmax) / 2;
+		Vec3d halfDiag = (mesh->bbmax - mesh->bbmin) * 0.5 * INCREMENTAL_BB_SCALE;
+		cacheBBmin = center - halfDiag;
+		cacheBBmax = center + halfDiag;
+
+		envelopeCache.clear();
+		envelopeCache.resize(directions.size());
+		segmentSignatures.clear();
+
+		for (int i = 0; i < directions.size(); i++)
+		{
+			Vec3d up = computeCameraUpVector(directions[i]);
+			ObjectTranformation transformation = envelopeTransformation(1, up, directions[i], cacheBBmin, cacheBBmax);
+			envelopeCache[i].camera.setup(transformation, w, h);
+		}
+	}
+
+	// Only the edited segments are rendered again
+	QVector<QSurfaceMesh*> dirtySegments;
+	QMap<QString, uint> signatures;
+
+	foreach(QSurfaceMesh * seg, mesh->getSegments())
+	{
+		QString id = seg->objectName();
+		signatures[id] = segmentSignature(seg);
+
+		if (!segmentSignatures.contains(id) || segmentSignatures[id] != signatures[id])
+			dirtySegments.push_back(seg);
+	}
+
+	// Removed segments
+	foreach(QString id, segmentSignatures.keys())
+	{
+		if (signatures.contains(id)) continue;
+		for (int i = 0; i < envelopeCache.size(); i++)
+			envelopeCache[i].segments.remove(id);
+	}
+
+	segmentSignatures = signatures;
+
+	searchDirections = directions;
+	searchMaxOffset.resize(directions.size());
+
+	prepareRasterizerPool(w, h);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < directions.size(); i++)
+	{
+		DepthRasterizer * r = rasterizerPool[omp_get_thread_num()];
+		DirectionEnvelopes & cache = envelopeCache[i];
+
+		for (int j = 0; j < dirtySegments.size(); j++)
+			r->renderSegment(dirtySegments[j], cache.camera, cache.segments[dirtySegments[j]->objectName()]);
+
+		searchMaxOffset[i] = mergeSegmentEnvelopes(cache);
+	}
+}
+
+double Offset::mergeSegmentEnvelopes( DirectionEnvelopes & cache )
+{
+	int w = cache.camera.width;
+	int h = cache.camera.height;
+
+	// Upper envelope is the nearest z, lower envelope the farthest, both in the frame of the upper camera
+	std::vector<float> upper(w * h, -FLT_MAX), lower(w * h, FLT_MAX);
+
+	foreach(const SegmentDepth & sd, cache.segments)
+	{
+		for (int y = 0; y < sd.height; y++)
+		{
+			float * U = &upper[(sd.y0 + y) * w + sd.x0];
+			float * L = &lower[(sd.y0 + y) * w + sd.x0];
+			const float * nearZ = &sd.nearZ[y * sd.width];
+			const float * farZ = &sd.farZ[y * sd.width];
+
+			for (int x = 0; x < sd.width; x++)
+			{
+				U[x] = Max(U[x], nearZ[x]);
+				L[x] = Min(L[x], farZ[x]);
+			}
+		}
+	}
+
+	// Background has zero offset
+	double om = 0;
+	for (int i = 0; i < w * h; i++)
+		if (upper[i] != -FLT_MAX) om = Max(om, double(upper[i] - lower[i]));
+
+	return om;
+}
+
+void Offset::invalidateIncremental()
+{
+	envelopeCache.clear();
+	segmentSignatures.clear();
 }
 
 double Offset::getStackability( bool recompute /*= false*/ )
@@ -338,24 +808,9 @@ double Offset::getStackability( bool recompute /*= false*/ )
 // == Hot spots
 HotSpot Offset::detectHotspotInRegion(int side, std::vector<Vec2i> &hotRegion)
 {
-	// Restore the camera according to the direction
-	activeViewer->objectTransformation = objectTransformation[side + 3];
-
-	// Draw Faces Unique
-	activeViewer->setMode(HV_FACEUNIQUE);
-	activeViewer->updateGL(); 
-	activeViewer->setMode(HV_FACEUNIQUE);
-	activeViewer->updateGL(); 
-
-	GLubyte* colormap = (GLubyte*)activeViewer->readBuffer(GL_RGBA, GL_UNSIGNED_BYTE);
-
-	// The size of current viewer
-	int w = activeViewer->width();
-	int h = activeViewer->height();	
-
 	// Switch between directions
 	bool isUpper = (side == 1);
-	std::vector< std::vector<double> > &depth = isUpper? upperDepth : lowerDepth;
+	Buffer2d &depth = isUpper? upperDepth : lowerDepth;
 
 	// Detect hot spots
 	uint sid, fid, fid_local;
@@ -365,47 +820,105 @@ HotSpot Offset::detectHotspotInRegion(int side, std::vector<Vec2i> &hotRegion)
 	QMap< QString, QVector< Vec2i > > subHotPixels;
 	QMap< QString, QVector< Vec3d > > subHotSamples;
 
-//	QImage debugImg(w, h, QImage::Format_ARGB32);
-	
-	for (int j=0;j<hotRegion.size();j++)
+	if (renderer == SOFTWARE_RASTERIZER)
 	{
-		// 2D coordinates in OpenGL format
-		Vec2i &hotPixel = hotRegion[j];
-		x = (side == 1) ? hotPixel.x() : (w-1) - hotPixel.x();
-		y = hotPixel.y();
-
-		// 3d position of this hot sample
-		// Flip \y to work in Qt format
-		double depthVal = depth[y][x];
-		Vec hotP= activeViewer->camera()->unprojectedCoordinatesOf(Vec(x, (h-1)-y, depthVal));
+		// Face ids and barycentric weights have been kept with the envelope
+		Buffer2i &faces = isUpper? upperFaces : lowerFaces;
+		Image2<Vec2f> &barycentric = isUpper? upperBarycentric : lowerBarycentric;
 
-		// Get the face index and segment index back
-		uint indx = ((y*w)+x)*4;
-		uint r = (uint)colormap[indx+0];
-		uint g = (uint)colormap[indx+1];
-		uint b = (uint)colormap[indx+2];
-		uint a = (uint)colormap[indx+3];
+		RasterCamera camera;
+		camera.setup(objectTransformation[side + 3], bufferWidth(), bufferHeight());
+		int w = bufferWidth();
 
-		fid = ((255-a)<<24) + (r<<16) + (g<<8) + b - 1;
+		for (int j=0;j<hotRegion.size();j++)
+		{
+			Vec2i &hotPixel = hotRegion[j];
+			x = (side == 1) ? hotPixel.x() : (w-1) - hotPixel.x();
+			y = hotPixel.y();
+
+			if (faces[y][x] < 0) continue;
+			fid = faces[y][x];
+
+			activeObject()->global2local_fid(fid, sid, fid_local);
+			QSurfaceMesh * seg = activeObject()->getSegment(sid);
+
+			// Exact hit on the triangle, in the same space as the unprojected GL samples
+			Vec2f b = barycentric[y][x];
+			Point p0 = seg->getVertexPos(seg->triangles[3*fid_local + 0]);
+			Point p1 = seg->getVertexPos(seg->triangles[3*fid_local + 1]);
+			Point p2 = seg->getVertexPos(seg->triangles[3*fid_local + 2]);
+			Vec3d hotPoint = camera.objectToWorld(p0 * (1.0 - b[0] - b[1]) + p1 * b[0] + p2 * b[1]);
+
+			QString segmentID = seg->objectName();
+			subHotRegionSize[segmentID]++;
+			subHotPixels[segmentID].push_back(hotPixel);
+			subHotSamples[segmentID].push_back(hotPoint);
+
+			if (!isUpper)
+				hotPoints[segmentID].push_back(hotPoint);
+		}
+	}
+	else
+	{
+		// Restore the camera according to the direction
+		activeViewer->objectTransformation = objectTransformation[side + 3];
 
-		if (fid >= activeObject()->nbFaces()) 
-			continue;
+		// Draw Faces Unique
+		activeViewer->setMode(HV_FACEUNIQUE);
+		activeViewer->renderToBuffer();
+		activeViewer->setMode(HV_FACEUNIQUE);
+		activeViewer->renderToBuffer();
 
-		activeObject()->global2local_fid(fid, sid, fid_local);
+		GLubyte* colormap = (GLubyte*)activeViewer->readBuffer(GL_RGBA, GL_UNSIGNED_BYTE);
 
-		// Store information for subHotRegion
-		QString segmentID = activeObject()->getSegment(sid)->objectName();
-		Vec3d hotPoint(hotP.x, hotP.y, hotP.z);
-		subHotRegionSize[segmentID]++;
-		subHotPixels[segmentID].push_back(hotPixel);
-		subHotSamples[segmentID].push_back(hotPoint);
+		// The size of current viewer
+		int w = activeViewer->bufferWidth();
+		int h = activeViewer->bufferHeight();
 
-		// All hot points in 3D
-		if (!isUpper)
-			hotPoints[segmentID].push_back(hotPoint);
+//		QImage debugImg(w, h, QImage::Format_ARGB32);
+	
+		for (int j=0;j<hotRegion.size();j++)
+		{
+			// 2D coordinates in OpenGL format
+			Vec2i &hotPixel = hotRegion[j];
+			x = (side == 1) ? hotPixel.x() : (w-1) - hotPixel.x();
+			y = hotPixel.y();
+
+			// 3d position of this hot sample
+			// Flip \y to work in Qt format
+			double depthVal = depth[y][x];
+			Vec hotP= activeViewer->camera()->unprojectedCoordinatesOf(Vec(x, (h-1)-y, depthVal));
+
+			// Get the face index and segment index back
+			uint indx = ((y*w)+x)*4;
+			uint r = (uint)colormap[indx+0];
+			uint g = (uint)colormap[indx+1];
+			uint b = (uint)colormap[indx+2];
+			uint a = (uint)colormap[indx+3];
+
+			fid = ((255-a)<<24) + (r<<16) + (g<<8) + b - 1;
+
+			if (fid >= activeObject()->nbFaces()) 
+				continue;
+
+			activeObject()->global2local_fid(fid, sid, fid_local);
+
+			// Store information for subHotRegion
+			QString segmentID = activeObject()->getSegment(sid)->objectName();
+			Vec3d hotPoint(hotP.x, hotP.y, hotP.z);
+			subHotRegionSize[segmentID]++;
+			subHotPixels[segmentID].push_back(hotPixel);
+			subHotSamples[segmentID].push_back(hotPoint);
+
+			// All hot points in 3D
+			if (!isUpper)
+				hotPoints[segmentID].push_back(hotPoint);
+
+			// debuging
+//			debugImg.setPixel(x, y, QColor(r, g, b).rgb());
+		}
 
-		// debuging
-//		debugImg.setPixel(x, y, QColor(r, g, b).rgb());
+		delete[] colormap;
 	}
 
 //	debugImg.save("face unique.png");
@@ -453,16 +966,18 @@ void Offset::detectHotspots( )
 {
 	// Initialization
 	clear();
-	int h = activeViewer->height();
-	int w = activeViewer->width();
+	int h = bufferHeight();
+	int w = bufferWidth();
 
 	// The best staking direction have been computed
 	Vec3d stackV = activeObject()->vec["stacking_shift"].normalized();
 	computeOffsetOfShape(stackV);
 
 	// Detect hot regions
+	CreateTimer(timer);
 	hotRegions = getMaximumRegions(offset);
-	visualizeRegions(w, h, hotRegions, "hot regions of shape.png");
+	addStageTime("regions", timer);
+	//visualizeRegions(w, h, hotRegions, "hot regions of shape.png");
 
 	// The max offset of hot regions
 	maxOffsetInHotRegions.clear();
@@ -482,7 +997,9 @@ void Offset::detectHotspots( )
 		//saveAsImage(offset, "Offset of region before getting hot regions.png");
 
 		// Detect zoomed (in) hot region 
+		timer.start();
 		Buffer2v2i zoomedHRs = getMaximumRegions(offset);
+		addStageTime("regions", timer);
 
 		// If there are multiple regions, pick up the one closest to the center
 		//visualizeRegions(w, h, zoomedHRs, QString::number(i) + "_zoomed in hot regions.png");
@@ -504,10 +1021,12 @@ void Offset::detectHotspots( )
 		std::vector<Vec2i> &zoomedHR = zoomedHRs[closestID];
 
 		// Detect hot spots from both directions
+		timer.start();
 		HotSpot UHS = detectHotspotInRegion(1, zoomedHR);
-		if (0 == UHS.side) continue;
-		HotSpot LHS = detectHotspotInRegion(-1, zoomedHR);
-		if (0 == LHS.side) continue;
+		HotSpot LHS = (0 == UHS.side) ? UHS : detectHotspotInRegion(-1, zoomedHR);
+		addStageTime("hotspot", timer);
+
+		if (0 == UHS.side || 0 == LHS.side) continue;
 
 		UHS.hotRegionID = i;
 		LHS.hotRegionID = i;
@@ -610,16 +1129,23 @@ void Offset::saveHotSpots( QString filename, int direction, double percent)
 // ==(un)Projection
 Vec3d Offset::unprojectedCoordinatesOf( uint x, uint y, int side )
 {
-	// Restore the camera according to the direction
-	activeViewer->objectTransformation = objectTransformation[side + 2];
-	activeViewer->updateGL();
+	int w = bufferWidth();
+	int h = bufferHeight();
 
-	int w = activeViewer->height();
-	int h = activeViewer->width();
-
-	std::vector< std::vector<double> > &depth = (side == 1)? upperDepth : lowerDepth;
+	Buffer2d &depth = (side == 1)? upperDepth : lowerDepth;
 	if (side == -1)	x = (w-1) - x;
 
+	if (renderer == SOFTWARE_RASTERIZER)
+	{
+		RasterCamera camera;
+		camera.setup(objectTransformation[side + 2], bufferWidth(), bufferHeight());
+		return camera.unprojectedCoordinatesOf(Vec3d(x, (h-1)-y, depth[y][x]));
+	}
+
+	// Restore the camera according to the direction
+	activeViewer->objectTransformation = objectTransformation[side + 2];
+	activeViewer->renderToBuffer();
+
 	Vec P = activeViewer->camera()->unprojectedCoordinatesOf(Vec(x, (h-1)-y, depth[y][x]));
 
 	return Vec3d(P[0], P[1], P[2]);
@@ -627,17 +1153,30 @@ Vec3d Offset::unprojectedCoordinatesOf( uint x, uint y, int side )
 
 Vec2i Offset::projectedCoordinatesOf( Vec3d point, int pathID )
 {
-	// Restore the camera according to the direction
-	activeViewer->objectTransformation = objectTransformation[pathID];
-
-	// Make sure to call /updateGL() to update the projectionMatrix!!!
-	activeViewer->updateGL();
+	int h = bufferHeight();
 
 	// \p is expressed in the Qt coordinates, (0, 0) being at the top left conner
-	Vec p = activeViewer->camera()->projectedCoordinatesOf( Vec (point[0], point[1], point[2]) );
+	Vec3d p;
+
+	if (renderer == SOFTWARE_RASTERIZER)
+	{
+		RasterCamera camera;
+		camera.setup(objectTransformation[pathID], bufferWidth(), bufferHeight());
+		p = camera.projectedCoordinatesOf(point);
+	}
+	else
+	{
+		// Restore the camera according to the direction
+		activeViewer->objectTransformation = objectTransformation[pathID];
+
+		// Make sure to call /updateGL() to update the projectionMatrix!!!
+		activeViewer->renderToBuffer();
+
+		Vec P = activeViewer->camera()->projectedCoordinatesOf( Vec (point[0], point[1], point[2]) );
+		p = Vec3d(P[0], P[1], P[2]);
+	}
 
 	// Convert to OpenGL coordinates
-	int h = activeViewer->height();
 	return Vec2i(p[0], (h-1)-p[1]);
 }
 
@@ -683,6 +1222,7 @@ QVector<Vec3d> Offset::getDirectionsOnXYPlane()
 		directions.push_back(-y);
 		break;
 	case SAMPLE_UPPER_HEMESPHERE:
+	case ADAPTIVE_HEMESPHERE:
 		{
 			double delta = M_PI / searchDensity;
 			double angle = 0.0;
@@ -698,12 +1238,8 @@ QVector<Vec3d> Offset::getDirectionsOnXYPlane()
 	return directions;
 }
 
-QVector<Vec3d> Offset::getDirectionsInCone( double cone_size )
+QVector<double> Offset::getElevationsInCone( double cone_size )
 {
-	// xy components
-	QVector<Vec3d> directions_xy = getDirectionsOnXYPlane();
-
-	// z components
 	QVector<double> thetas;
 	double delta = M_PI / searchDensity;
 	double angle = 0.0;
@@ -716,6 +1252,17 @@ QVector<Vec3d> Offset::getDirectionsInCone( double cone_size )
 		angle += delta;
 	}
 
+	return thetas;
+}
+
+QVector<Vec3d> Offset::getDirectionsInCone( double cone_size )
+{
+	// xy components
+	QVector<Vec3d> directions_xy = getDirectionsOnXYPlane();
+
+	// z components
+	QVector<double> thetas = getElevationsInCone(cone_size);
+
 	// Z direction
 	QVector<Vec3d> directions;
 	Vec3d Z(0.0, 0.0, 1.0);
@@ -764,5 +1311,57 @@ void Offset::setConeSize( double size )
 	coneSize = size;
 }
 
+void Offset::setSoftwareRenderer( bool isSoftware )
+{
+	renderer = (isSoftware || !activeViewer) ? SOFTWARE_RASTERIZER : HIDDEN_VIEWER;
+}
+
+void Offset::setIncremental( bool isIncremental )
+{
+	this->isIncremental = isIncremental;
+
+	if (!isIncremental) invalidateIncremental();
+}
+
+void Offset::setParallelSearch( bool isParallel )
+{
+	isParallelSearch = isParallel;
+}
+
+void Offset::setEnvelopeResolution( int newRes )
+{
+	setEnvelopeResolution(newRes, newRes);
+}
+
+void Offset::setEnvelopeResolution( int w, int h )
+{
+	rasterizer->setResolution(w, h);
+
+	// The viewer renders offscreen, its widget keeps its size
+	if (activeViewer) activeViewer->setBufferSize(w, h);
+
+	invalidateIncremental();
+}
+
+void Offset::setTiledEnvelope( bool isTiled )
+{
+	isTiledEnvelope = isTiled;
+}
+
+void Offset::setTiledMemoryBudget( int mb )
+{
+	tiledMemoryBudget = Max(1, mb);
+}
+
+void Offset::resetStageTimes()
+{
+	stageTimes.clear();
+}
+
+void Offset::addStageTime( QString stage, QElapsedTimer & timer )
+{
+	stageTimes[stage] += timer.nsecsElapsed() * 1e-6;
+}
+
 
 
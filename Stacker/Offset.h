@@ -2,6 +2,7 @@
 
 #include <QQueue>
 #include <QObject>
+#include <set>
 
 
 #include "GraphicsLibrary/Mesh/QSegMesh.h"
@@ -9,6 +10,7 @@
 #include "HotSpot.h"
 #include "Numeric.h"
 #include "HiddenViewer.h"
+#include "DepthRasterizer.h"
 
 #define ZERO_TOLERANCE 0.001
 
@@ -16,26 +18,55 @@ class HiddenViewer;
 
 enum SEARCH_TYPE
 {
-	NONE, ROT_AROUND_X, ROT_AROUND_Y, ROT_AROUND_X_AND_Y, SAMPLE_UPPER_HEMESPHERE
+	NONE, ROT_AROUND_X, ROT_AROUND_Y, ROT_AROUND_X_AND_Y, SAMPLE_UPPER_HEMESPHERE, ADAPTIVE_HEMESPHERE
 };
 
+enum ENVELOPE_RENDERER
+{
+	HIDDEN_VIEWER, SOFTWARE_RASTERIZER
+};
+
+// Per direction cache of the incremental search, segment envelopes under a frozen camera
+struct DirectionEnvelopes
+{
+	RasterCamera camera;
+	QMap< QString, SegmentDepth > segments;
+};
 
 class Offset: public QObject
 {
 	Q_OBJECT
 
 public:
-	Offset(HiddenViewer* viewer);
+	Offset(HiddenViewer* viewer = NULL);
+	~Offset();
 
 	// Stackability
 	double	computeStackability();
 	double	computeStackability(Vec3d direction);
 	double	getStackability(bool recompute = false);
+
+	// Batched search, each thread renders on its own rasterizer
+	void	computeMaxOffsets( QVector<Vec3d> & directions, double scale = 1.0 );
+	double	computeMaxOffset( Vec3d direction, DepthRasterizer * r );
+	double	stackabilityOf( Vec3d direction, double om, double V0 );
+
+	// Coarse to fine search, coarse directions are scored at low resolution
+	void	computeAdaptiveMaxOffsets( double V0 );
+	Vec3d	directionOnGrid( Vec2i g, QVector<double> & thetas );
+	void	fineNeighbours( Vec2i g, int nbPhi, int nbTheta, std::set< std::pair<int, int> > & coarse, std::set< std::pair<int, int> > & result );
+
+	// Incremental search, only the edited segments are rendered again
+	void	computeMaxOffsetsIncremental( QVector<Vec3d> & directions );
+	double	mergeSegmentEnvelopes( DirectionEnvelopes & cache );
+	void	invalidateIncremental();
 	
 	// Compute offset function and stackability
 	void computeEnvelope(int side);
 	void computeEnvelopeOfRegion( int side , Vec3d up, Vec3d direction, Vec3d bbmin, Vec3d bbmax );
 	void computeEnvelopeOfShape( int side, Vec3d up, Vec3d stacking_direction );
+	void computeEnvelopesOfShape( Vec3d up, Vec3d stacking_direction );
+	ObjectTranformation envelopeTransformation( int side, Vec3d up, Vec3d direction, Vec3d bbmin, Vec3d bbmax );
 	
 	void computeOffset();
 	void computeOffsetOfRegion( Vec3d direction, std::vector< Vec2i >& region );
@@ -52,12 +83,19 @@ public:
 	// Stacking directions
 	QVector<Vec3d> getDirectionsOnXYPlane();
 	QVector<Vec3d> getDirectionsInCone(double cone_size);
+	QVector<double> getElevationsInCone(double cone_size);
 
 	// Shortener
 	QSegMesh*	activeObject();
 	Controller* ctrl();
 	void		clear();
 
+	// Rendering
+	void	setActiveObject(QSegMesh * object);
+	void	renderDepth( ObjectTranformation & transformation );
+	int		bufferWidth();
+	int		bufferHeight();
+
 	// Utilities 
 	Vec3d unprojectedCoordinatesOf( uint x, uint y, int direction);
 	Vec2i projectedCoordinatesOf( Vec3d point, int pathID );
@@ -66,6 +104,8 @@ public:
 
 public:
 	HiddenViewer * activeViewer;
+	DepthRasterizer * rasterizer;
+	ENVELOPE_RENDERER renderer;
 
 	// Stackability
 	double O_max;
@@ -74,6 +114,21 @@ public:
 	SEARCH_TYPE searchType;
 	double coneSize;
 	int searchDensity;			// Number of samples in [0, PI]
+	bool isParallelSearch;
+	bool isIncremental;
+	bool isTiledEnvelope;		// The search renders in bands of rows
+	int tiledMemoryBudget;		// MB per search thread in tiled mode
+
+	// Results of the last direction search
+	QVector<Vec3d> searchDirections;
+	QVector<double> searchMaxOffset;
+	QVector<double> searchStackability;
+	int searchEvaluations;
+	int searchSavedEvaluations;
+
+	// Profiling, milliseconds spent in each stage since the last reset
+	QMap<QString, double> stageTimes;
+	void resetStageTimes();
 
 	// Buffers
 	Buffer2d upperEnvelope;
@@ -82,6 +137,12 @@ public:
 	Buffer2d lowerDepth;
 	Buffer2d offset; 	
 
+	// Visible faces, from the software rasterizer
+	Buffer2i upperFaces;
+	Buffer2i lowerFaces;
+	Image2<Vec2f> upperBarycentric;
+	Image2<Vec2f> lowerBarycentric;
+
 	// Hot stuff
 	std::map< QString, std::vector<Vec3d> > hotPoints;
 	Buffer2v2i hotRegions;
@@ -97,4 +158,22 @@ public slots:
 	void setSearchType(int type);
 	void setSearchDensity(int density);
 	void setConeSize(double size);
+	void setSoftwareRenderer(bool isSoftware);
+	void setParallelSearch(bool isParallel);
+	void setIncremental(bool isIncremental);
+	void setEnvelopeResolution(int newRes);
+	void setEnvelopeResolution(int w, int h);
+	void setTiledEnvelope(bool isTiled);
+	void setTiledMemoryBudget(int mb);
+
+private:
+	QSegMesh * m_activeObject;	// Used when there is no viewer
+	std::vector<DepthRasterizer*> rasterizerPool;
+	void prepareRasterizerPool( int w, int h );
+	void addStageTime( QString stage, QElapsedTimer & timer );
+
+	// Incremental search
+	QVector<DirectionEnvelopes> envelopeCache;
+	QMap<QString, uint> segmentSignatures;
+	Vec3d cacheBBmin, cacheBBmax;
 };
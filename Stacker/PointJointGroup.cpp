@@ -55,12 +55,12 @@ void PointJointGroup::draw()
 
 }
 
-void PointJointGroup::saveParameters( std::ofstream &outF )
+void PointJointGroup::saveParameters( std::ostream &outF )
 {
 	outF << getJointPos();
 }
 
-void PointJointGroup::loadParameters( std::ifstream &inF, Vec3d translation, double scaleFactor )
+void PointJointGroup::loadParameters( std::istream &inF, Vec3d translation, double scaleFactor )
 {
 	inF >> pos;
 	pos += translation;
@@ -144,6 +144,7 @@ void PointJointGroup::rejoint(QString sliderID)
 	if (slider->atEnd(1, p))
 	{
 		jointCoords[track->id] = track->getCoordinate(slider->fromCoordinate(jointCoords[sliderID]));
+		revision = newRevision();
 	}
 
 	// Freeze both slider and track
@@ -158,6 +159,7 @@ Group* PointJointGroup::clone()
 	g->id = this->id;
 	g->nodes = this->nodes;
 	g->jointCoords = this->jointCoords;
+	g->revision = this->revision;
 
 	return g;
 }
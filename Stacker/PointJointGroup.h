@@ -11,8 +11,8 @@ public:
 	void process(QVector< Primitive* > segments);
 	void regroup();
 	void draw();	
-	void saveParameters( std::ofstream &outF );
-	void loadParameters( std::ifstream &inF, Vec3d translation, double scaleFactor );
+	void saveParameters( std::ostream &outF );
+	void loadParameters( std::istream &inF, Vec3d translation, double scaleFactor );
 	Group* clone();
 
 	// Get
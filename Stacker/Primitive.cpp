@@ -1,5 +1,6 @@
 #include "Primitive.h"
 #include "Utility/SimpleDraw.h"
+#include <QVarLengthArray>
 
 Primitive::Primitive( QSurfaceMesh* mesh, QString newId )
 {
@@ -12,9 +13,20 @@ Primitive::Primitive( QSurfaceMesh* mesh, QString newId )
 
 	isDraw = true;
 
+	isDeferred = false;
+	isMeshDirty = false;
+
 	selectedCurveId = -1;
 }
 
+void Primitive::setDeferred( bool isDeferred )
+{
+	this->isDeferred = isDeferred;
+
+	// Pending deformation
+	if(!isDeferred && isMeshDirty) deformMesh();
+}
+
 void Primitive::drawDebug()
 {
 	// Debug points
@@ -82,10 +94,11 @@ void Primitive::addFixedPoint( Point fp )
 	fixedPoints.push_back(fp);
 }
 
-double Primitive::similarity( void* state1, void* state2 )
+double Primitive::similarity( PrimitiveState state1, PrimitiveState state2 )
 {
 	// Save the current state
-	void* state = getState();
+	QVarLengthArray<double, 64> state(stateSize());
+	getState(state.data());
 	
 	std::vector<Vec3d> points1, points2;
 	setState(state1);
@@ -98,7 +111,7 @@ double Primitive::similarity( void* state1, void* state2 )
 		result += (points1[i] - points2[i]).norm();
 	
 	// Restore the current state
-	setState(state);
+	setState(PrimitiveState(primType, state.size(), state.data()));
 
 	return result;
 }
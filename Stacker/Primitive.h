@@ -8,8 +8,6 @@
 
 #include <QTextStream>
 
-enum PrimType{ CUBOID, GCYLINDER, WIRE};
-
 
 class Primitive
 {
@@ -23,6 +21,11 @@ public:
 	// Deform the underlying geometry according to the \pre_state and current state
 	virtual void deformMesh() = 0;
 
+	// Deferred deformation, the mesh is left as is until the primitive leaves this mode
+	bool isDeferred;
+	bool isMeshDirty;
+	void setDeferred( bool isDeferred );
+
 	// Visualize the primitive and potential actions
 	virtual void draw() = 0;
 	virtual	void drawNames(int name, bool isDrawParts = false) = 0;
@@ -44,9 +47,10 @@ public:
 	virtual std::vector<double> getCoordinate( Point v ) = 0;
 	virtual Point fromCoordinate(std::vector<double> &coords) = 0;
 
-	// Primitive state
-	virtual void*	getState() = 0;
-	virtual void	setState( void* state) = 0;
+	// Primitive state, a flat list of stateSize() parameters
+	virtual int		stateSize() = 0;
+	virtual void	getState( double * state ) = 0;
+	virtual void	setState( PrimitiveState state ) = 0;
 
 	// Primitive geometry
 	double	originalVolume;
@@ -76,7 +80,7 @@ public:
 	virtual void	addFixedCurve(int cid);
 
 	// Similarity between two primitives
-	double similarity(void* state1, void* state2);
+	double similarity(PrimitiveState state1, PrimitiveState state2);
 
 	// Helpful for debugging
 	std::vector<Vec3d> debugPoints, debugPoints2, debugPoints3;
@@ -90,8 +94,8 @@ public:
 	virtual Point	getSelectedCurveCenter() = 0;
 
 	// Save and load
-	virtual void save(std::ofstream &outF) = 0;
-	virtual void load(std::ifstream &inF, Vec3d translation, double scaleFactor) = 0;
+	virtual void save(std::ostream &outF) = 0;
+	virtual void load(std::istream &inF, Vec3d translation, double scaleFactor) = 0;
 	virtual void	serialize( QTextStream &out) = 0;
 	virtual void	unserialize( QTextStream &in) = 0;
 
@@ -0,0 +1,102 @@
+#include "PrimitiveState.h"
+#include <new>
+#include "Utility/Macros.h"
+
+#define STATE_BLOCK_GRANULARITY 16		// Capacities are rounded to this many values
+#define STATE_ARENA_MAX_POOLED 4096		// Beyond this, released blocks are freed
+
+StateArena & StateArena::instance()
+{
+	static StateArena arena;
+	return arena;
+}
+
+StateArena::~StateArena()
+{
+	freePool();
+}
+
+StateBlock * StateArena::acquire( int size )
+{
+	StateArena & arena = instance();
+	int capacity = Max(1, (size + STATE_BLOCK_GRANULARITY - 1) / STATE_BLOCK_GRANULARITY) * STATE_BLOCK_GRANULARITY;
+
+	StateBlock * block = NULL;
+	{
+		QMutexLocker locker(&arena.mutex);
+
+		std::vector<StateBlock*> & blocks = arena.pool[capacity];
+		if(!blocks.empty())
+		{
+			block = blocks.back();
+			blocks.pop_back();
+			arena.numPooled--;
+		}
+
+		arena.numLive++;
+	}
+
+	if(!block)
+	{
+		block = (StateBlock *) ::operator new(sizeof(StateBlock) + capacity * sizeof(double));
+		new (&block->ref) QAtomicInt(0);
+		block->capacity = capacity;
+	}
+
+	block->ref = 1;
+	return block;
+}
+
+void StateArena::release( StateBlock * block )
+{
+	StateArena & arena = instance();
+
+	{
+		QMutexLocker locker(&arena.mutex);
+		arena.numLive--;
+
+		if(arena.numPooled < STATE_ARENA_MAX_POOLED)
+		{
+			arena.pool[block->capacity].push_back(block);
+			arena.numPooled++;
+			return;
+		}
+	}
+
+	::operator delete(block);
+}
+
+void StateArena::trim()
+{
+	StateArena & arena = instance();
+	QMutexLocker locker(&arena.mutex);
+	arena.freePool();
+}
+
+void StateArena::freePool()
+{
+	QMapIterator< int, std::vector<StateBlock*> > it(pool);
+	while(it.hasNext())
+	{
+		const std::vector<StateBlock*> & blocks = it.next().value();
+		for(int i = 0; i < (int)blocks.size(); i++)
+			::operator delete(blocks[i]);
+	}
+
+	pool.clear();
+	numPooled = 0;
+}
+
+int StateArena::liveBlocks()
+{
+	StateArena & arena = instance();
+	QMutexLocker locker(&arena.mutex);
+	return arena.numLive;
+}
+
+int StateArena::pooledBlocks()
+{
+	StateArena & arena = instance();
+	QMutexLocker locker(&arena.mutex);
+	return arena.numPooled;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <QMap>
+#include <QString>
+#include <QMutex>
+#include <QAtomicInt>
+
+enum PrimType{ CUBOID, GCYLINDER, WIRE};
+
+// Parameters of one primitive, a typed view into a state block
+struct PrimitiveState
+{
+	PrimitiveState( PrimType t = CUBOID, int n = 0, const double * v = NULL ) : type(t), size(n), values(v) {}
+	bool isNull() const { return values == NULL; }
+
+	PrimType type;
+	int size;
+	const double * values;
+};
+
+// Position of the parameters of each primitive in a state block
+struct StateSlot
+{
+	PrimType type;
+	int offset;
+	int size;
+};
+
+typedef QMap<QString, StateSlot> StateLayout;
+
+// Reference counted parameters, the values follow the header in memory
+struct StateBlock
+{
+	QAtomicInt ref;
+	int capacity;
+	double * values() { return (double *)(this + 1); }
+};
+
+// Pool of state blocks. Released blocks are kept for the next snapshot instead of
+// being freed, so a long search reuses the same memory.
+class StateArena
+{
+public:
+	static StateBlock * acquire( int size );
+	static void release( StateBlock * block );
+
+	// Free the pooled blocks
+	static void trim();
+
+	// Statistics
+	static int liveBlocks();
+	static int pooledBlocks();
+
+private:
+	StateArena() : numLive(0), numPooled(0) {}
+	~StateArena();
+	static StateArena & instance();
+	void freePool();
+
+	QMutex mutex;
+	QMap< int, std::vector<StateBlock*> > pool;	// Free blocks by capacity
+	int numLive, numPooled;
+};
@@ -1,19 +1,100 @@
 #include "ShapeState.h"
 #include <iostream>
+#include <cstring>
+#include "Utility/Macros.h"
+
+ShapeState::ShapeState() : stackability(0), deltaStackability(0), distortion(0), block(NULL), blockSize(0)
+{
+}
+
+ShapeState::ShapeState( const ShapeState & other ) : layout(other.layout), groups(other.groups),
+	stacking_shift(other.stacking_shift), stackability(other.stackability), deltaStackability(other.deltaStackability),
+	distortion(other.distortion), path(other.path), block(other.block), blockSize(other.blockSize)
+{
+	if(block) block->ref.ref();
+}
+
+ShapeState & ShapeState::operator=( const ShapeState & other )
+{
+	if(other.block) other.block->ref.ref();
+	if(block && !block->ref.deref()) StateArena::release(block);
+
+	layout = other.layout;
+	groups = other.groups;
+	stacking_shift = other.stacking_shift;
+	stackability = other.stackability;
+	deltaStackability = other.deltaStackability;
+	distortion = other.distortion;
+	path = other.path;
+	block = other.block;
+	blockSize = other.blockSize;
+
+	return *this;
+}
+
+ShapeState::~ShapeState()
+{
+	if(block && !block->ref.deref()) StateArena::release(block);
+}
+
+void ShapeState::allocate( const StateLayout & newLayout )
+{
+	if(block && !block->ref.deref()) StateArena::release(block);
+
+	layout = newLayout;
+	blockSize = 0;
+	foreach(const StateSlot & slot, layout)
+		blockSize = Max(blockSize, slot.offset + slot.size);
+
+	block = StateArena::acquire(blockSize);
+}
+
+// Written blocks are never shared
+void ShapeState::detach()
+{
+	if(!block || block->ref == 1) return;
+
+	StateBlock * copy = StateArena::acquire(blockSize);
+	memcpy(copy->values(), block->values(), blockSize * sizeof(double));
+
+	if(!block->ref.deref()) StateArena::release(block);
+	block = copy;
+}
+
+bool ShapeState::hasPrimState( const QString & id ) const
+{
+	return block && layout.contains(id);
+}
+
+PrimitiveState ShapeState::primState( const QString & id ) const
+{
+	if(!hasPrimState(id)) return PrimitiveState();
+
+	StateSlot slot = layout.value(id);
+	return PrimitiveState(slot.type, slot.size, block->values() + slot.offset);
+}
+
+double * ShapeState::primValues( const QString & id )
+{
+	if(!hasPrimState(id)) return NULL;
+
+	detach();
+	return block->values() + layout.value(id).offset;
+}
 
 
-double ShapeState::energy()
+double ShapeState::energy() const
 {
 	double alpha = 1;
 	return  deltaStackability * alpha - distortion * (1-alpha);
 }
 
-bool lessEnergy::operator()(ShapeState a, ShapeState b)
+bool lessEnergy::operator()(const ShapeState & a, const ShapeState & b) const
 {
 	return a.energy() < b.energy();
 }
 
-bool lessDistortion::operator()(ShapeState a, ShapeState b)
+bool lessDistortion::operator()(const ShapeState & a, const ShapeState & b) const
 {
 	return a.distortion < b.distortion;
 }
\ No newline at end of file
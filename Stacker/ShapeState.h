@@ -3,19 +3,33 @@
 #include <QMap>
 #include <QVector>
 #include <QString>
+#include <QSharedPointer>
 #include <queue>
 #include "Stacker/EditPath.h"
+#include "Stacker/PrimitiveState.h"
 
 class Group;
 
+// Snapshot of a shape. Copies are cheap: the parameters of all primitives live in one
+// reference counted block from the StateArena that is only copied when written to,
+// and the groups are immutable copies shared between snapshots.
 class ShapeState
 {
 public:
+	ShapeState();
+	ShapeState( const ShapeState & other );
+	ShapeState & operator=( const ShapeState & other );
+	~ShapeState();
+
 	// Geometry
-	QMap< QString, void* > primStates;
+	StateLayout layout;
+	void			allocate( const StateLayout & newLayout );
+	bool			hasPrimState( const QString & id ) const;
+	PrimitiveState	primState( const QString & id ) const;
+	double *		primValues( const QString & id );
 
 	// Groups
-	QMap<QString, Group*> groups;
+	QMap<QString, QSharedPointer<Group> > groups;
 
 	// Stacking
 	Vec3d stacking_shift;
@@ -24,21 +38,25 @@ public:
 	// Energy
 	double deltaStackability;
 	double distortion;
-	double energy();
+	double energy() const;
 
 	// Editing path from parent
 	EditPath path;
 
+private:
+	StateBlock * block;
+	int blockSize;
+	void detach();
 };
 
 struct lessDistortion
 {
-	bool operator () (ShapeState a, ShapeState b);
+	bool operator () (const ShapeState & a, const ShapeState & b) const;
 };
 
 struct lessEnergy
 {
-	bool operator () (ShapeState a, ShapeState b);
+	bool operator () (const ShapeState & a, const ShapeState & b) const;
 };
 
 typedef std::priority_queue< ShapeState, QVector<ShapeState>, lessEnergy >		PQShapeStateLessEnergy;
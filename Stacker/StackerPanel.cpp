@@ -43,10 +43,12 @@ StackerPanel::StackerPanel()
 	hiddenDock->setWindowOpacity(1.0);
 	int x = qApp->desktop()->availableGeometry().width();
 	hiddenDock->move(QPoint(x - hiddenDock->width(),0)); //Move the hidden dock to the top right conner
-	connect(panel.hidderViewerResolution, SIGNAL(valueChanged(int)), hiddenViewer, SLOT(setResolution(int)));
 
 	// Offset function calculator
 	activeOffset = new Offset(hiddenViewer);
+	connect(panel.hidderViewerResolution, SIGNAL(valueChanged(int)), activeOffset, SLOT(setEnvelopeResolution(int)));
+	connect(panel.softwareRenderer, SIGNAL(toggled(bool)), activeOffset, SLOT(setSoftwareRenderer(bool)));
+	connect(panel.tiledEnvelope, SIGNAL(toggled(bool)), activeOffset, SLOT(setTiledEnvelope(bool)));
 
 	// Improve and suggest
 	connect(panel.showPaths, SIGNAL(stateChanged(int)), SLOT(updateActiveObject()));
@@ -57,6 +59,9 @@ StackerPanel::StackerPanel()
 	connect(panel.BBTolerance, SIGNAL(valueChanged(double)), improver, SLOT(setBBTolerance(double)) );
 	connect(panel.numExpectedSolutions, SIGNAL(valueChanged(int)), improver, SLOT(setNumExpectedSolutions(int)) );
 	connect(panel.localRadius, SIGNAL(valueChanged(int)), improver, SLOT(setLocalRadius(int)) );
+	connect(panel.uniqueThreshold, SIGNAL(valueChanged(double)), improver, SLOT(setUniqueThreshold(double)) );
+	connect(panel.parallelImprove, SIGNAL(toggled(bool)), improver, SLOT(setParallelSearch(bool)) );
+	connect(panel.deferredImprove, SIGNAL(toggled(bool)), improver, SLOT(setDeferredDeformation(bool)) );
 	
 	// Stacking direction
 	connect(panel.searchType, SIGNAL(valueChanged(int)), activeOffset, SLOT(setSearchType(int)));
@@ -73,7 +78,8 @@ StackerPanel::StackerPanel()
 	panel.BBTolerance->setValue(improver->BB_TOLERANCE);
 	panel.targetS->setValue(improver->TARGET_STACKABILITY);
 	panel.localRadius->setValue(improver->LOCAL_RADIUS);
-	panel.hidderViewerResolution->setValue(hiddenViewer->height());
+	panel.uniqueThreshold->setValue(improver->UNIQUE_THRESHOLD);
+	panel.hidderViewerResolution->setValue(activeOffset->bufferHeight());
 	panel.stackCount->setValue(previewer->stackCount);
 	panel.searchType->setValue(activeOffset->searchType);
 }
@@ -189,8 +195,8 @@ void StackerPanel::outputForPaper()
 	data["Stackability"] = QString::number(activeObject()->val["stackability"]);
 
 	// Save visualized 3D offset function:
-	int w = activeOffset->offset.front().size();
-	int h = activeOffset->offset.size();
+	int w = activeOffset->offset.width();
+	int h = activeOffset->offset.height();
 	double q = 1.0 / Max(w,h);
 	QStringList vertices, faces;
 
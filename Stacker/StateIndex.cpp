@@ -0,0 +1,115 @@
+#include "StateIndex.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+StateIndex::StateIndex()
+{
+	clear();
+}
+
+void StateIndex::clear()
+{
+	items.clear();
+	trees.clear();
+}
+
+int StateIndex::size() const
+{
+	return items.size();
+}
+
+double StateIndex::distance( const std::vector<double> & a, const std::vector<double> & b )
+{
+	// Different primitives, not comparable
+	if(a.size() != b.size()) return std::numeric_limits<double>::max();
+
+	double result = 0;
+	for(int i = 0; i + 2 < (int)a.size(); i += 3)
+	{
+		double dx = a[i] - b[i], dy = a[i+1] - b[i+1], dz = a[i+2] - b[i+2];
+		result += sqrt(dx*dx + dy*dy + dz*dz);
+	}
+
+	return result;
+}
+
+void StateIndex::insert( const std::vector<double> & state )
+{
+	items.push_back(state);
+
+	// Merge the trees of the same size as the new one, smallest first
+	std::vector<int> ids(1, items.size() - 1);
+
+	while(!trees.empty() && trees.back().ids.size() == ids.size())
+	{
+		ids.insert(ids.end(), trees.back().ids.begin(), trees.back().ids.end());
+		trees.pop_back();
+	}
+
+	trees.push_back(Tree());
+	Tree & tree = trees.back();
+	tree.nodes.reserve(ids.size());
+	tree.ids = ids;
+	tree.root = build(tree, ids, 0, ids.size());
+}
+
+int StateIndex::build( Tree & tree, std::vector<int> & ids, int begin, int end )
+{
+	if(begin >= end) return -1;
+
+	Node node;
+	node.item = ids[begin];
+	node.radius = 0;
+	node.inside = node.outside = -1;
+
+	int index = tree.nodes.size();
+	tree.nodes.push_back(node);
+
+	if(end - begin == 1) return index;
+
+	// Split the others at the median distance to the vantage point
+	std::vector< std::pair<double,int> > closer;
+	for(int i = begin + 1; i < end; i++)
+		closer.push_back(std::make_pair(distance(items[node.item], items[ids[i]]), ids[i]));
+
+	int median = (end - begin - 1) / 2;
+	std::nth_element(closer.begin(), closer.begin() + median, closer.end());
+
+	for(int i = 0; i < (int)closer.size(); i++)
+		ids[begin + 1 + i] = closer[i].second;
+
+	double radius = closer[median].first;
+	int inside = build(tree, ids, begin + 1, begin + 1 + median);
+	int outside = build(tree, ids, begin + 1 + median, end);
+
+	tree.nodes[index].radius = radius;
+	tree.nodes[index].inside = inside;
+	tree.nodes[index].outside = outside;
+
+	return index;
+}
+
+bool StateIndex::search( const Tree & tree, int node, const std::vector<double> & state, double threshold ) const
+{
+	if(node < 0) return false;
+
+	const Node & n = tree.nodes[node];
+	double d = distance(state, items[n.item]);
+	if(d < threshold) return true;
+
+	// Triangle inequality, a branch is skipped when all its states are too far
+	if(d < n.radius + threshold && search(tree, n.inside, state, threshold)) return true;
+	if(d >= n.radius - threshold && search(tree, n.outside, state, threshold)) return true;
+
+	return false;
+}
+
+bool StateIndex::hasWithin( const std::vector<double> & state, double threshold ) const
+{
+	for(int i = 0; i < (int)trees.size(); i++)
+		if(search(trees[i], trees[i].root, state, threshold)) return true;
+
+	return false;
+}
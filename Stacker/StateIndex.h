@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+// Metric index over shape states, for the uniqueness test of the Improver
+// A state is the list of the points of all primitives (Controller::stateFeature) and the
+// distance is the one of Controller::similarity, the sum of the point distances.
+// States are kept in vantage point trees of distinct power of two sizes. A new state is a
+// tree of its own, trees of the same size are merged like the digits of a binary counter,
+// so each state is rebuilt O(log n) times and a query searches O(log n) trees.
+class StateIndex
+{
+public:
+	StateIndex();
+
+	void clear();
+	void insert( const std::vector<double> & state );
+	int size() const;
+
+	// Is any indexed state closer than \threshold to \state
+	bool hasWithin( const std::vector<double> & state, double threshold ) const;
+
+	static double distance( const std::vector<double> & a, const std::vector<double> & b );
+
+private:
+	struct Node
+	{
+		int item;
+		double radius;
+		int inside, outside;
+	};
+
+	struct Tree
+	{
+		std::vector<int> ids;
+		std::vector<Node> nodes;
+		int root;
+	};
+
+	std::vector< std::vector<double> > items;
+	std::vector<Tree> trees;		// Decreasing sizes, the smallest is last
+
+	int build( Tree & tree, std::vector<int> & ids, int begin, int end );
+	bool search( const Tree & tree, int node, const std::vector<double> & state, double threshold ) const;
+};
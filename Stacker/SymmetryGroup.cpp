@@ -123,6 +123,7 @@ Group* SymmetryGroup::clone()
 	g->nodes = this->nodes;
 	g->symmetryPlane = this->symmetryPlane;
 	g->correspondence = this->correspondence;
+	g->revision = this->revision;
 
 	return g;
 }
@@ -12,11 +12,13 @@ HEADERS += ./GUI/global.h \
     ./GraphicsLibrary/Mesh/SurfaceMesh/Quadric.h \
     ./GraphicsLibrary/Mesh/SurfaceMesh/Surface_mesh.h \
     ./GraphicsLibrary/Mesh/SurfaceMesh/Vector.h \
+    ./GraphicsLibrary/Mesh/MeshReader.h \
     ./GraphicsLibrary/Basic/Line.h \
     ./GraphicsLibrary/Basic/Plane.h \
     ./GraphicsLibrary/Basic/PolygonArea.h \
     ./GraphicsLibrary/Basic/Triangle.h \
     ./GraphicsLibrary/SpacePartition/Octree.h \
+    ./GraphicsLibrary/SpacePartition/AABBTree.h \
     ./GraphicsLibrary/Sampling/EdgeSampler.h \
     ./GraphicsLibrary/Sampling/RegularRecursive.h \
     ./GraphicsLibrary/Sampling/Sampler.h \
@@ -25,6 +27,8 @@ HEADERS += ./GUI/global.h \
     ./GraphicsLibrary/Sampling/VoxelSampling.h \
     ./GraphicsLibrary/Voxel/Voxel.h \
     ./GraphicsLibrary/Voxel/Voxeler.h \
+    ./GraphicsLibrary/Voxel/VoxelSet.h \
+    ./GraphicsLibrary/Voxel/VoxelBitset.h \
     ./GraphicsLibrary/Skeleton/ClosedPolygon.h \
     ./GraphicsLibrary/Skeleton/GeneralizedCylinder.h \
     ./GraphicsLibrary/Skeleton/PriorityQueue.h \
@@ -34,6 +38,7 @@ HEADERS += ./GUI/global.h \
     ./GraphicsLibrary/Skeleton/SkeletonExtract.h \
     ./GraphicsLibrary/Skeleton/SkeletonNode.h \
     ./GraphicsLibrary/Skeleton/VertexRecord.h \
+    ./GraphicsLibrary/Skeleton/ContractionSolver.h \
     ./Utility/ColorMap.h \
     ./Utility/Graph.h \
     ./Utility/HashTable.h \
@@ -49,9 +54,6 @@ HEADERS += ./GUI/global.h \
     ./MathLibrary/Bounding/ConvexHull3.h \
     ./MathLibrary/Bounding/MinOBB2.h \
     ./MathLibrary/Bounding/MinOBB3.h \
-    ./MathLibrary/Bounding/OBB.h \
-    ./MathLibrary/Bounding/OBB2.h \
-    ./MathLibrary/Bounding/OBB2_math.h \
     ./MathLibrary/Deformer/DeformerPanel.h \
     ./MathLibrary/Deformer/QVoxelDeformerPanel.h \
     ./MathLibrary/Deformer/VoxelDeformer.h \
@@ -59,24 +61,59 @@ HEADERS += ./GUI/global.h \
     ./MathLibrary/Deformer/QFFD.h \
     ./MathLibrary/Deformer/QControlPoint.h \
     ./MathLibrary/Coordiantes/GCDeformation.h \
-    ./Stacker/EditSuggestion.h \
     ./Stacker/Offset.h \
     ./Stacker/ShapeState.h \
     ./Stacker/HiddenViewer.h \
     ./Stacker/StackerPanel.h \
-    ./Stacker/StackerPreview.h \
     ./Stacker/ControllerPanel.h \
     ./Stacker/GroupPanel.h \
-    ./Stacker/QDeformController.h \
     ./Stacker/ConcentricGroup.h \
     ./Stacker/CoplanarGroup.h \
     ./Stacker/Group.h \
-    ./Stacker/JointGroup.h \
     ./Stacker/SymmetryGroup.h \
     ./Stacker/Controller.h \
     ./Stacker/Cuboid.h \
     ./Stacker/Primitive.h \
-    ./Stacker/GCylinder.h
+    ./Stacker/GCylinder.h \
+    ./Stacker/DepthRasterizer.h \
+    ./Stacker/Image2.h \
+    ./GUI/MeshBrowser/MeshBrowserWidget.h \
+    ./GUI/MeshBrowser/QuickMesh.h \
+    ./GUI/MeshBrowser/QuickMeshViewer.h \
+    ./GraphicsLibrary/Basic/Circle.h \
+    ./GraphicsLibrary/Decimation/Decimater.h \
+    ./GraphicsLibrary/Decimation/SimpleMatrix.h \
+    ./GraphicsLibrary/Remeshing/LaplacianRemesher.h \
+    ./GraphicsLibrary/Smoothing/Smoother.h \
+    ./GraphicsLibrary/Subdivision/LongestEdgeSubdivision.h \
+    ./GraphicsLibrary/Subdivision/LoopSubdivision.h \
+    ./GraphicsLibrary/Subdivision/ModifiedButterflySubdivision.h \
+    ./GraphicsLibrary/Subdivision/Sqrt3Subdivision.h \
+    ./GraphicsLibrary/Subdivision/SubdivisionAlgorithms.h \
+    ./MathLibrary/Bounding/Box3.h \
+    ./MathLibrary/Bounding/OBB_PCA.h \
+    ./MathLibrary/Bounding/OBB_Volume.h \
+    ./MathLibrary/Bounding/OBB_Volume_math.h \
+    ./MathLibrary/Coordiantes/MeanValueCoordinates.h \
+    ./MathLibrary/Coordiantes/CoordinateMatrix.h \
+    ./MathLibrary/Coordiantes/CoordinateCache.h \
+    ./MathLibrary/Deformer/DualQuat.h \
+    ./MathLibrary/Deformer/Skinning.h \
+    ./MathLibrary/PCA3.h \
+    ./Stacker/ConstraintGraph.h \
+    ./Stacker/ConstraintGraphVis.h \
+    ./Stacker/EditPath.h \
+    ./Stacker/HotSpot.h \
+    ./Stacker/Improver.h \
+    ./Stacker/JointDetector.h \
+    ./Stacker/LineJointGroup.h \
+    ./Stacker/Numeric.h \
+    ./Stacker/PointJointGroup.h \
+    ./Stacker/Previewer.h \
+    ./Stacker/Propagator.h \
+    ./Stacker/QManualDeformer.h \
+    ./Stacker/PrimitiveState.h \
+    ./Stacker/StateIndex.h
 SOURCES += ./GUI/global.cpp \
     ./GUI/main.cpp \
     ./GUI/QMeshDoc.cpp \
@@ -92,18 +129,22 @@ SOURCES += ./GUI/global.cpp \
     ./GraphicsLibrary/Mesh/SurfaceMesh/IO_off.cpp \
     ./GraphicsLibrary/Mesh/SurfaceMesh/IO_stl.cpp \
     ./GraphicsLibrary/Mesh/SurfaceMesh/Surface_mesh.cpp \
+    ./GraphicsLibrary/Mesh/MeshReader.cpp \
     ./GraphicsLibrary/Basic/Line.cpp \
     ./GraphicsLibrary/Basic/Plane.cpp \
     ./GraphicsLibrary/Basic/Triangle.cpp \
     ./GraphicsLibrary/SpacePartition/kdtree.cpp \
     ./GraphicsLibrary/SpacePartition/Octree.cpp \
+    ./GraphicsLibrary/SpacePartition/AABBTree.cpp \
     ./GraphicsLibrary/Sampling/Sampler.cpp \
     ./GraphicsLibrary/Voxel/Voxeler.cpp \
+    ./GraphicsLibrary/Voxel/VoxelBitset.cpp \
     ./GraphicsLibrary/Skeleton/ClosedPolygon.cpp \
     ./GraphicsLibrary/Skeleton/GeneralizedCylinder.cpp \
     ./GraphicsLibrary/Skeleton/PriorityQueue.cpp \
     ./GraphicsLibrary/Skeleton/Skeleton.cpp \
     ./GraphicsLibrary/Skeleton/SkeletonExtract.cpp \
+    ./GraphicsLibrary/Skeleton/ContractionSolver.cpp \
     ./Utility/ColorMap.cpp \
     ./Utility/SimpleDraw.cpp \
     ./Utility/Stats.cpp \
@@ -120,27 +161,46 @@ SOURCES += ./GUI/global.cpp \
     ./MathLibrary/Deformer/FFD.cpp \
     ./MathLibrary/Deformer/QFFD.cpp \
     ./MathLibrary/Coordiantes/GCDeformation.cpp \
-    ./Stacker/EditSuggestion.cpp \
+    ./MathLibrary/Coordiantes/CoordinateCache.cpp \
     ./Stacker/HiddenViewer.cpp \
     ./Stacker/Offset.cpp \
     ./Stacker/ShapeState.cpp \
     ./Stacker/StackerPanel.cpp \
-    ./Stacker/StackerPreview.cpp \
     ./Stacker/ControllerPanel.cpp \
     ./Stacker/GroupPanel.cpp \
-    ./Stacker/QDeformController.cpp \
     ./Stacker/ConcentricGroup.cpp \
     ./Stacker/CoplanarGroup.cpp \
     ./Stacker/Group.cpp \
-    ./Stacker/JointGroup.cpp \
     ./Stacker/SymmetryGroup.cpp \
     ./Stacker/Controller.cpp \
     ./Stacker/Cuboid.cpp \
     ./Stacker/GCylinder.cpp \
-    ./Stacker/Primitive.cpp
+    ./Stacker/Primitive.cpp \
+    ./Stacker/DepthRasterizer.cpp \
+    ./GUI/MeshBrowser/MeshBrowserWidget.cpp \
+    ./GUI/MeshBrowser/QuickMeshViewer.cpp \
+    ./GraphicsLibrary/Basic/Circle.cpp \
+    ./GraphicsLibrary/Smoothing/Smoother.cpp \
+    ./MathLibrary/Bounding/Box3.cpp \
+    ./MathLibrary/Deformer/Skinning.cpp \
+    ./Stacker/ConstraintGraph.cpp \
+    ./Stacker/ConstraintGraphVis.cpp \
+    ./Stacker/EditPath.cpp \
+    ./Stacker/HotSpot.cpp \
+    ./Stacker/Improver.cpp \
+    ./Stacker/JointDetector.cpp \
+    ./Stacker/LineJointGroup.cpp \
+    ./Stacker/Numeric.cpp \
+    ./Stacker/PointJointGroup.cpp \
+    ./Stacker/Previewer.cpp \
+    ./Stacker/Propagator.cpp \
+    ./Stacker/QManualDeformer.cpp \
+    ./Stacker/PrimitiveState.cpp \
+    ./Stacker/StateIndex.cpp
 FORMS += ./GUI/Workspace.ui \
     ./GUI/Tools/RotationWidget.ui \
     ./GUI/Tools/MeshInfo.ui \
+    ./GUI/MeshBrowser/MeshBrowserForm.ui \
     ./MathLibrary/Deformer/DeformerWidget.ui \
     ./MathLibrary/Deformer/QVoxelDeformerWidget.ui \
     ./Stacker/ControllerWidget.ui \
@@ -33,6 +33,12 @@ unix {
     LIBS += -lGLEW -lGLU -lGL -lQGLViewer
 }
 
+win32:QMAKE_CXXFLAGS += /openmp
+unix {
+    QMAKE_CXXFLAGS += -fopenmp
+    LIBS += -fopenmp
+}
+
 DEPENDPATH += .
 MOC_DIR += ./GeneratedFiles/debug
 OBJECTS_DIR += debug